@@ -65,7 +65,8 @@ SSqlException SMySQL::sPerrorException(const string &reason)
 
 int SMySQL::doCommand(const string &query)
 {
-  return doQuery(query);
+  doQuery(query);
+  return (int)mysql_affected_rows(&d_db);
 }
 
 int SMySQL::doQuery(const string &query)
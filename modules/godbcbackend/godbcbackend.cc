@@ -73,6 +73,7 @@ public:
     declare( suffix, "update-lastcheck-query", "", "update domains set last_check=%d where id=%d");
     declare( suffix, "info-all-master-query", "", "select id,name,master,last_check,notified_serial,type from domains where type='MASTER'");
     declare( suffix, "delete-zone-query", "", "delete from records where domain_id=%d");
+    declare( suffix, "delete-record-query", "", "delete from records where domain_id=%d and name='%s' and type='%s' and content='%s' and prio=%d");
   }
   
   //! Constructs a new gODBCBackend object.
@@ -185,9 +185,13 @@ int SODBC::doCommand( const std::string & command )
 
   testResult( result, "Could not execute query." );
 
+  SQLLEN rows;
+  if ( SQLRowCount( m_statement, &rows ) != SQL_SUCCESS )
+    rows = -1;
+
   SQLFreeStmt( m_statement, SQL_CLOSE );
 
-  return 0;
+  return rows;
 }
 
 // Escapes a SQL string.
@@ -69,6 +69,7 @@ public:
     declare(suffix,"zone-lastchange-query", "", "select max(change_date) from records where domain_id=%d");
     declare(suffix,"info-all-master-query","", "select id,name,master,last_check,notified_serial,type from domains where type='MASTER'");
     declare(suffix,"delete-zone-query","", "delete from records where domain_id=%d");
+    declare(suffix,"delete-record-query","", "delete from records where domain_id=%d and name='%s' and type='%s' and content='%s' and prio=%d");
   }
   
   DNSBackend *make(const string &suffix="")
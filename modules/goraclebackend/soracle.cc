@@ -112,7 +112,14 @@ SSqlException SOracle::sPerrorException(const string &reason)
 
 int SOracle::doCommand(const string &query)
 {
-  return doQuery(query);
+  doQuery(query);
+  if(query=="begin") // doQuery skips this one
+    return 0;
+
+  ub4 rows;
+  if(OCIAttrGet(d_handle, OCI_HTYPE_STMT, &rows, 0, OCI_ATTR_ROW_COUNT, d_errorHandle))
+    return -1;
+  return rows;
 }
 
 int getNumFields(const string& query)
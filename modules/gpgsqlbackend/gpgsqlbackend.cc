@@ -94,17 +94,23 @@ public:
     declare(suffix,"get-order-before-query","DNSSEC Ordering Query, before", "select ordername, name from records where ordername ~<=~ E'%s' and domain_id=%d and ordername is not null order by 1 using ~>~ limit 1");
     declare(suffix,"get-order-after-query","DNSSEC Ordering Query, after", "select ordername from records where ordername ~>~ E'%s' and domain_id=%d and ordername is not null order by 1 using ~<~ limit 1");
     declare(suffix,"get-order-last-query","DNSSEC Ordering Query, last", "select ordername, name from records where ordername != '' and domain_id=%d and ordername is not null order by 1 using ~>~ limit 1");
+    declare(suffix,"get-order-names-query","DNSSEC Ordering Query, all", "select ordername, name from records where ordername != '' and domain_id=%d and ordername is not null");
     declare(suffix,"set-order-and-auth-query", "DNSSEC set ordering query", "update records set ordername=E'%s',auth=(%d = 1) where name=E'%s' and domain_id='%d'");
     declare(suffix,"set-auth-on-ds-record-query", "DNSSEC set auth on a DS record", "update records set auth=true where domain_id='%d' and name='%s' and type='DS'");
 
     declare(suffix,"nullify-ordername-and-update-auth-query", "DNSSEC nullify ordername and update auth query", "update records set ordername=NULL,auth=(%d = 1) where domain_id='%d' and name='%s'");
     declare(suffix,"nullify-ordername-and-auth-query", "DNSSEC nullify ordername and auth query", "update records set ordername=NULL,auth=false where name=E'%s' and type=E'%s' and domain_id='%d'");
+    declare(suffix,"set-order-and-auth-batch-query", "DNSSEC set ordering for many names", "update records set ordername=case name %s end,auth=(%d = 1) where domain_id=%d and name in (%s)");
+    declare(suffix,"nullify-ordername-and-update-auth-batch-query", "DNSSEC nullify ordername and update auth for many names", "update records set ordername=NULL,auth=(%d = 1) where domain_id=%d and name in (%s)");
+    declare(suffix,"nullify-ordername-and-auth-batch-query", "DNSSEC nullify ordername and auth for many names", "update records set ordername=NULL,auth=false where domain_id=%d and type in (%s) and name in (%s)");
+    declare(suffix,"set-auth-on-ds-record-batch-query", "DNSSEC set auth on the DS records of many names", "update records set auth=true where domain_id=%d and type='DS' and name in (%s)");
     
     declare(suffix,"update-serial-query","", "update domains set notified_serial=%d where id=%d");
     declare(suffix,"update-lastcheck-query","", "update domains set last_check=%d where id=%d");
     declare(suffix,"zone-lastchange-query", "", "select max(change_date) from records where domain_id=%d");
     declare(suffix,"info-all-master-query","", "select id,name,master,last_check,notified_serial,type from domains where type='MASTER'");
     declare(suffix,"delete-zone-query","", "delete from records where domain_id=%d");
+    declare(suffix,"delete-record-query","", "delete from records where domain_id=%d and name=E'%s' and type='%s' and content=E'%s' and prio=%d");
 
     declare(suffix,"add-domain-key-query","", "insert into cryptokeys (domain_id, flags, active, content) select id, %d, (%d = 1), '%s' from domains where name=E'%s'");
     declare(suffix,"list-domain-keys-query","", "select cryptokeys.id, flags, case when active then 1 else 0 end as active, content from domains, cryptokeys where cryptokeys.domain_id=domains.id and name=E'%s'");
@@ -10,4 +10,9 @@ class gPgSQLBackend : public GSQLBackend
 {
 public:
   gPgSQLBackend(const string &mode, const string &suffix); //!< Makes our connection to the database. Throws an exception if it fails.
+  //! sqlEscape() escapes backslashes, which only works in E'' strings
+  string sqlQuote(const string &name)
+  {
+    return "E'"+sqlEscape(name)+"'";
+  }
 };
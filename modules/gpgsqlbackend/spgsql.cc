@@ -96,10 +96,14 @@ int SPgSQL::doCommand(const string &query)
     
     throw SSqlException("PostgreSQL failed to execute command: "+error); 
   }
-  if(d_result)
+  int rows=-1;
+  if(d_result) {
+    if(*PQcmdTuples(d_result))
+      rows=atoi(PQcmdTuples(d_result));
     PQclear(d_result);
+  }
   d_count=0;
-  return 0;
+  return rows;
 }
 
 
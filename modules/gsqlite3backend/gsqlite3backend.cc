@@ -93,11 +93,16 @@ public:
     declare(suffix,"get-order-before-query","DNSSEC Ordering Query, before", "select ordername, name from records where ordername <= '%s' and domain_id=%d and ordername is not null order by 1 desc limit 1");
     declare(suffix,"get-order-after-query","DNSSEC Ordering Query, after", "select min(ordername) from records where ordername > '%s' and domain_id=%d and ordername is not null");
     declare(suffix,"get-order-last-query","DNSSEC Ordering Query, last", "select ordername, name from records where ordername != '' and domain_id=%d and ordername is not null order by 1 desc limit 1");
+    declare(suffix,"get-order-names-query","DNSSEC Ordering Query, all", "select ordername, name from records where ordername != '' and domain_id=%d and ordername is not null");
     declare(suffix,"set-order-and-auth-query", "DNSSEC set ordering query", "update records set ordername='%s',auth=%d where name='%s' and domain_id='%d'");
 
     declare(suffix,"nullify-ordername-and-update-auth-query", "DNSSEC nullify ordername and update auth query", "update records set ordername=NULL,auth=%d where domain_id='%d' and name='%s'");
     declare(suffix,"nullify-ordername-and-auth-query", "DNSSEC nullify ordername and auth query", "update records set ordername=NULL,auth=0 where name='%s' and type='%s' and domain_id='%d'");
     declare(suffix,"set-auth-on-ds-record-query", "DNSSEC set auth on a DS record", "update records set auth=1 where domain_id='%d' and name='%s' and type='DS'");
+    declare(suffix,"set-order-and-auth-batch-query", "DNSSEC set ordering for many names", "update records set ordername=case name %s end,auth=%d where domain_id=%d and name in (%s)");
+    declare(suffix,"nullify-ordername-and-update-auth-batch-query", "DNSSEC nullify ordername and update auth for many names", "update records set ordername=NULL,auth=%d where domain_id=%d and name in (%s)");
+    declare(suffix,"nullify-ordername-and-auth-batch-query", "DNSSEC nullify ordername and auth for many names", "update records set ordername=NULL,auth=0 where domain_id=%d and type in (%s) and name in (%s)");
+    declare(suffix,"set-auth-on-ds-record-batch-query", "DNSSEC set auth on the DS records of many names", "update records set auth=1 where domain_id=%d and type='DS' and name in (%s)");
     
     declare( suffix, "master-zone-query", "Data", "select master from domains where name='%s' and type='SLAVE'");
 
@@ -114,6 +119,7 @@ public:
     declare (suffix, "zone-lastchange-query", "", "select max(change_date) from records where domain_id=%d");
     declare( suffix, "info-all-master-query", "", "select id,name,master,last_check,notified_serial,type from domains where type='MASTER'");
     declare( suffix, "delete-zone-query", "", "delete from records where domain_id=%d");
+    declare( suffix, "delete-record-query", "", "delete from records where domain_id=%d and name='%s' and type='%s' and content='%s' and prio=%d");
     declare(suffix, "dnssec", "Assume DNSSEC Schema is in place","no");
 
     declare(suffix,"add-domain-key-query","", "insert into cryptokeys (domain_id, flags, active, content) select id, %d, %d, '%s' from domains where name='%s'");
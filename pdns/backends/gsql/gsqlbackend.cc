@@ -278,6 +278,7 @@ GSQLBackend::GSQLBackend(const string &mode, const string &suffix)
   d_ZoneLastChangeQuery=getArg("zone-lastchange-query");
   d_InfoOfAllMasterDomainsQuery=getArg("info-all-master-query");
   d_DeleteZoneQuery=getArg("delete-zone-query");
+  d_DeleteRecordQuery=getArg("delete-record-query");
   d_getAllDomainsQuery=getArg("get-all-domains-query");
 
   d_removeEmptyNonTerminalsFromZoneQuery = getArg("remove-empty-non-terminals-from-zone-query");
@@ -290,10 +291,15 @@ GSQLBackend::GSQLBackend(const string &mode, const string &suffix)
     d_beforeOrderQuery = getArg("get-order-before-query");
     d_afterOrderQuery = getArg("get-order-after-query");
     d_lastOrderQuery = getArg("get-order-last-query");
+    d_allOrderQuery = getArg("get-order-names-query");
     d_setOrderAuthQuery = getArg("set-order-and-auth-query");
     d_nullifyOrderNameAndUpdateAuthQuery = getArg("nullify-ordername-and-update-auth-query");
     d_nullifyOrderNameAndAuthQuery = getArg("nullify-ordername-and-auth-query");
     d_setAuthOnDsRecordQuery = getArg("set-auth-on-ds-record-query");
+    d_setOrderAuthBatchQuery = getArg("set-order-and-auth-batch-query");
+    d_nullifyOrderNameAndUpdateAuthBatchQuery = getArg("nullify-ordername-and-update-auth-batch-query");
+    d_nullifyOrderNameAndAuthBatchQuery = getArg("nullify-ordername-and-auth-batch-query");
+    d_setAuthOnDsRecordBatchQuery = getArg("set-auth-on-ds-record-batch-query");
     
     d_AddDomainKeyQuery = getArg("add-domain-key-query");
     d_ListDomainKeysQuery = getArg("list-domain-keys-query");
@@ -334,6 +340,74 @@ bool GSQLBackend::updateDNSSECOrderAndAuthAbsolute(uint32_t domain_id, const std
   return true;
 }
 
+static void appendToList(string& list, const string& item)
+{
+  if(!list.empty())
+    list.append(1, ',');
+  list.append(item);
+}
+
+/* each statement updates up to 'batchsize' names, so rectifying a zone takes a few statements per thousand names
+   instead of a few per name */
+bool GSQLBackend::updateDNSSECOrderAndAuthBatch(uint32_t domain_id, const std::string& zonename, const vector<DNSSECOrderAndAuth>& names)
+{
+  if(!d_dnssecQueries)
+    return false;
+
+  const vector<DNSSECOrderAndAuth>::size_type batchsize=500;
+  vector<string> queries;
+  for(vector<DNSSECOrderAndAuth>::size_type begin = 0; begin < names.size(); begin += batchsize) {
+    vector<DNSSECOrderAndAuth>::size_type end = min(names.size(), begin + batchsize);
+    string cases[2], ordered[2], unordered[2], dsnames;
+    map<string, string> nullified; // type list -> names
+
+    for(vector<DNSSECOrderAndAuth>::size_type n = begin; n < end; ++n) {
+      const DNSSECOrderAndAuth& doa = names[n];
+      string qname = sqlQuote(doa.qname);
+      if(doa.ordering == DNSSECOrderAndAuth::NoOrdername) {
+        appendToList(unordered[doa.auth], qname);
+      }
+      else {
+        string ordername = doa.ordering == DNSSECOrderAndAuth::AbsoluteOrdername ? doa.ordername : toLower(labelReverse(makeRelative(doa.qname, zonename)));
+        cases[doa.auth] += " when "+qname+" then "+sqlQuote(ordername);
+        appendToList(ordered[doa.auth], qname);
+      }
+      if(doa.dsAuth)
+        appendToList(dsnames, qname);
+      if(doa.nullifyNS || doa.nullifyAddresses) {
+        string types;
+        if(doa.nullifyNS)
+          appendToList(types, sqlQuote("NS"));
+        if(doa.nullifyAddresses) {
+          appendToList(types, sqlQuote("A"));
+          appendToList(types, sqlQuote("AAAA"));
+        }
+        appendToList(nullified[types], qname);
+      }
+    }
+
+    for(int auth = 0; auth < 2; ++auth) {
+      if(!ordered[auth].empty())
+        queries.push_back((boost::format(d_setOrderAuthBatchQuery) % cases[auth] % auth % domain_id % ordered[auth]).str());
+      if(!unordered[auth].empty())
+        queries.push_back((boost::format(d_nullifyOrderNameAndUpdateAuthBatchQuery) % auth % domain_id % unordered[auth]).str());
+    }
+    if(!dsnames.empty())
+      queries.push_back((boost::format(d_setAuthOnDsRecordBatchQuery) % domain_id % dsnames).str());
+    for(map<string, string>::const_iterator i = nullified.begin(); i != nullified.end(); ++i)
+      queries.push_back((boost::format(d_nullifyOrderNameAndAuthBatchQuery) % domain_id % i->first % i->second).str());
+  }
+
+  try {
+    BOOST_FOREACH(const string& query, queries)
+      d_db->doCommand(query);
+  }
+  catch(SSqlException &e) {
+    throw AhuException("GSQLBackend unable to update ordername/auth for domain_id "+itoa(domain_id)+": "+e.txtReason());
+  }
+  return true;
+}
+
 bool GSQLBackend::nullifyDNSSECOrderNameAndUpdateAuth(uint32_t domain_id, const std::string& qname, bool auth)
 {
   if(!d_dnssecQueries)
@@ -501,6 +575,27 @@ bool GSQLBackend::getBeforeAndAfterNamesAbsolute(uint32_t id, const std::string&
   return true;
 }
 
+bool GSQLBackend::getOrderNames(uint32_t domain_id, vector<pair<string, string> >& ordernames)
+{
+  if(!d_dnssecQueries)
+    return false;
+
+  char output[1024];
+  snprintf(output, sizeof(output)-1, d_allOrderQuery.c_str(), domain_id);
+  try {
+    d_db->doQuery(output);
+  }
+  catch(SSqlException &e) {
+    throw AhuException("GSQLBackend unable to list ordernames for domain_id "+itoa(domain_id)+": "+e.txtReason());
+  }
+
+  SSql::row_t row;
+  while(d_db->getRow(row))
+    ordernames.push_back(make_pair(row[0], row[1]));
+
+  return true;
+}
+
 int GSQLBackend::addDomainKey(const string& name, const KeyData& key)
 {
   if(!d_dnssecQueries)
@@ -890,6 +985,24 @@ bool GSQLBackend::feedRecord(const DNSResourceRecord &r)
   return true; // XXX FIXME this API should not return 'true' I think -ahu 
 }
 
+bool GSQLBackend::removeRecord(const DNSResourceRecord &r)
+{
+  string output = (boost::format(d_DeleteRecordQuery) % r.domain_id % toLower(sqlEscape(r.qname)) % sqlEscape(r.qtype.getName()) % sqlEscape(r.content) % r.priority).str();
+
+  int rows;
+  try {
+    rows=d_db->doCommand(output.c_str());
+  }
+  catch (SSqlException &e) {
+    throw AhuException("GSQLBackend unable to remove record: "+e.txtReason());
+  }
+  if(rows < 0) // the driver can't tell what happened, so we can't vouch for the zone after an IXFR
+    return false;
+  if(!rows)
+    throw AhuException("GSQLBackend found no record '"+r.qname+"|"+r.qtype.getName()+"|"+r.content+"' to remove, zone is out of sync");
+  return true;
+}
+
 bool GSQLBackend::startTransaction(const string &domain, int domain_id)
 {
   char output[1024];
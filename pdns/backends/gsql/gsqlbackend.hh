@@ -23,6 +23,11 @@ public:
   }
   
   virtual string sqlEscape(const string &name);
+  //! quotes a string for use in a generated list of values, backends with a different string syntax override this
+  virtual string sqlQuote(const string &name)
+  {
+    return "'"+sqlEscape(name)+"'";
+  }
   void lookup(const QType &, const string &qdomain, DNSPacket *p=0, int zoneId=-1);
   bool list(const string &target, int domain_id);
   bool get(DNSResourceRecord &r);
@@ -33,6 +38,7 @@ public:
   bool commitTransaction();
   bool abortTransaction();
   bool feedRecord(const DNSResourceRecord &r);
+  bool removeRecord(const DNSResourceRecord &r);
   bool createSlaveDomain(const string &ip, const string &domain, const string &account);
   bool superMasterBackend(const string &ip, const string &domain, const vector<DNSResourceRecord>&nsset, string *account, DNSBackend **db);
   void setFresh(uint32_t domain_id);
@@ -41,8 +47,10 @@ public:
   bool getDomainInfo(const string &domain, DomainInfo &di);
   void setNotified(uint32_t domain_id, uint32_t serial);
   virtual bool getBeforeAndAfterNamesAbsolute(uint32_t id, const std::string& qname, std::string& unhashed, std::string& before, std::string& after);
+  virtual bool getOrderNames(uint32_t domain_id, vector<pair<string, string> >& ordernames);
   bool updateDNSSECOrderAndAuth(uint32_t domain_id, const std::string& zonename, const std::string& qname, bool auth);
   virtual bool updateDNSSECOrderAndAuthAbsolute(uint32_t domain_id, const std::string& qname, const std::string& ordername, bool auth);
+  virtual bool updateDNSSECOrderAndAuthBatch(uint32_t domain_id, const std::string& zonename, const vector<DNSSECOrderAndAuth>& names);
   virtual bool nullifyDNSSECOrderNameAndUpdateAuth(uint32_t domain_id, const std::string& qname, bool auth);
   virtual bool nullifyDNSSECOrderNameAndAuth(uint32_t domain_id, const std::string& qname, const std::string& type);
   virtual bool setDNSSECAuthOnDsRecord(uint32_t domain_id, const std::string& qname);
@@ -89,16 +97,22 @@ private:
   string d_UpdateLastCheckofZoneQuery;
   string d_InfoOfAllMasterDomainsQuery;
   string d_DeleteZoneQuery;		
+  string d_DeleteRecordQuery;
   string d_ZoneLastChangeQuery;
   
   string d_firstOrderQuery;
   string d_beforeOrderQuery;
   string d_afterOrderQuery;
   string d_lastOrderQuery;
+  string d_allOrderQuery;
   string d_setOrderAuthQuery;
   string d_nullifyOrderNameAndUpdateAuthQuery;
   string d_nullifyOrderNameAndAuthQuery;
   string d_setAuthOnDsRecordQuery;
+  string d_setOrderAuthBatchQuery;
+  string d_nullifyOrderNameAndUpdateAuthBatchQuery;
+  string d_nullifyOrderNameAndAuthBatchQuery;
+  string d_setAuthOnDsRecordBatchQuery;
   string d_removeEmptyNonTerminalsFromZoneQuery;
   string d_insertEmptyNonTerminalQuery;
   string d_deleteEmptyNonTerminalQuery;
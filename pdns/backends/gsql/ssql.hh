@@ -37,7 +37,7 @@ public:
   virtual SSqlException sPerrorException(const string &reason)=0;
   virtual int doQuery(const string &query, result_t &result)=0;
   virtual int doQuery(const string &query)=0;
-  virtual int doCommand(const string &query)=0;
+  virtual int doCommand(const string &query)=0; //!< returns the number of rows changed, or -1 if the driver can't tell
   virtual bool getRow(row_t &row)=0;
   virtual string escape(const string &name)=0;
   virtual void setLog(bool state){}
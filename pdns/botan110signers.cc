@@ -32,6 +32,7 @@ public:
   storvector_t convertToISCVector() const;
   std::string getPubKeyHash() const;
   std::string sign(const std::string& hash) const; 
+  std::vector<std::string> signBatch(const std::vector<std::string>& msgs) const;
   std::string hash(const std::string& hash) const; 
   bool verify(const std::string& hash, const std::string& signature) const;
   std::string getPublicKeyString() const;
@@ -191,21 +192,31 @@ std::string GOSTDNSCryptoKeyEngine::getPublicKeyString() const
  */
 
 std::string GOSTDNSCryptoKeyEngine::sign(const std::string& msg) const
+{
+  return signBatch(std::vector<std::string>(1, msg)).front();
+}
+
+std::vector<std::string> GOSTDNSCryptoKeyEngine::signBatch(const std::vector<std::string>& msgs) const
 {
   GOST_3410_Signature_Operation ops(*d_key);
   AutoSeeded_RNG rng;
+  std::vector<std::string> signatures;
+  signatures.reserve(msgs.size());
   
-  string hash= this->hash(msg);
+  for(std::vector<std::string>::const_iterator msg = msgs.begin(); msg != msgs.end(); ++msg) {
+    string hash= this->hash(*msg);
   
-  SecureVector<byte> signature=ops.sign((byte*)hash.c_str(), hash.length(), rng);
+    SecureVector<byte> signature=ops.sign((byte*)hash.c_str(), hash.length(), rng);
 
 #if BOTAN_VERSION_CODE <= BOTAN_VERSION_CODE_FOR(1,9,12)  // see http://bit.ly/gTytUf
-  string reversed((const char*)signature.begin()+ signature.size()/2, signature.size()/2);
-  reversed.append((const char*)signature.begin(), signature.size()/2);
-  return reversed;
+    string reversed((const char*)signature.begin()+ signature.size()/2, signature.size()/2);
+    reversed.append((const char*)signature.begin(), signature.size()/2);
+    signatures.push_back(reversed);
 #else  
-  return string((const char*)signature.begin(), (const char*) signature.end());
+    signatures.push_back(string((const char*)signature.begin(), (const char*) signature.end()));
 #endif
+  }
+  return signatures;
 }
 
 std::string GOSTDNSCryptoKeyEngine::hash(const std::string& orig) const
@@ -261,6 +272,7 @@ public:
   storvector_t convertToISCVector() const;
   std::string getPubKeyHash() const;
   std::string sign(const std::string& hash) const; 
+  std::vector<std::string> signBatch(const std::vector<std::string>& msgs) const;
   std::string hash(const std::string& hash) const; 
   bool verify(const std::string& hash, const std::string& signature) const;
   std::string getPublicKeyString() const;
@@ -392,12 +404,21 @@ void ECDSADNSCryptoKeyEngine::fromPublicKeyString(const std::string&input)
 
 std::string ECDSADNSCryptoKeyEngine::sign(const std::string& msg) const
 {
-  string hash = this->hash(msg);
+  return signBatch(std::vector<std::string>(1, msg)).front();
+}
+
+std::vector<std::string> ECDSADNSCryptoKeyEngine::signBatch(const std::vector<std::string>& msgs) const
+{
   ECDSA_Signature_Operation ops(*d_key);
   AutoSeeded_RNG rng;
-  SecureVector<byte> signature=ops.sign((byte*)hash.c_str(), hash.length(), rng);
-  
-  return string((const char*)signature.begin(), (const char*) signature.end());
+  std::vector<std::string> signatures;
+  signatures.reserve(msgs.size());
+  for(std::vector<std::string>::const_iterator msg = msgs.begin(); msg != msgs.end(); ++msg) {
+    string hash = this->hash(*msg);
+    SecureVector<byte> signature=ops.sign((byte*)hash.c_str(), hash.length(), rng);
+    signatures.push_back(string((const char*)signature.begin(), (const char*) signature.end()));
+  }
+  return signatures;
 }
 
 std::string ECDSADNSCryptoKeyEngine::hash(const std::string& orig) const
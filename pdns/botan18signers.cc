@@ -20,6 +20,7 @@ public:
   storvector_t convertToISCVector() const;
   std::string getPubKeyHash() const;
   std::string sign(const std::string& hash) const; 
+  std::vector<std::string> signBatch(const std::vector<std::string>& msgs) const;
   std::string hash(const std::string& hash) const; 
   bool verify(const std::string& msg, const std::string& signature) const;
   std::string getPublicKeyString() const;
@@ -168,12 +169,21 @@ void ECDSADNSCryptoKeyEngine::fromPublicKeyString(const std::string&input)
 }
 
 std::string ECDSADNSCryptoKeyEngine::sign(const std::string& msg) const
+{
+  return signBatch(std::vector<std::string>(1, msg)).front();
+}
+
+std::vector<std::string> ECDSADNSCryptoKeyEngine::signBatch(const std::vector<std::string>& msgs) const
 {
   AutoSeeded_RNG rng;
-  string hash = this->hash(msg);
-  SecureVector<byte> signature=d_key->sign((byte*)hash.c_str(), hash.length(), rng);
-  
-  return string((const char*)signature.begin(), (const char*) signature.end());
+  std::vector<std::string> signatures;
+  signatures.reserve(msgs.size());
+  for(std::vector<std::string>::const_iterator msg = msgs.begin(); msg != msgs.end(); ++msg) {
+    string hash = this->hash(*msg);
+    SecureVector<byte> signature=d_key->sign((byte*)hash.c_str(), hash.length(), rng);
+    signatures.push_back(string((const char*)signature.begin(), (const char*) signature.end()));
+  }
+  return signatures;
 }
 
 std::string ECDSADNSCryptoKeyEngine::hash(const std::string& orig) const
@@ -26,6 +26,7 @@ public:
   storvector_t convertToISCVector() const;
   std::string getPubKeyHash() const;
   std::string sign(const std::string& msg) const; 
+  std::vector<std::string> signBatch(const std::vector<std::string>& msgs) const;
   std::string hash(const std::string& hash) const; 
   bool verify(const std::string& msg, const std::string& signature) const;
   std::string getPublicKeyString() const;
@@ -180,6 +181,12 @@ void BotanRSADNSCryptoKeyEngine::fromPublicKeyString(const std::string& rawStrin
 }
 
 std::string BotanRSADNSCryptoKeyEngine::sign(const std::string& msg) const
+{
+  return signBatch(std::vector<std::string>(1, msg)).front();
+}
+
+// setting up the signer and seeding the RNG cost about as much as a signature, so do that once per batch
+std::vector<std::string> BotanRSADNSCryptoKeyEngine::signBatch(const std::vector<std::string>& msgs) const
 {  
 #if BOTAN_VERSION_CODE < BOTAN_VERSION_CODE_FOR(1,9,0)  
   EMSA* emsaptr;
@@ -202,8 +209,13 @@ std::string BotanRSADNSCryptoKeyEngine::sign(const std::string& msg) const
 #endif
 
   AutoSeeded_RNG rng;
-  SecureVector<byte> signature= pks.sign_message((byte*)msg.c_str(), msg.length(), rng);
-  return string((const char*)signature.begin(), (const char*) signature.end());
+  std::vector<std::string> signatures;
+  signatures.reserve(msgs.size());
+  for(std::vector<std::string>::const_iterator msg = msgs.begin(); msg != msgs.end(); ++msg) {
+    SecureVector<byte> signature= pks.sign_message((byte*)msg->c_str(), msg->length(), rng);
+    signatures.push_back(string((const char*)signature.begin(), (const char*) signature.end()));
+  }
+  return signatures;
 }
 
 std::string BotanRSADNSCryptoKeyEngine::hash(const std::string& orig) const
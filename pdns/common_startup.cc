@@ -17,6 +17,10 @@
     Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 */
 #include "common_startup.hh"
+#include "ixfr.hh"
+#include "nsec3cache.hh"
+#include "knownnames.hh"
+#include "zoneapexes.hh"
 
 typedef Distributor<DNSPacket,DNSPacket,PacketHandler> DNSDistributor;
 
@@ -30,6 +34,8 @@ CommunicatorClass Communicator;
 UDPNameserver *N;
 int avg_latency;
 TCPNameserver *TN;
+static QueryStatRing *s_queryRing;
+static RemoteStatRing *s_remoteRing;
 
 ArgvMap &arg()
 {
@@ -53,6 +59,8 @@ void declareArguments()
   ::arg().set("soa-serial-offset","Make sure that no SOA serial is less than this number")="0";
   
   ::arg().set("retrieval-threads", "Number of AXFR-retrieval threads for slave operation")="2";
+  ::arg().set("max-transfers-per-master", "Maximum number of simultaneous transfers from a single master, 0 for no limit")="0";
+  ::arg().set("axfr-hash-threads", "Number of threads per incoming AXFR that calculate NSEC3 hashes while the zone is received, 0 to hash afterwards")="1";
 
   ::arg().setCmd("help","Provide a helpful message");
   ::arg().setCmd("version","Output version and compilation date");
@@ -82,6 +90,7 @@ void declareArguments()
 
   ::arg().set("load-modules","Load this module - supply absolute or relative path")="";
   ::arg().set("launch","Which backends to launch and order to query them in")="";
+  ::arg().setSwitch("backend-fanout","Ask all launched backends at the same time, instead of in order until one answers")="no";
   ::arg().setSwitch("disable-axfr","Disable zonetransfers but do allow TCP queries")="no";
   ::arg().set("allow-axfr-ips","Allow zonetransfers only to these subnets")="0.0.0.0/0,::/0";
   ::arg().set("slave-cycle-interval","Reschedule failed SOA serial checks once every .. seconds")="60";
@@ -124,6 +133,7 @@ void declareArguments()
 
   ::arg().set("default-ttl","Seconds a result is valid if not set otherwise")="3600";
   ::arg().set("max-tcp-connections","Maximum number of TCP connections")="10";
+  ::arg().set("ring-sample-rate","Record only one in this many queries in the queries and remotes rings")="1";
   ::arg().setSwitch("no-shuffle","Set this to prevent random shuffling of answers - for regression testing")="off";
 
   ::arg().setSwitch( "use-logfile", "Use a log file (Windows only)" )= "no";
@@ -132,6 +142,15 @@ void declareArguments()
   ::arg().set("setgid","If set, change group id to this gid for more security")="";
 
   ::arg().set("max-cache-entries", "Maximum number of cache entries")="1000000";
+  ::arg().set("cache-snapshot-file", "If set, load the packet and query cache from this file on startup, and write it there on exit")="";
+  ::arg().set("cache-snapshot-interval", "If set, also write the cache snapshot once every this many seconds")="0";
+  ::arg().set("ixfr-journal-size", "Number of changes per zone to remember for answering IXFR queries, 0 to always answer with a full AXFR")="0";
+  ::arg().set("max-signature-cache-entries", "Maximum number of RRSIG signatures to remember")="1000000";
+  ::arg().set("nsec3-hash-cache-entries", "Number of NSEC3 hashes to remember, 0 to always calculate them")="10000";
+  ::arg().set("nsec3-index-max-names", "Keep an in-memory index of the NSEC3 hashes of zones with up to this many names, 0 to disable")="100000";
+  ::arg().set("known-names-zones", "Answer lookups for names that don't exist in these zones from memory, instead of asking the backends")="";
+  ::arg().set("known-names-max-names", "Don't keep the names of known-names-zones with more than this many names in memory")="1000000";
+  ::arg().set("zone-apex-index-ttl", "Seconds to keep the list of all zones used to find the zone of a name, 0 to ask for the SOA at every label")="0";
   ::arg().set("max-ent-entries", "Maximum number of empty non-terminals in a zone")="100000";
   ::arg().set("entropy-source", "If set, read entropy from this file")="/dev/urandom";
 
@@ -170,13 +189,25 @@ void declareStats(void)
   S.declare("latency","Average number of microseconds needed to answer a question");
   S.declare("timedout-packets","Number of packets which weren't answered within timeout set");
 
-  S.declareRing("queries","UDP Queries Received");
+  S.declare("nsec3-hash-cache-hit","Number of NSEC3 hashes found in the cache");
+  S.declare("nsec3-hash-cache-miss","Number of NSEC3 hashes that had to be calculated");
+  S.declare("known-names-filtered","Number of lookups answered negatively by the known-names-zones filter");
+
+  S.declare("xfr-queue","Number of zone transfers waiting for a retrieval thread");
+  S.declare("xfr-active","Number of zone transfers in progress");
+  S.declare("xfr-failed","Number of zone transfers that failed");
+  S.declare("xfr-bytes","Number of bytes received in zone transfers");
+  S.declare("xfr-bytes-per-second","Number of bytes received in zone transfers over the last second");
+
+  s_queryRing=new QueryStatRing(10000, ::arg().asNum("ring-sample-rate"), ::arg().asNum("receiver-threads"));
+  S.declareSampledRing("queries","UDP Queries Received", s_queryRing);
   S.declareRing("nxdomain-queries","Queries for non-existent records within existent domains");
   S.declareRing("noerror-queries","Queries for existing records, but for type we don't have");
   S.declareRing("servfail-queries","Queries that could not be answered due to backend errors");
   S.declareRing("unauth-queries","Queries for domains that we are not authoritative for");
   S.declareRing("logmessages","Log Messages");
-  S.declareRing("remotes","Remote server IP addresses");
+  s_remoteRing=new RemoteStatRing(10000, ::arg().asNum("ring-sample-rate"), ::arg().asNum("receiver-threads"));
+  S.declareSampledRing("remotes","Remote server IP addresses", s_remoteRing);
   S.declareRing("remotes-unauth","Remote hosts querying domains for which we are not auth");
   S.declareRing("remotes-corrupt","Remote hosts sending corrupt packets");
 
@@ -255,8 +286,12 @@ void *qthread(void *number)
      if(P->d.qr)
        continue;
 
-    S.ringAccount("queries", P->qdomain+"/"+P->qtype.getName());
-    S.ringAccount("remotes",P->getRemote());
+    if(S.doingRings() && s_queryRing->sample()) {
+      s_queryRing->account(QueryRingKey(P->qdomain, P->qtype.getCode()), P->qdomain);
+      ComboAddress remote=P->d_remote;
+      remote.sin4.sin_port=0;
+      s_remoteRing->account(remote);
+    }
     if(logDNSQueries) {
       string remote;
       if(P->hasEDNSSubnet()) 
@@ -304,6 +339,23 @@ void *qthread(void *number)
   return 0;
 }
 
+//! Periodically writes out the cache so that a respawn after a crash also starts warm
+static void *snapshotThread(void *)
+{
+  const string fname=::arg()["cache-snapshot-file"];
+  const int interval=::arg().asNum("cache-snapshot-interval");
+  for(;;) {
+    sleep(interval);
+    try {
+      PC.dump(fname);
+    }
+    catch(AhuException& ae) {
+      L<<Logger::Error<<ae.reason<<endl;
+    }
+  }
+  return 0;
+}
+
 void mainthread()
 {
   Utility::srandom(time(0));
@@ -339,11 +391,37 @@ void mainthread()
     DP->onlyFrom(::arg()["allow-recursion"]);
     DP->go();
   }
+  IXJ.setMaxDiffs(::arg().asNum("ixfr-journal-size"));
+  setSignatureCacheSize(::arg().asNum("max-signature-cache-entries"));
+  g_nsec3cache.setMaxEntries(::arg().asNum("nsec3-hash-cache-entries"));
+  g_nsec3cache.setMaxIndexNames(::arg().asNum("nsec3-index-max-names"));
+  vector<string> knownNamesZones;
+  stringtok(knownNamesZones, ::arg()["known-names-zones"], ", \t");
+  g_knownnames.setMaxNames(::arg().asNum("known-names-max-names"));
+  g_knownnames.setZones(knownNamesZones);
+  UeberBackend::setFanout(::arg().mustDo("backend-fanout"));
+  g_zoneapexes.setTTL(::arg().asNum("zone-apex-index-ttl"));
+
   // NOW SAFE TO CREATE THREADS!
   dl->go();
 
   pthread_t qtid;
 
+  if(!::arg()["cache-snapshot-file"].empty()) {
+    const string& fname=::arg()["cache-snapshot-file"];
+    if(!access(fname.c_str(), R_OK)) {
+      try {
+        int count=PC.restore(fname);
+        L<<Logger::Warning<<"Loaded "<<count<<" cache entries from '"<<fname<<"'"<<endl;
+      }
+      catch(AhuException& ae) {
+        L<<Logger::Error<<"Starting with an empty cache: "<<ae.reason<<endl;
+      }
+    }
+    if(::arg().asNum("cache-snapshot-interval") > 0)
+      pthread_create(&qtid, 0, snapshotThread, 0);
+  }
+
 
   if(::arg().mustDo("webserver"))
     sws.go();
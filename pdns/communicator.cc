@@ -31,35 +31,98 @@
 #include "session.hh"
 #include "packetcache.hh"
 #include <boost/lexical_cast.hpp>
+#include <boost/foreach.hpp>
+#include "statbag.hh"
 
 // #include "namespaces.hh"
 
+extern StatBag S;
+
 void CommunicatorClass::retrievalLoopThread(void)
 {
   for(;;) {
-    d_suck_sem.wait();
     SuckRequest sr;
     {
       Lock l(&d_lock);
-      if(d_suckdomains.empty()) 
-        continue;
-	
-      sr=d_suckdomains.front();
-      d_suckdomains.pop_front();
+      while(!pickSuckRequest(sr)) {
+        struct timespec ts;
+        ts.tv_sec=time(0)+1; // wake up once in a while for masters coming out of their backoff
+        ts.tv_nsec=0;
+        pthread_cond_timedwait(&d_suck_cond, &d_lock, &ts);
+      }
     }
+    bool ok=false;
     try {
-      suck(sr.domain,sr.master);
+      ok=suck(sr.domain,sr.master);
     }
     catch(AhuException& ae) {
       cerr<<"Error: "<<ae.reason<<endl;
     }
+    {
+      Lock l(&d_lock);
+      finishSuckRequest(sr, ok);
+    }
+    pthread_cond_broadcast(&d_suck_cond); // a transfer slot for this master came free
   }
 
 }
 
+void CommunicatorClass::updateTransferStats()
+{
+  time_t now=time(0);
+  if(now == d_lastxfrtime)
+    return;
+  unsigned int bytes=S.read("xfr-bytes");
+  if(d_lastxfrtime)
+    S.set("xfr-bytes-per-second", (bytes-d_lastxfrbytes)/(now-d_lastxfrtime));
+  d_lastxfrbytes=bytes;
+  d_lastxfrtime=now;
+}
+
+void CommunicatorClass::setTransferTiming(const string& domain, const TransferTiming& tt)
+{
+  Lock l(&d_lock);
+  d_transfertimings[domain]=tt;
+}
+
+string CommunicatorClass::getTransferStatus(const string& domain)
+{
+  ostringstream os;
+  Lock l(&d_lock);
+  if(!domain.empty()) {
+    map<string, TransferTiming, CIStringCompare>::const_iterator iter=d_transfertimings.find(domain);
+    if(iter == d_transfertimings.end())
+      return "No AXFR of '"+domain+"' since startup\n";
+    const TransferTiming& tt=iter->second;
+    os<<"Last AXFR of '"<<domain<<"' "<<time(0)-tt.when<<" seconds ago: "<<tt.records<<" records, transfer "<<
+      tt.transfer<<" seconds, rectify "<<tt.rectify<<" seconds"<<endl;
+    return os.str();
+  }
+
+  unsigned int notified=0;
+  BOOST_FOREACH(const SuckRequest& sr, d_suckdomains) 
+    if(sr.priority > SuckRequest::Refresh)
+      notified++;
+
+  os<<d_suckdomains.size()<<" transfers queued ("<<notified<<" notified), "<<d_activetransfers<<" active, "<<
+    S.read("xfr-bytes-per-second")<<" bytes/s"<<endl;
+
+  time_t now=time(0);
+  for(map<string, MasterTransferState>::const_iterator iter=d_masterstates.begin(); iter != d_masterstates.end(); ++iter) {
+    os<<iter->first<<": "<<iter->second.active<<" active";
+    if(iter->second.failures) {
+      os<<", "<<iter->second.failures<<" failures";
+      if(iter->second.nextAttempt > now)
+        os<<", backing off for "<<iter->second.nextAttempt - now<<" seconds";
+    }
+    os<<endl;
+  }
+  return os.str();
+}
 
 void CommunicatorClass::go()
 {
+  d_maxtransferspermaster=::arg().asNum("max-transfers-per-master");
   pthread_t tid;
   pthread_create(&tid,0,&launchhelper,this); // Starts CommunicatorClass::mainloop()
   for(int n=0; n < ::arg().asNum("retrieval-threads"); ++n)
@@ -100,6 +163,7 @@ void CommunicatorClass::mainloop(void)
         }
         // this gets executed at least once every second
         doNotifications();
+        updateTransferStats();
       }
     }
   }
@@ -28,6 +28,8 @@
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/identity.hpp>
 #include <boost/multi_index/sequenced_index.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/key_extractors.hpp>
 using namespace boost::multi_index;
 
 #ifndef WIN32 
@@ -43,8 +45,12 @@ using namespace boost::multi_index;
 
 struct SuckRequest
 {
+  enum Priority {Refresh=0, Notify=1}; //!< zones we were told about go before zones found stale by the refresh cycle
   string domain;
   string master;
+  int priority;
+  uint64_t order; //!< first come, first served within a priority
+  unsigned int attempts;
   bool operator<(const SuckRequest& b) const
   {
     return tie(domain, master) < tie(b.domain, b.master);
@@ -52,15 +58,23 @@ struct SuckRequest
 };
 
 struct IDTag{};
+struct QueueTag{};
 
 typedef multi_index_container<
   SuckRequest,
   indexed_by<
-    sequenced<>,
+    ordered_non_unique<tag<QueueTag>, 
+                       composite_key<SuckRequest, 
+                                     member<SuckRequest, int, &SuckRequest::priority>,
+                                     member<SuckRequest, uint64_t, &SuckRequest::order>
+                       >,
+                       composite_key_compare<std::greater<int>, std::less<uint64_t> >
+    >,
     ordered_unique<tag<IDTag>, identity<SuckRequest> >
   >
 > UniQueue;
 typedef UniQueue::index<IDTag>::type domains_by_name_t;
+typedef UniQueue::index<QueueTag>::type domains_by_priority_t;
 
 class NotificationQueue
 {
@@ -147,6 +161,12 @@ public:
   {
     pthread_mutex_init(&d_lock,0);
     pthread_mutex_init(&d_holelock,0);
+    pthread_cond_init(&d_suck_cond,0);
+    d_suckorder=0;
+    d_activetransfers=0;
+    d_maxtransferspermaster=0;
+    d_lastxfrbytes=0;
+    d_lastxfrtime=0;
 
     d_tickinterval=60;
     d_masterschanged=d_slaveschanged=true;
@@ -157,7 +177,8 @@ public:
   
   void drillHole(const string &domain, const string &ip);
   bool justNotified(const string &domain, const string &ip);
-  void addSuckRequest(const string &domain, const string &master);
+  void addSuckRequest(const string &domain, const string &master, int priority=SuckRequest::Refresh);
+  string getTransferStatus(const string& domain="");
   void addSlaveCheckRequest(const DomainInfo& di, const ComboAddress& remote);
   void addTrySuperMasterRequest(DNSPacket *p);
   void notify(const string &domain, const string &ip);
@@ -183,15 +204,46 @@ private:
   map<pair<string,string>,time_t>d_holes;
   pthread_mutex_t d_holelock;
   void launchRetrievalThreads();
-  void suck(const string &domain, const string &remote);
+  bool suck(const string &domain, const string &remote);
+  void queueSuckRequest(const SuckRequest& sr);
+  bool pickSuckRequest(SuckRequest& sr);
+  void finishSuckRequest(const SuckRequest& sr, bool ok);
+  void updateTransferStats();
+  bool ixfrSuck(const string &domain, const ComboAddress& raddr, const SOAData& sd, const DomainInfo& di,
+                const string& tsigkeyname, const string& tsigalgorithm, const string& tsigsecret, const ComboAddress* laddr);
   void slaveRefresh(PacketHandler *P);
   void masterUpdateCheck(PacketHandler *P);
   pthread_mutex_t d_lock;
   
   UniQueue d_suckdomains;
+  uint64_t d_suckorder;
+
+  struct MasterTransferState
+  {
+    MasterTransferState() : active(0), failures(0), nextAttempt(0) {}
+    unsigned int active;
+    unsigned int failures;
+    time_t nextAttempt;
+  };
+  map<string, MasterTransferState> d_masterstates; //!< masters with transfers running or backing off
+
+  struct TransferTiming
+  {
+    TransferTiming() : when(0), records(0), transfer(0), rectify(0) {}
+    time_t when;
+    unsigned int records;
+    float transfer; //!< seconds spent receiving and storing the zone
+    float rectify;  //!< seconds spent on auth, ordername and empty non-terminals after that
+  };
+  map<string, TransferTiming, CIStringCompare> d_transfertimings; //!< last AXFR of each zone
+  void setTransferTiming(const string& domain, const TransferTiming& tt);
+  unsigned int d_activetransfers;
+  unsigned int d_maxtransferspermaster;
+  unsigned int d_lastxfrbytes;
+  time_t d_lastxfrtime;
   
   bool d_havepriosuckrequest;
-  Semaphore d_suck_sem;
+  pthread_cond_t d_suck_cond;
   Semaphore d_any_sem;
   time_t d_tickinterval;
   NotificationQueue d_nq;
@@ -19,6 +19,7 @@ public:
   storvector_t convertToISCVector() const;
   std::string getPubKeyHash() const;
   std::string sign(const std::string& msg) const; 
+  std::vector<std::string> signBatch(const std::vector<std::string>& msgs) const;
   std::string hash(const std::string& hash) const; 
   bool verify(const std::string& msg, const std::string& signature) const;
   std::string getPublicKeyString() const;
@@ -131,16 +132,24 @@ void CryptoPPECDSADNSCryptoKeyEngine<HASHER,CURVE,BITS>::fromPublicKeyString(con
 template<class HASHER, class CURVE, int BITS>
 std::string CryptoPPECDSADNSCryptoKeyEngine<HASHER,CURVE,BITS>::sign(const std::string& msg) const
 {  
-  string signature;
+  return signBatch(std::vector<std::string>(1, msg)).front();
+}
+template<class HASHER, class CURVE, int BITS>
+std::vector<std::string> CryptoPPECDSADNSCryptoKeyEngine<HASHER,CURVE,BITS>::signBatch(const std::vector<std::string>& msgs) const
+{  
+  // seeding the pool and setting up the signer are shared by all signatures in the batch
   AutoSeededRandomPool prng;
-  StringSource( msg, true /*pump all*/,
-    new SignerFilter( prng,
-        typename ECDSA<ECP,HASHER>::Signer( *d_key ),
-        new StringSink( signature )
-    ) // SignerFilter
-  ); // StringSource
-  return signature;
-
+  typename ECDSA<ECP,HASHER>::Signer signer( *d_key );
+  std::vector<std::string> signatures(msgs.size());
+  for(std::vector<std::string>::size_type n = 0; n < msgs.size(); ++n) {
+    StringSource( msgs[n], true /*pump all*/,
+      new SignerFilter( prng,
+          signer,
+          new StringSink( signatures[n] )
+      ) // SignerFilter
+    ); // StringSource
+  }
+  return signatures;
 }
 template<class HASHER, class CURVE, int BITS>
 std::string CryptoPPECDSADNSCryptoKeyEngine<HASHER,CURVE,BITS>::hash(const std::string& orig) const
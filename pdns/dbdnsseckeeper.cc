@@ -32,43 +32,175 @@
 #include "base64.hh"
 #include "cachecleaner.hh"
 #include "arguments.hh"
+#include "lock.hh"
+#include <boost/scoped_ptr.hpp>
 
 
 using namespace boost::assign;
+using boost::scoped_ptr;
 #include "namespaces.hh"
 
 
-DNSSECKeeper::keycache_t DNSSECKeeper::s_keycache;
+DNSSECKeeper::descriptors_t DNSSECKeeper::s_descriptors;
+pthread_rwlock_t DNSSECKeeper::s_descriptorlock = PTHREAD_RWLOCK_INITIALIZER;
+__thread DNSSECKeeper::descriptors_t* DNSSECKeeper::t_descriptors;
+pthread_key_t DNSSECKeeper::s_descriptorsKey;
+pthread_once_t DNSSECKeeper::s_descriptorsOnce = PTHREAD_ONCE_INIT;
+const char* DNSSECKeeper::s_descriptorKinds[] = {"PRESIGNED", "NSEC3PARAM", "NSEC3NARROW", "SOA-EDIT", 0};
 DNSSECKeeper::metacache_t DNSSECKeeper::s_metacache;
 pthread_rwlock_t DNSSECKeeper::s_metacachelock = PTHREAD_RWLOCK_INITIALIZER;
-pthread_rwlock_t DNSSECKeeper::s_keycachelock = PTHREAD_RWLOCK_INITIALIZER;
-AtomicCounter DNSSECKeeper::s_ops;
 time_t DNSSECKeeper::s_last_prune;
 
-bool DNSSECKeeper::isSecuredZone(const std::string& zone) 
+static bool keyCompareByKindAndID(const DNSSECKeeper::keyset_t::value_type& a, const DNSSECKeeper::keyset_t::value_type& b)
 {
-  if(isPresigned(zone))
-    return true;
-  
-  if(!((++s_ops) % 100000)) {
-    cleanup();
+  return make_pair(!a.second.keyOrZone, a.second.id) <
+         make_pair(!b.second.keyOrZone, b.second.id);
+}
+
+shared_ptr<const DNSSECKeeper::ZoneDescriptor> DNSSECKeeper::loadZoneDescriptor(const std::string& zone)
+{
+  shared_ptr<ZoneDescriptor> zd(new ZoneDescriptor);
+  zd->d_zone = zone;
+  zd->d_ttd = time(0) + 30;
+
+  vector<string> meta;
+  for(const char** kind = s_descriptorKinds; *kind; ++kind) {
+    meta.clear();
+    d_keymetadb->getDomainMetadata(zone, *kind, meta);
+    if(!meta.empty())
+      zd->d_meta[*kind] = *meta.begin();
+  }
+  zd->d_presigned = (zd->d_meta["PRESIGNED"] == "1");
+  const string& ns3param = zd->d_meta["NSEC3PARAM"];
+  if(!ns3param.empty()) { // "no NSEC3"
+    scoped_ptr<DNSRecordContent> tmp(DNSRecordContent::mastermake(QType::NSEC3PARAM, 1, ns3param));
+    zd->d_ns3pr = *dynamic_cast<NSEC3PARAMRecordContent*>(tmp.get());
+    zd->d_haveNSEC3 = true;
+    zd->d_narrow = (zd->d_meta["NSEC3NARROW"] == "1");
   }
 
+  vector<UeberBackend::KeyData> dbkeyset;
+  d_keymetadb->getDomainKeys(zone, 0, dbkeyset);
+  BOOST_FOREACH(UeberBackend::KeyData& kd, dbkeyset) 
   {
-    ReadLock l(&s_keycachelock);
-    keycache_t::const_iterator iter = s_keycache.find(zone);
-    if(iter != s_keycache.end() && iter->d_ttd > (unsigned int)time(0)) { 
-      if(iter->d_keys.empty())
-        return false;
+    DNSSECPrivateKey dpk;
+    DNSKEYRecordContent dkrc;
+    
+    dpk.setKey(shared_ptr<DNSCryptoKeyEngine>(DNSCryptoKeyEngine::makeFromISCString(dkrc, kd.content)));
+    
+    dpk.d_flags = kd.flags;
+    dpk.d_algorithm = dkrc.d_algorithm;
+    if(dpk.d_algorithm == 5 && zd->d_haveNSEC3)
+      dpk.d_algorithm+=2;
+    
+    KeyMetaData kmd;
+    kmd.active = kd.active;
+    kmd.keyOrZone = (kd.flags == 257);
+    kmd.id = kd.id;
+    zd->d_keys.push_back(make_pair(dpk, kmd));
+  }
+  sort(zd->d_keys.begin(), zd->d_keys.end(), keyCompareByKindAndID);
+  return zd;
+}
+
+bool DNSSECKeeper::usable(const ZoneDescriptor& zd, time_t now)
+{
+  if(zd.d_superseded)
+    return false;
+  if(zd.d_ttd > now)
+    return true;
+  return ++zd.d_refreshing > 1; // not the first to notice it expired, so someone else is reloading it
+}
+
+void DNSSECKeeper::publish(const shared_ptr<const ZoneDescriptor>& zd)
+{
+  WriteLock l(&s_descriptorlock);
+  descriptors_t::iterator iter = s_descriptors.find(zd->d_zone);
+  if(iter != s_descriptors.end()) {
+    iter->second->d_superseded = true;
+    iter->second = zd;
+    return;
+  }
+  s_descriptors.insert(make_pair(zd->d_zone, zd));
+
+  if(s_descriptors.size() > (unsigned int)::arg().asNum("max-cache-entries")) {
+    time_t now = time(0);
+    for(iter = s_descriptors.begin(); iter != s_descriptors.end(); ) {
+      if(iter->second->d_ttd < now) {
+        iter->second->d_superseded = true;
+        s_descriptors.erase(iter++);
+      }
       else
-        return true;
+        ++iter;
     }
-    else
-      ; 
-  }  
-  keyset_t keys = getKeys(zone, true); // does the cache
-  
-  BOOST_FOREACH(keyset_t::value_type& val, keys) {
+  }
+}
+
+void DNSSECKeeper::makeDescriptorsKey()
+{
+  pthread_key_create(&s_descriptorsKey, freeDescriptors);
+}
+
+// TCP connections get a thread each, so the per-thread descriptors must not outlive it
+void DNSSECKeeper::freeDescriptors(void* descriptors)
+{
+  delete static_cast<descriptors_t*>(descriptors);
+}
+
+shared_ptr<const DNSSECKeeper::ZoneDescriptor> DNSSECKeeper::getZoneDescriptor(const std::string& zone)
+{
+  time_t now = time(0);
+  if(!t_descriptors) {
+    pthread_once(&s_descriptorsOnce, makeDescriptorsKey);
+    t_descriptors = new descriptors_t;
+    pthread_setspecific(s_descriptorsKey, t_descriptors); // so freeDescriptors() gets it when this thread exits
+  }
+
+  shared_ptr<const ZoneDescriptor> zd;
+  bool reload = false;
+  descriptors_t::const_iterator iter = t_descriptors->find(zone);
+  if(iter != t_descriptors->end() && !iter->second->d_superseded) {
+    if(usable(*iter->second, now))
+      return iter->second;
+    zd = iter->second; // expired, and we are the one to reload it
+    reload = true;
+  }
+  if(!reload) {
+    {
+      ReadLock l(&s_descriptorlock);
+      iter = s_descriptors.find(zone);
+      if(iter != s_descriptors.end())
+        zd = iter->second;
+    }
+    reload = !zd || !usable(*zd, now);
+  }
+
+  if(reload) {
+    shared_ptr<const ZoneDescriptor> stale = zd;
+    try {
+      zd = loadZoneDescriptor(zone);
+    }
+    catch(...) {
+      if(stale) // so the next thread tries again instead of waiting for us
+        stale->d_superseded = true;
+      throw;
+    }
+    publish(zd);
+  }
+
+  if(t_descriptors->size() >= (unsigned int)::arg().asNum("max-cache-entries"))
+    t_descriptors->clear();
+  (*t_descriptors)[zone] = zd;
+  return zd;
+}
+
+bool DNSSECKeeper::isSecuredZone(const std::string& zone) 
+{
+  shared_ptr<const ZoneDescriptor> zd = getZoneDescriptor(zone);
+  if(zd->d_presigned)
+    return true;
+
+  BOOST_FOREACH(const keyset_t::value_type& val, zd->d_keys) {
     if(val.second.active) {
       return true;
     }
@@ -78,9 +210,7 @@ bool DNSSECKeeper::isSecuredZone(const std::string& zone)
 
 bool DNSSECKeeper::isPresigned(const std::string& name)
 {
-  string meta;
-  getFromMeta(name, "PRESIGNED", meta);
-  return meta=="1";
+  return getZoneDescriptor(name)->d_presigned;
 }
 
 bool DNSSECKeeper::addKey(const std::string& name, bool keyOrZone, int algorithm, int bits, bool active)
@@ -109,8 +239,10 @@ bool DNSSECKeeper::addKey(const std::string& name, bool keyOrZone, int algorithm
 
 void DNSSECKeeper::clearAllCaches() {
   {
-    WriteLock l(&s_keycachelock);
-    s_keycache.clear();
+    WriteLock l(&s_descriptorlock);
+    for(descriptors_t::const_iterator iter = s_descriptors.begin(); iter != s_descriptors.end(); ++iter)
+      iter->second->d_superseded = true;
+    s_descriptors.clear();
   }
   WriteLock l(&s_metacachelock);
   s_metacache.clear();
@@ -119,8 +251,12 @@ void DNSSECKeeper::clearAllCaches() {
 void DNSSECKeeper::clearCaches(const std::string& name)
 {
   {
-    WriteLock l(&s_keycachelock);
-    s_keycache.erase(name); 
+    WriteLock l(&s_descriptorlock);
+    descriptors_t::iterator iter = s_descriptors.find(name);
+    if(iter != s_descriptors.end()) {
+      iter->second->d_superseded = true; // threads that still hold it notice this and fetch a new one
+      s_descriptors.erase(iter);
+    }
   }
   WriteLock l(&s_metacachelock);
   pair<metacache_t::iterator, metacache_t::iterator> range = s_metacache.equal_range(name);
@@ -140,13 +276,6 @@ bool DNSSECKeeper::addKey(const std::string& name, const DNSSECPrivateKey& dpk,
   return d_keymetadb->addDomainKey(name, kd) >= 0; // >= 0 == s
 }
 
-
-static bool keyCompareByKindAndID(const DNSSECKeeper::keyset_t::value_type& a, const DNSSECKeeper::keyset_t::value_type& b)
-{
-  return make_pair(!a.second.keyOrZone, a.second.id) <
-         make_pair(!b.second.keyOrZone, b.second.id);
-}
-
 DNSSECPrivateKey DNSSECKeeper::getKeyById(const std::string& zname, unsigned int id)
 {  
   vector<DNSBackend::KeyData> keys;
@@ -193,12 +322,17 @@ bool DNSSECKeeper::activateKey(const std::string& zname, unsigned int id)
 void DNSSECKeeper::getFromMeta(const std::string& zname, const std::string& key, std::string& value)
 {
   value.clear();
-  unsigned int now = time(0);
-
-  if(!((++s_ops) % 100000)) {
-    cleanup();
+  for(const char** kind = s_descriptorKinds; *kind; ++kind) {
+    if(key == *kind) {
+      shared_ptr<const ZoneDescriptor> zd = getZoneDescriptor(zname);
+      map<string, string>::const_iterator iter = zd->d_meta.find(key);
+      if(iter != zd->d_meta.end())
+        value = iter->second;
+      return;
+    }
   }
 
+  unsigned int now = time(0);
   {
     ReadLock l(&s_metacachelock); 
     
@@ -222,25 +356,19 @@ void DNSSECKeeper::getFromMeta(const std::string& zname, const std::string& key,
     WriteLock l(&s_metacachelock);
     replacing_insert(s_metacache, nce);
   }
+  cleanup();
 }
 
 bool DNSSECKeeper::getNSEC3PARAM(const std::string& zname, NSEC3PARAMRecordContent* ns3p, bool* narrow)
 {
-  string value;
-  getFromMeta(zname, "NSEC3PARAM", value);
-  if(value.empty()) { // "no NSEC3"
+  shared_ptr<const ZoneDescriptor> zd = getZoneDescriptor(zname);
+  if(!zd->d_haveNSEC3)
     return false;
-  }
      
-  if(ns3p) {
-    NSEC3PARAMRecordContent* tmp=dynamic_cast<NSEC3PARAMRecordContent*>(DNSRecordContent::mastermake(QType::NSEC3PARAM, 1, value));
-    *ns3p = *tmp;
-    delete tmp;
-  }
-  if(narrow) {
-    getFromMeta(zname, "NSEC3NARROW", value);
-    *narrow = (value=="1");
-  }
+  if(ns3p)
+    *ns3p = zd->d_ns3pr;
+  if(narrow)
+    *narrow = zd->d_narrow;
   return true;
 }
 
@@ -285,66 +413,13 @@ bool DNSSECKeeper::unsetPresigned(const std::string& zname)
 
 DNSSECKeeper::keyset_t DNSSECKeeper::getKeys(const std::string& zone, boost::tribool allOrKeyOrZone) 
 {
-  unsigned int now = time(0);
-
-  if(!((++s_ops) % 100000)) {
-    cleanup();
+  shared_ptr<const ZoneDescriptor> zd = getZoneDescriptor(zone);
+  keyset_t ret;
+  BOOST_FOREACH(const keyset_t::value_type& value, zd->d_keys) {
+    if(boost::indeterminate(allOrKeyOrZone) || allOrKeyOrZone == value.second.keyOrZone)
+      ret.push_back(value);
   }
-
-  {
-    ReadLock l(&s_keycachelock);
-    keycache_t::const_iterator iter = s_keycache.find(zone);
-      
-    if(iter != s_keycache.end() && iter->d_ttd > now) { 
-      keyset_t ret;
-      BOOST_FOREACH(const keyset_t::value_type& value, iter->d_keys) {
-        if(boost::indeterminate(allOrKeyOrZone) || allOrKeyOrZone == value.second.keyOrZone)
-          ret.push_back(value);
-      }
-      return ret;
-    }
-  }    
-  keyset_t retkeyset, allkeyset;
-  vector<UeberBackend::KeyData> dbkeyset;
-  
-  d_keymetadb->getDomainKeys(zone, 0, dbkeyset);
-  
-  BOOST_FOREACH(UeberBackend::KeyData& kd, dbkeyset) 
-  {
-    DNSSECPrivateKey dpk;
-
-    DNSKEYRecordContent dkrc;
-    
-    dpk.setKey(shared_ptr<DNSCryptoKeyEngine>(DNSCryptoKeyEngine::makeFromISCString(dkrc, kd.content)));
-    
-    dpk.d_flags = kd.flags;
-    dpk.d_algorithm = dkrc.d_algorithm;
-    if(dpk.d_algorithm == 5 && getNSEC3PARAM(zone))
-      dpk.d_algorithm+=2;
-    
-    KeyMetaData kmd;
-
-    kmd.active = kd.active;
-    kmd.keyOrZone = (kd.flags == 257);
-    kmd.id = kd.id;
-    
-    if(boost::indeterminate(allOrKeyOrZone) || allOrKeyOrZone == kmd.keyOrZone)
-      retkeyset.push_back(make_pair(dpk, kmd));
-    allkeyset.push_back(make_pair(dpk, kmd));
-  }
-  sort(retkeyset.begin(), retkeyset.end(), keyCompareByKindAndID);
-  sort(allkeyset.begin(), allkeyset.end(), keyCompareByKindAndID);
-  
-  KeyCacheEntry kce;
-  kce.d_domain=zone;
-  kce.d_keys = allkeyset;
-  kce.d_ttd = now + 30;
-  {
-    WriteLock l(&s_keycachelock);
-    replacing_insert(s_keycache, kce);
-  }
-  
-  return retkeyset;
+  return ret;
 }
 
 bool DNSSECKeeper::secureZone(const std::string& name, int algorithm)
@@ -420,10 +495,6 @@ void DNSSECKeeper::cleanup()
         WriteLock l(&s_metacachelock);
         pruneCollection(s_metacache, ::arg().asNum("max-cache-entries"));
     }
-    {
-        WriteLock l(&s_keycachelock);
-        pruneCollection(s_keycache, ::arg().asNum("max-cache-entries"));
-    }
     s_last_prune=time(0);
   }
 }
@@ -50,13 +50,19 @@ private:
 //! compares two dns packets, skipping the header, but including the question and the qtype
 bool dnspacketLessThan(const std::string& a, const std::string& b)
 {
-  if(a.length() <= 12 || b.length() <= 12) 
-    return a.length() < b.length();
+  return dnspacketLessThan(a.c_str(), a.length(), b.c_str(), b.length());
+}
+
+//! same, for packets that are not in a string, like the one we just received
+bool dnspacketLessThan(const char* a, unsigned int alen, const char* b, unsigned int blen)
+{
+  if(alen <= 12 || blen <= 12) 
+    return alen < blen;
 //    throw runtime_error("Error parsing question in dnspacket comparison: packet too short");
     
   // we find: 3www4ds9a2nl0XXYY, where XX and YY are each 2 bytes describing class and type
   
-  BoundsCheckingPointer aSafe(a), bSafe(b);
+  BoundsCheckingPointer aSafe(a, alen), bSafe(b, blen);
   int aPos=12, bPos=12;
   
   unsigned char aLabelLen, bLabelLen;
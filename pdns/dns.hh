@@ -279,6 +279,7 @@ struct dnsheader {
 extern time_t s_starttime;
 std::string questionExpand(const char* packet, uint16_t len, uint16_t& type);
 bool dnspacketLessThan(const std::string& a, const std::string& b);
+bool dnspacketLessThan(const char* a, unsigned int alen, const char* b, unsigned int blen);
 
 /** helper function for both DNSPacket and addSOARecord() - converts a line into a struct, for easier parsing */
 void fillSOAData(const string &content, SOAData &data);
@@ -163,6 +163,14 @@ int BackendMakerClass::numLauncheable()
   return d_instances.size();
 }
 
+vector<string> BackendMakerClass::getInstances()
+{
+  vector<string> ret;
+  for(vector<pair<string,string> >::const_iterator i=d_instances.begin();i!=d_instances.end();++i)
+    ret.push_back(i->first+i->second);
+  return ret;
+}
+
 vector<DNSBackend *>BackendMakerClass::all(bool metadataOnly)
 {
   vector<DNSBackend *>ret;
@@ -263,6 +271,27 @@ bool DNSBackend::getBeforeAndAfterNames(uint32_t id, const std::string& zonename
   return ret;
 }
 
+bool DNSBackend::updateDNSSECOrderAndAuthBatch(uint32_t domain_id, const std::string& zonename, const vector<DNSSECOrderAndAuth>& names)
+{
+  for(vector<DNSSECOrderAndAuth>::const_iterator i = names.begin(); i != names.end(); ++i) {
+    if(i->ordering == DNSSECOrderAndAuth::AbsoluteOrdername)
+      updateDNSSECOrderAndAuthAbsolute(domain_id, i->qname, i->ordername, i->auth);
+    else if(i->ordering == DNSSECOrderAndAuth::RelativeOrdername)
+      updateDNSSECOrderAndAuth(domain_id, zonename, i->qname, i->auth);
+    else
+      nullifyDNSSECOrderNameAndUpdateAuth(domain_id, i->qname, i->auth);
+    if(i->dsAuth)
+      setDNSSECAuthOnDsRecord(domain_id, i->qname);
+    if(i->nullifyNS)
+      nullifyDNSSECOrderNameAndAuth(domain_id, i->qname, "NS");
+    if(i->nullifyAddresses) {
+      nullifyDNSSECOrderNameAndAuth(domain_id, i->qname, "A");
+      nullifyDNSSECOrderNameAndAuth(domain_id, i->qname, "AAAA");
+    }
+  }
+  return true;
+}
+
 /**
  * Calculates a SOA serial for the zone and stores it in the third
  * argument. Returns false if calculation is not possible for some
@@ -59,6 +59,33 @@ struct DomainInfo
   }
 };
 
+//! One step in the history of a zone, as sent in an IXFR (RFC 1995): the records removed and added going from oldSOA to newSOA
+struct IXFRDiff
+{
+  uint32_t fromSerial;
+  uint32_t toSerial;
+  DNSResourceRecord oldSOA;
+  DNSResourceRecord newSOA;
+  vector<DNSResourceRecord> removed;
+  vector<DNSResourceRecord> added;
+};
+
+//! The DNSSEC ordering and auth rectify works out for one name, see DNSBackend::updateDNSSECOrderAndAuthBatch
+struct DNSSECOrderAndAuth
+{
+  enum Ordering { NoOrdername, RelativeOrdername, AbsoluteOrdername };
+
+  DNSSECOrderAndAuth() : ordering(NoOrdername), auth(false), dsAuth(false), nullifyNS(false), nullifyAddresses(false)
+  {}
+  string qname;
+  string ordername;      //!< only used for AbsoluteOrdername, RelativeOrdername derives it from the zone name as updateDNSSECOrderAndAuth does
+  Ordering ordering;     //!< NoOrdername sets the ordername of the name to NULL
+  bool auth;
+  bool dsAuth;           //!< set auth on the DS records of this name
+  bool nullifyNS;        //!< the NS records of this name lose their ordername and auth
+  bool nullifyAddresses; //!< the A and AAAA records of this name lose their ordername and auth
+};
+
 class DNSPacket;
 
 
@@ -126,6 +153,12 @@ public:
 
   bool getBeforeAndAfterNames(uint32_t id, const std::string& zonename, const std::string& qname, std::string& before, std::string& after);
 
+  //! fills out all (ordername, name) pairs of a zone that have a non-empty ordername, in no particular order. Returns false if the backend can't list these, so callers fall back to getBeforeAndAfterNamesAbsolute
+  virtual bool getOrderNames(uint32_t domain_id, vector<pair<string, string> >& ordernames)
+  {
+    return false;
+  }
+
   virtual bool updateDNSSECOrderAndAuth(uint32_t domain_id, const std::string& zonename, const std::string& qname, bool auth)
   {
     return false;
@@ -136,6 +169,9 @@ public:
     return false;
   }
 
+  //! applies the result of rectifying many names at once. The default does this one name at a time with the calls above, backends that can do better override it
+  virtual bool updateDNSSECOrderAndAuthBatch(uint32_t domain_id, const std::string& zonename, const vector<DNSSECOrderAndAuth>& names);
+
   virtual bool updateEmptyNonTerminals(uint32_t domain_id, const std::string& zonename, set<string>& insert, set<string>& erase, bool remove)
   {
     return false;
@@ -200,6 +236,19 @@ public:
   {
     return false; // no problem!
   }
+
+  //! removes a record from a zone, needs a call to startTransaction first. Returns false if the backend can't do this, which disables
+  //! incoming IXFR. Should throw if the record is not there, the zone is then out of sync and needs an AXFR
+  virtual bool removeRecord(const DNSResourceRecord &rr)
+  {
+    return false;
+  }
+
+  //! backends that keep their own zone history fill out the diffs leading from fromSerial to toSerial, in order. If this returns false, the generic IXFR journal is used
+  virtual bool getIXFRDiffs(uint32_t domain_id, uint32_t fromSerial, uint32_t toSerial, vector<IXFRDiff>& diffs)
+  {
+    return false;
+  }
   //! if this returns true, DomainInfo di contains information about the domain
   virtual bool getDomainInfo(const string &domain, DomainInfo &di)
   {
@@ -285,6 +334,7 @@ public:
   void load(const string &module);
   int numLauncheable();
   vector<string> getModules();
+  vector<string> getInstances(); //!< launched backends in order, like 'gmysql' or 'gmysql-second'
 
 private:
   void load_all();
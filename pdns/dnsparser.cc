@@ -566,6 +566,11 @@ public:
     return *p;
   }
   
+  uint32_t getOffset() const
+  {
+    return d_offset;
+  }
+
   void skipRData()
   {
     int toskip = get16BitInt();
@@ -634,3 +639,42 @@ void ageDNSPacket(std::string& packet, uint32_t seconds)
     return;
   }
 }
+
+/* where the TTLs of the records are in packet, so it can be aged later on without parsing it again. 
+   Like ageDNSPacket, this stops at the OPT record, and gives up silently on a broken packet */
+void getDNSPacketTTLOffsets(const std::string& packet, vector<uint16_t>& offsets)
+{
+  offsets.clear();
+  if(packet.length() < sizeof(dnsheader))
+    return;
+  try 
+  {
+    dnsheader dh;
+    memcpy((void*)&dh, (const dnsheader*)packet.c_str(), sizeof(dh));
+    int numrecords = ntohs(dh.ancount) + ntohs(dh.nscount) + ntohs(dh.arcount);
+    DNSPacketMangler dpm(const_cast<std::string&>(packet)); // we only read
+    
+    int n;
+    for(n=0; n < ntohs(dh.qdcount) ; ++n) {
+      dpm.skipLabel();
+      dpm.skipBytes(4); // qtype, qclass
+    }
+    for(n=0; n < numrecords; ++n) {
+      dpm.skipLabel();
+      
+      uint16_t dnstype = dpm.get16BitInt();
+      /* uint16_t dnsclass = */ dpm.get16BitInt();
+      
+      if(dnstype == QType::OPT)
+	break;
+      
+      offsets.push_back(dpm.getOffset());
+      dpm.skipBytes(4);
+      dpm.skipRData();
+    }
+  }
+  catch(...)
+  {
+    offsets.clear();
+  }
+}
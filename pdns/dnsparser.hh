@@ -337,4 +337,5 @@ private:
 string simpleCompress(const string& label, const string& root="");
 void simpleExpandTo(const string& label, unsigned int frompos, string& ret);
 void ageDNSPacket(std::string& packet, uint32_t seconds);
+void getDNSPacketTTLOffsets(const std::string& packet, vector<uint16_t>& offsets);
 #endif
@@ -88,6 +88,15 @@ DNSCryptoKeyEngine* DNSCryptoKeyEngine::make(unsigned int algo)
   }
 }
 
+vector<string> DNSCryptoKeyEngine::signBatch(const vector<string>& msgs) const
+{
+  vector<string> signatures;
+  signatures.reserve(msgs.size());
+  BOOST_FOREACH(const string& msg, msgs)
+    signatures.push_back(sign(msg));
+  return signatures;
+}
+
 void DNSCryptoKeyEngine::report(unsigned int algo, maker_t* maker, bool fallback)
 {
   getAllMakers()[algo].push_back(maker);
@@ -342,6 +351,60 @@ std::string hashQNameWithSalt(unsigned int times, const std::string& salt, const
   }
   return string((char*)hash, sizeof(hash));
 }
+
+namespace {
+struct HashJob
+{
+  unsigned int times;
+  const string* salt;
+  const vector<string>* qnames;
+  vector<string>* hashes;
+  vector<string>::size_type begin, end;
+};
+
+void* hashQNamesThread(void* p)
+{
+  HashJob* hj = (HashJob*)p;
+  for(vector<string>::size_type n = hj->begin; n < hj->end; ++n)
+    (*hj->hashes)[n] = hashQNameWithSalt(hj->times, *hj->salt, (*hj->qnames)[n]);
+  return 0;
+}
+}
+
+void hashQNamesWithSalt(unsigned int times, const std::string& salt, const vector<string>& qnames, vector<string>& hashes, unsigned int threads)
+{
+  hashes.clear();
+  hashes.resize(qnames.size());
+
+  // starting threads for a small zone costs more than it saves
+  if(qnames.size() < 1000)
+    threads = 1;
+  threads = max(1U, threads);
+
+  vector<HashJob> jobs(threads);
+  vector<pthread_t> tids(threads);
+  vector<string>::size_type chunk = (qnames.size() + threads - 1) / threads;
+  for(unsigned int n = 0; n < threads; ++n) {
+    HashJob& hj = jobs[n];
+    hj.times = times;
+    hj.salt = &salt;
+    hj.qnames = &qnames;
+    hj.hashes = &hashes;
+    hj.begin = min(qnames.size(), n * chunk);
+    hj.end = min(qnames.size(), hj.begin + chunk);
+  }
+
+  if(threads == 1) {
+    hashQNamesThread(&jobs[0]);
+    return;
+  }
+
+  for(unsigned int n = 0; n < threads; ++n)
+    pthread_create(&tids[n], 0, hashQNamesThread, &jobs[n]);
+  for(unsigned int n = 0; n < threads; ++n)
+    pthread_join(tids[n], 0);
+}
+
 DNSKEYRecordContent DNSSECPrivateKey::getDNSKEY() const
 {
   return makeDNSKEYFromDNSCryptoKeyEngine(getKey(), d_algorithm, d_flags);
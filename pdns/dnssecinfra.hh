@@ -22,6 +22,8 @@ class DNSCryptoKeyEngine
     virtual storvector_t convertToISCVector() const =0;
     std::string convertToISC() const ;
     virtual std::string sign(const std::string& msg) const =0;
+    //! signs each message in msgs, in order. Engines that can share setup work between signatures override this
+    virtual std::vector<std::string> signBatch(const std::vector<std::string>& msgs) const;
     virtual std::string hash(const std::string& msg) const =0;
     virtual bool verify(const std::string& msg, const std::string& signature) const =0;
     
@@ -118,12 +120,16 @@ struct DNSSECPrivateKey;
 
 void fillOutRRSIG(DNSSECPrivateKey& dpk, const std::string& signQName, RRSIGRecordContent& rrc, vector<shared_ptr<DNSRecordContent> >& toSign);
 uint32_t getCurrentInception(unsigned int safety=0);
+//! sets the number of signatures fillOutRRSIG() remembers
+void setSignatureCacheSize(unsigned int maxEntries);
 void addSignature(DNSSECKeeper& dk, DNSBackend& db, const std::string signQName, const std::string& wildcardname, uint16_t signQType, uint32_t signTTL, DNSPacketWriter::Place signPlace, 
   vector<shared_ptr<DNSRecordContent> >& toSign, vector<DNSResourceRecord>& outsigned, uint32_t origTTL);
 int getRRSIGsForRRSET(DNSSECKeeper& dk, const std::string& signer, const std::string signQName, uint16_t signQType, uint32_t signTTL, 
 		     vector<shared_ptr<DNSRecordContent> >& toSign, vector<RRSIGRecordContent> &rrc, bool ksk);
 
 std::string hashQNameWithSalt(unsigned int times, const std::string& salt, const std::string& qname);
+//! hashes[n] becomes hashQNameWithSalt(times, salt, qnames[n]), spread over 'threads' threads for large zones
+void hashQNamesWithSalt(unsigned int times, const std::string& salt, const vector<string>& qnames, vector<string>& hashes, unsigned int threads);
 void decodeDERIntegerSequence(const std::string& input, vector<string>& output);
 class DNSPacket;
 void addRRSigs(DNSSECKeeper& dk, DNSBackend& db, const std::set<string, CIStringCompare>& authMap, vector<DNSResourceRecord>& rrs);
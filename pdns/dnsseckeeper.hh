@@ -104,20 +104,33 @@ public:
 private:
 
   
-  struct KeyCacheEntry
+  /* Everything about the DNSSEC setup of a zone that answering queries needs. A descriptor is never changed once it
+     is published in s_descriptors, a reload publishes a new one and marks the old one superseded. Each thread keeps
+     its own map of the descriptors it used, so the common case of a fresh descriptor needs no locking at all. */
+  struct ZoneDescriptor : public boost::noncopyable
   {
-    typedef vector<DNSSECKeeper::keymeta_t> keys_t;
-  
-    uint32_t getTTD() const
-    {
-      return d_ttd;
-    }
-  
-    string d_domain;
-    unsigned int d_ttd;
-    mutable keys_t d_keys;
+    ZoneDescriptor() : d_ttd(0), d_presigned(false), d_haveNSEC3(false), d_narrow(false), d_superseded(false)
+    {}
+    string d_zone;
+    time_t d_ttd;
+    keyset_t d_keys;              //!< all keys of the zone, KSKs first
+    map<string, string> d_meta;   //!< first value of each kind in s_descriptorKinds
+    bool d_presigned;
+    bool d_haveNSEC3;
+    NSEC3PARAMRecordContent d_ns3pr;
+    bool d_narrow;
+    mutable volatile bool d_superseded; //!< written under s_descriptorlock, readers may see it a little late
+    mutable AtomicCounter d_refreshing; //!< the first thread to find the descriptor expired reloads it, the others keep using it
   };
-  
+  typedef map<string, shared_ptr<const ZoneDescriptor>, CIStringCompare> descriptors_t;
+
+  shared_ptr<const ZoneDescriptor> getZoneDescriptor(const std::string& zone);
+  shared_ptr<const ZoneDescriptor> loadZoneDescriptor(const std::string& zone);
+  static bool usable(const ZoneDescriptor& zd, time_t now);
+  static void publish(const shared_ptr<const ZoneDescriptor>& zd);
+  static void makeDescriptorsKey();
+  static void freeDescriptors(void* descriptors);
+
   struct METACacheEntry
   {
     uint32_t getTTD() const
@@ -132,13 +145,6 @@ private:
   };
   
   
-  typedef multi_index_container<
-    KeyCacheEntry,
-    indexed_by<
-      ordered_unique<member<KeyCacheEntry, std::string, &KeyCacheEntry::d_domain>, CIStringCompare >,
-      sequenced<>
-    >
-  > keycache_t;
   typedef multi_index_container<
     METACacheEntry,
     indexed_by<
@@ -154,11 +160,14 @@ private:
 
   void cleanup();
 
-  static keycache_t s_keycache;
-  static metacache_t s_metacache;
+  static descriptors_t s_descriptors;
+  static pthread_rwlock_t s_descriptorlock;
+  static __thread descriptors_t* t_descriptors;
+  static pthread_key_t s_descriptorsKey;
+  static pthread_once_t s_descriptorsOnce;
+  static const char* s_descriptorKinds[];
+  static metacache_t s_metacache;  //!< metadata kinds that are not part of the ZoneDescriptor
   static pthread_rwlock_t s_metacachelock;
-  static pthread_rwlock_t s_keycachelock;
-  static AtomicCounter s_ops;
   static time_t s_last_prune;
 };
 
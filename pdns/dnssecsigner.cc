@@ -20,17 +20,132 @@
 #include <boost/foreach.hpp>
 #include "md5.hh"
 #include "dnsseckeeper.hh"
-#include "dns_random.hh"
 #include "lock.hh"
+#include "statbag.hh"
+#include <boost/utility.hpp>
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/sequenced_index.hpp>
+#include <boost/multi_index/key_extractors.hpp>
 
-/* this is where the RRSIGs begin, keys are retrieved,
-   but the actual signing happens in fillOutRRSIG */
-int getRRSIGsForRRSET(DNSSECKeeper& dk, const std::string& signer, const std::string signQName, uint16_t signQType, uint32_t signTTL, 
-		     vector<shared_ptr<DNSRecordContent> >& toSign, vector<RRSIGRecordContent>& rrcs, bool ksk)
+using namespace boost::multi_index;
+
+/* Signatures are cached on a hash of the signing key and the message signed, which includes the inception and
+   expiration of the RRSIG. The cache is split in shards to keep threads from waiting on each other, and each
+   shard drops its least recently used signatures when full, and signatures that have expired when they come by. */
+namespace {
+class SignatureCache : public boost::noncopyable
+{
+public:
+  SignatureCache() : d_maxEntries(1000000)
+  {
+    for(unsigned int n = 0; n < s_numShards; ++n)
+      pthread_mutex_init(&d_shards[n].d_lock, 0);
+
+    extern StatBag S;
+    S.declare("signature-cache-hit", "Number of signatures found in the signature cache");
+    S.declare("signature-cache-miss", "Number of signatures that had to be calculated");
+    S.declare("signature-cache-evict", "Number of signatures dropped from the signature cache because it was full");
+    d_statnumhit=S.getPointer("signature-cache-hit");
+    d_statnummiss=S.getPointer("signature-cache-miss");
+    d_statnumevict=S.getPointer("signature-cache-evict");
+  }
+
+  bool get(const string& key, uint32_t now, string& signature)
+  {
+    Shard& shard = getShard(key);
+    Lock l(&shard.d_lock);
+    cache_t::iterator iter = shard.d_entries.find(key);
+    if(iter == shard.d_entries.end()) {
+      __sync_fetch_and_add(d_statnummiss, 1); // StatBag counters are shared by all shards
+      return false;
+    }
+    if(iter->d_expire <= now) {
+      shard.d_entries.erase(iter);
+      __sync_fetch_and_add(d_statnummiss, 1);
+      return false;
+    }
+    shard.d_entries.get<1>().relocate(shard.d_entries.get<1>().end(), shard.d_entries.project<1>(iter)); // most recently used goes to the back
+    signature = iter->d_signature;
+    __sync_fetch_and_add(d_statnumhit, 1);
+    return true;
+  }
+
+  void insert(const string& key, uint32_t expire, const string& signature)
+  {
+    Entry entry;
+    entry.d_key = key;
+    entry.d_expire = expire;
+    entry.d_signature = signature;
+
+    unsigned int maxShardEntries = max(1U, d_maxEntries / s_numShards);
+    Shard& shard = getShard(key);
+    Lock l(&shard.d_lock);
+    if(!shard.d_entries.insert(entry).second)
+      return;
+    while(shard.d_entries.size() > maxShardEntries) {
+      shard.d_entries.get<1>().pop_front();
+      __sync_fetch_and_add(d_statnumevict, 1);
+    }
+  }
+
+  void setMaxEntries(unsigned int maxEntries)
+  {
+    d_maxEntries = maxEntries;
+  }
+
+private:
+  struct Entry
+  {
+    string d_key;      // md5 of the public key hash and the message, fixed width
+    string d_signature;
+    uint32_t d_expire;
+  };
+
+  typedef multi_index_container<
+    Entry,
+    indexed_by <
+      ordered_unique<member<Entry,string,&Entry::d_key> >,
+      sequenced<>
+    >
+  > cache_t;
+
+  struct Shard
+  {
+    pthread_mutex_t d_lock;
+    cache_t d_entries;
+  };
+
+  static const unsigned int s_numShards = 16;
+
+  Shard& getShard(const string& key)
+  {
+    return d_shards[(unsigned char)key[0] % s_numShards];
+  }
+
+  Shard d_shards[s_numShards];
+  unsigned int d_maxEntries;
+  unsigned int *d_statnumhit;
+  unsigned int *d_statnummiss;
+  unsigned int *d_statnumevict;
+};
+
+SignatureCache& getSignatureCache()
+{
+  static SignatureCache signatures;
+  return signatures;
+}
+}
+
+void setSignatureCacheSize(unsigned int maxEntries)
+{
+  getSignatureCache().setMaxEntries(maxEntries);
+}
+
+/* the RRSIG fields that are the same for all keys, and the keys that sign the RRSET */
+static void getRRSIGTemplate(DNSSECKeeper& dk, const std::string& signer, const std::string signQName, uint16_t signQType, uint32_t signTTL, 
+                             bool ksk, RRSIGRecordContent& rrc, vector<DNSSECPrivateKey>& signingKeys)
 {
-  if(toSign.empty())
-    return -1;
-  RRSIGRecordContent rrc;
   rrc.d_type=signQType;
 
   rrc.d_labels=countLabels(signQName); 
@@ -44,7 +159,6 @@ int getRRSIGsForRRSET(DNSSECKeeper& dk, const std::string& signer, const std::st
   
   DNSSECKeeper::keyset_t keys = dk.getKeys(signer); // we don't want the . for the root!
   vector<DNSSECPrivateKey> KSKs, ZSKs;
-  vector<DNSSECPrivateKey>* signingKeys;
   
   // if ksk==1, only get KSKs
   // if ksk==0, get ZSKs, unless there is no ZSK, then get KSK
@@ -58,16 +172,24 @@ int getRRSIGsForRRSET(DNSSECKeeper& dk, const std::string& signer, const std::st
     else if(!ksk)
       ZSKs.push_back(keymeta.first);
   }
-  if(ksk)
-    signingKeys = &KSKs;
-  else {
-    if(ZSKs.empty())
-      signingKeys = &KSKs;
-    else
-      signingKeys =&ZSKs;
-  }
+  if(ksk || ZSKs.empty())
+    signingKeys.swap(KSKs);
+  else
+    signingKeys.swap(ZSKs);
+}
+
+/* this is where the RRSIGs begin, keys are retrieved,
+   but the actual signing happens in fillOutRRSIG */
+int getRRSIGsForRRSET(DNSSECKeeper& dk, const std::string& signer, const std::string signQName, uint16_t signQType, uint32_t signTTL, 
+		     vector<shared_ptr<DNSRecordContent> >& toSign, vector<RRSIGRecordContent>& rrcs, bool ksk)
+{
+  if(toSign.empty())
+    return -1;
+  RRSIGRecordContent rrc;
+  vector<DNSSECPrivateKey> signingKeys;
+  getRRSIGTemplate(dk, signer, signQName, signQType, signTTL, ksk, rrc, signingKeys);
   
-  BOOST_FOREACH(DNSSECPrivateKey& dpk, *signingKeys) {
+  BOOST_FOREACH(DNSSECPrivateKey& dpk, signingKeys) {
     fillOutRRSIG(dpk, signQName, rrc, toSign);
     rrcs.push_back(rrc);
   }
@@ -110,47 +232,121 @@ void addSignature(DNSSECKeeper& dk, DNSBackend& db, const std::string& signer, c
   toSign.clear();
 }
 
-static pthread_rwlock_t g_signatures_lock = PTHREAD_RWLOCK_INITIALIZER;
-typedef map<pair<string, string>, string> signaturecache_t;
-static signaturecache_t g_signatures;
-static int g_cacheweekno;
-
-void fillOutRRSIG(DNSSECPrivateKey& dpk, const std::string& signQName, RRSIGRecordContent& rrc, vector<shared_ptr<DNSRecordContent> >& toSign) 
+/* fills out the RRSIG fields that depend on the key, and the signature if it is in the cache. If it isn't, msg and
+   lookup are what needs to be signed and the key to cache the signature under */
+static bool prepareRRSIG(DNSSECPrivateKey& dpk, const std::string& signQName, RRSIGRecordContent& rrc, vector<shared_ptr<DNSRecordContent> >& toSign, 
+                         string& msg, string& lookup)
 {
   DNSKEYRecordContent drc = dpk.getDNSKEY(); 
   const DNSCryptoKeyEngine* rc = dpk.getKey();
   rrc.d_tag = drc.getTag();
   rrc.d_algorithm = drc.d_algorithm;
   
-  string msg=getMessageForRRSET(signQName, rrc, toSign); // this is what we will hash & sign
-  pair<string, string> lookup(rc->getPubKeyHash(), pdns_md5sum(msg));  // this hash is a memory saving exercise
+  msg=getMessageForRRSET(signQName, rrc, toSign); // this is what we will hash & sign
+  lookup=pdns_md5sum(rc->getPubKeyHash()+msg);  // this hash is a memory saving exercise
   
-  bool doCache=1;
-  if(doCache)
-  {
-    ReadLock l(&g_signatures_lock);
-    signaturecache_t::const_iterator iter = g_signatures.find(lookup);
-    if(iter != g_signatures.end()) {
-      rrc.d_signature=iter->second;
-      return;
+  return getSignatureCache().get(lookup, time(0), rrc.d_signature);
+}
+
+void fillOutRRSIG(DNSSECPrivateKey& dpk, const std::string& signQName, RRSIGRecordContent& rrc, vector<shared_ptr<DNSRecordContent> >& toSign) 
+{
+  string msg, lookup;
+  if(prepareRRSIG(dpk, signQName, rrc, toSign, msg, lookup))
+    return;
+  
+  rrc.d_signature = dpk.getKey()->sign(msg);
+
+  getSignatureCache().insert(lookup, rrc.d_sigexpire, rrc.d_signature);
+}
+
+namespace {
+/* an RRSIG that addRRSigs still has to sign, so all signatures made with one key can go to signBatch() together */
+struct PendingSignature
+{
+  DNSSECPrivateKey d_dpk;
+  RRSIGRecordContent d_rrc;
+  string d_msg;
+  string d_lookup;
+  vector<DNSResourceRecord>::size_type d_pos; // where the RRSIG is in the output
+};
+}
+
+/* like addSignature, but the signatures not found in the cache are left for signPending */
+static void queueSignature(DNSSECKeeper& dk, DNSBackend& db, const std::string& signer, const std::string signQName, const std::string& wildcardname, uint16_t signQType, 
+  uint32_t signTTL, DNSPacketWriter::Place signPlace, 
+  vector<shared_ptr<DNSRecordContent> >& toSign, vector<DNSResourceRecord>& outsigned, uint32_t origTTL, vector<PendingSignature>& pending)
+{
+  if(toSign.empty())
+    return;
+  if(dk.isPresigned(signer)) {
+    addSignature(dk, db, signer, signQName, wildcardname, signQType, signTTL, signPlace, toSign, outsigned, origTTL);
+    return;
+  }
+
+  const string& rrsigQName = wildcardname.empty() ? signQName : wildcardname;
+  RRSIGRecordContent rrc;
+  vector<DNSSECPrivateKey> signingKeys;
+  getRRSIGTemplate(dk, signer, rrsigQName, signQType, signTTL, signQType == QType::DNSKEY, rrc, signingKeys);
+
+  DNSResourceRecord rr;
+  rr.qname=signQName;
+  rr.qtype=QType::RRSIG;
+  if(origTTL)
+    rr.ttl=origTTL;
+  else
+    rr.ttl=signTTL;
+  rr.auth=false;
+  rr.d_place = (DNSResourceRecord::Place) signPlace;
+
+  BOOST_FOREACH(DNSSECPrivateKey& dpk, signingKeys) {
+    PendingSignature ps;
+    if(prepareRRSIG(dpk, rrsigQName, rrc, toSign, ps.d_msg, ps.d_lookup)) {
+      rr.content = rrc.getZoneRepresentation();
     }
-    else
-      ; // cerr<<"Miss!"<<endl;
+    else {
+      ps.d_dpk = dpk;
+      ps.d_rrc = rrc;
+      ps.d_pos = outsigned.size();
+      pending.push_back(ps);
+      rr.content.clear(); // filled out by signPending
+    }
+    outsigned.push_back(rr);
   }
-  
-  rrc.d_signature = rc->sign(msg);
+  toSign.clear();
+}
 
-  if(doCache) {
-    WriteLock l(&g_signatures_lock);
-    /* we add some jitter here so not all your slaves start pruning their caches at the very same millisecond */
-    unsigned int weekno = (time(0) - dns_random(3600)) / (86400*7);  // we just spent milliseconds doing a signature, microsecond more won't kill us
-  
-    if(g_cacheweekno < weekno) {  // blunt but effective (C) Habbie
-      g_signatures.clear();
-      g_cacheweekno = weekno;
+static bool pendingKeyCompare(const PendingSignature* a, const PendingSignature* b)
+{
+  return a->d_dpk.getKey() < b->d_dpk.getKey();
+}
+
+/* signs everything queueSignature could not find in the cache, one signBatch() per key */
+static void signPending(vector<PendingSignature>& pending, vector<DNSResourceRecord>& rrs)
+{
+  vector<PendingSignature*> byKey;
+  byKey.reserve(pending.size());
+  BOOST_FOREACH(PendingSignature& ps, pending)
+    byKey.push_back(&ps);
+  stable_sort(byKey.begin(), byKey.end(), pendingKeyCompare);
+
+  vector<PendingSignature*>::size_type begin = 0;
+  while(begin < byKey.size()) {
+    const DNSCryptoKeyEngine* rc = byKey[begin]->d_dpk.getKey();
+    vector<PendingSignature*>::size_type end = begin;
+    vector<string> msgs;
+    for(; end < byKey.size() && byKey[end]->d_dpk.getKey() == rc; ++end)
+      msgs.push_back(byKey[end]->d_msg);
+
+    vector<string> signatures = rc->signBatch(msgs);
+    for(vector<PendingSignature*>::size_type n = begin; n < end; ++n) {
+      PendingSignature& ps = *byKey[n];
+      ps.d_rrc.d_signature = signatures[n - begin];
+      getSignatureCache().insert(ps.d_lookup, ps.d_rrc.d_sigexpire, ps.d_rrc.d_signature);
+      rrs[ps.d_pos].content = ps.d_rrc.getZoneRepresentation();
     }
-    g_signatures[lookup] = rrc.d_signature;
+    begin = end;
   }
+  pending.clear();
 }
 
 static bool rrsigncomp(const DNSResourceRecord& a, const DNSResourceRecord& b)
@@ -186,12 +382,13 @@ void addRRSigs(DNSSECKeeper& dk, DNSBackend& db, const set<string, CIStringCompa
   vector<shared_ptr<DNSRecordContent> > toSign;
 
   vector<DNSResourceRecord> signedRecords;
+  vector<PendingSignature> pending;
   
   string signer;
   for(vector<DNSResourceRecord>::const_iterator pos = rrs.begin(); pos != rrs.end(); ++pos) {
     if(pos != rrs.begin() && (signQType != pos->qtype.getCode()  || signQName != pos->qname)) {
       if(getBestAuthFromSet(authSet, signQName, signer))
-        addSignature(dk, db, signer, signQName, wildcardQName, signQType, signTTL, signPlace, toSign, signedRecords, origTTL);
+        queueSignature(dk, db, signer, signQName, wildcardQName, signQType, signTTL, signPlace, toSign, signedRecords, origTTL, pending);
     }
     signedRecords.push_back(*pos);
     signQName= pos->qname;
@@ -219,6 +416,7 @@ void addRRSigs(DNSSECKeeper& dk, DNSBackend& db, const set<string, CIStringCompa
     }
   }
   if(getBestAuthFromSet(authSet, signQName, signer))
-    addSignature(dk, db, signer, signQName, wildcardQName, signQType, signTTL, signPlace, toSign, signedRecords, origTTL);
+    queueSignature(dk, db, signer, signQName, wildcardQName, signQType, signTTL, signPlace, toSign, signedRecords, origTTL, pending);
+  signPending(pending, signedRecords);
   rrs.swap(signedRecords);
 }
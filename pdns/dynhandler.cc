@@ -26,6 +26,9 @@
 #include "misc.hh"
 #include "communicator.hh"
 #include "dnsseckeeper.hh"
+#include "nsec3cache.hh"
+#include "knownnames.hh"
+#include "zoneapexes.hh"
 
 static bool s_pleasequit;
 
@@ -53,6 +56,16 @@ static void dokill(int)
 
 string DLRQuitHandler(const vector<string>&parts, Utility::pid_t ppid)
 {
+  if(!::arg()["cache-snapshot-file"].empty()) {
+    extern PacketCache PC;
+    try {
+      int count=PC.dump(::arg()["cache-snapshot-file"]);
+      L<<Logger::Warning<<"Wrote "<<count<<" cache entries to '"<<::arg()["cache-snapshot-file"]<<"' before exiting"<<endl;
+    }
+    catch(AhuException& ae) {
+      L<<Logger::Error<<ae.reason<<endl;
+    }
+  }
 #ifndef WIN32
   signal(SIGALRM, dokill);
 
@@ -121,17 +134,40 @@ string DLPurgeHandler(const vector<string>&parts, Utility::pid_t ppid)
     for (vector<string>::const_iterator i=++parts.begin();i<parts.end();++i) {
       ret+=PC.purge(*i);
       dk.clearCaches(*i);
+      g_nsec3cache.clearIndexes(*i);
     }
   }
   else {
     ret=PC.purge();
     dk.clearAllCaches();
+    g_nsec3cache.clearIndexes();
   }
+  g_knownnames.clear();
+  g_zoneapexes.clear();
 
   os<<ret;
   return os.str();
 }
 
+string DLDumpCacheHandler(const vector<string>&parts, Utility::pid_t ppid)
+{
+  extern PacketCache PC;
+  if(parts.size() > 2)
+    return "syntax: dump-cache [filename]";
+
+  string fname = parts.size()==2 ? parts[1] : ::arg()["cache-snapshot-file"];
+  if(fname.empty())
+    return "No filename given and no cache-snapshot-file configured";
+  try {
+    ostringstream os;
+    os<<"Dumped "<<PC.dump(fname)<<" cache entries to '"<<fname<<"'";
+    return os.str();
+  }
+  catch(AhuException& ae) {
+    return ae.reason;
+  }
+}
+
 string DLCCHandler(const vector<string>&parts, Utility::pid_t ppid)
 {
   extern PacketCache PC;  
@@ -204,10 +240,23 @@ string DLNotifyRetrieveHandler(const vector<string>&parts, Utility::pid_t ppid)
     return "Domain '"+domain+"' is not a slave domain (or has no master defined)";
 
   random_shuffle(di.masters.begin(), di.masters.end());
-  Communicator.addSuckRequest(domain, di.masters.front());
+  Communicator.addSuckRequest(domain, di.masters.front(), SuckRequest::Notify);
   return "Added retrieval request for '"+domain+"' from master "+di.masters.front();
 }
 
+string DLTransferStatusHandler(const vector<string>&parts, Utility::pid_t ppid)
+{
+  extern CommunicatorClass Communicator;
+  if(parts.size() > 2)
+    return "syntax: xfr-status [domain]";
+  return Communicator.getTransferStatus(parts.size() == 2 ? parts[1] : "");
+}
+
+string DLBackendLatencyHandler(const vector<string>&parts, Utility::pid_t ppid)
+{
+  return UeberBackend::getLatencyReport();
+}
+
 string DLNotifyHostHandler(const vector<string>&parts, Utility::pid_t ppid)
 {
   extern CommunicatorClass Communicator;
@@ -250,6 +299,8 @@ string DLRediscoverHandler(const vector<string>&parts, Utility::pid_t ppid)
     L<<Logger::Error<<"Rediscovery was requested"<<endl;
     string status="Ok";
     P.getBackend()->rediscover(&status);
+    g_zoneapexes.clear();
+    g_nsec3cache.clearIndexes();
     return status;
   }
   catch(AhuException &ae) {
@@ -262,6 +313,8 @@ string DLReloadHandler(const vector<string>&parts, Utility::pid_t ppid)
 {
   PacketHandler P;
   P.getBackend()->reload();
+  g_zoneapexes.clear();
+  g_nsec3cache.clearIndexes();
   L<<Logger::Error<<"Reload was requested"<<endl;
   return "Ok";
 }
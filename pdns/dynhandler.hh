@@ -50,5 +50,8 @@ string DLReloadHandler(const vector<string>&parts, Utility::pid_t ppid);
 string DLRediscoverHandler(const vector<string>&parts, Utility::pid_t ppid);
 string DLVersionHandler(const vector<string>&parts, Utility::pid_t ppid);
 string DLPurgeHandler(const vector<string>&parts, Utility::pid_t ppid);
+string DLDumpCacheHandler(const vector<string>&parts, Utility::pid_t ppid);
 string DLNotifyRetrieveHandler(const vector<string>&parts, Utility::pid_t ppid);
+string DLTransferStatusHandler(const vector<string>&parts, Utility::pid_t ppid);
+string DLBackendLatencyHandler(const vector<string>&parts, Utility::pid_t ppid);
 #endif /* PDNS_DYNHANDLER_HH */
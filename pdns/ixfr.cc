@@ -0,0 +1,204 @@
+/*
+    PowerDNS Versatile Database Driven Nameserver
+    Copyright (C) 2002 - 2011  PowerDNS.COM BV
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation
+
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "ixfr.hh"
+#include "lock.hh"
+#include "logger.hh"
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+
+IXFRJournal IXJ;
+
+IXFRJournal::IXFRJournal() : d_maxDiffs(0)
+{
+  pthread_mutex_init(&d_lock, 0);
+}
+
+IXFRJournal::~IXFRJournal()
+{
+  pthread_mutex_destroy(&d_lock);
+}
+
+// the fields are separated by a 0, which can't appear in a name or in content, so keyToRecord() can split them again
+string IXFRJournal::recordKey(const DNSResourceRecord& rr)
+{
+  string ret=toLower(rr.qname);
+  ret.append(1, '\0');
+  ret+=lexical_cast<string>(rr.qtype.getCode());
+  ret.append(1, '\0');
+  ret+=lexical_cast<string>(rr.ttl);
+  ret.append(1, '\0');
+  ret+=lexical_cast<string>(rr.priority);
+  ret.append(1, '\0');
+  ret+=rr.content;
+  return ret;
+}
+
+DNSResourceRecord IXFRJournal::keyToRecord(const string& key, int domain_id)
+{
+  string::size_type pos[4];
+  string::size_type start=0;
+  for(int n=0; n < 4; ++n) {
+    pos[n]=key.find('\0', start);
+    start=pos[n]+1;
+  }
+
+  DNSResourceRecord rr;
+  rr.qname=key.substr(0, pos[0]);
+  rr.qtype=atoi(key.c_str()+pos[0]+1);
+  rr.ttl=strtoul(key.c_str()+pos[1]+1, 0, 10);
+  rr.priority=atoi(key.c_str()+pos[2]+1);
+  rr.content=key.substr(pos[3]+1);
+  rr.domain_id=domain_id;
+  rr.auth=true;
+  rr.d_place=DNSResourceRecord::ANSWER;
+  return rr;
+}
+
+void IXFRJournal::pushDiff(ZoneJournal& zj, const IXFRDiff& diff)
+{
+  zj.d_diffs.push_back(diff);
+  while(zj.d_diffs.size() > d_maxDiffs)
+    zj.d_diffs.pop_front();
+  zj.d_serial=diff.toSerial;
+  zj.d_soa=diff.newSOA;
+}
+
+void IXFRJournal::update(const SOAData& sd, DNSBackend* db)
+{
+  if(!d_maxDiffs)
+    return;
+
+  {
+    Lock l(&d_lock);
+    zones_t::const_iterator iter=d_zones.find(sd.qname);
+    if(iter != d_zones.end() && iter->second.d_valid && iter->second.d_serial == sd.serial)
+      return;
+  }
+
+  // list outside of the lock, this can take a while for large zones
+  if(!db->list(sd.qname, sd.domain_id))
+    throw AhuException("Backend signals error condition listing zone '"+sd.qname+"' for the IXFR journal");
+
+  snapshot_t snapshot;
+  DNSResourceRecord rr;
+  while(db->get(rr)) {
+    uint16_t qtype=rr.qtype.getCode();
+    if(!qtype || qtype == QType::SOA || qtype == QType::RRSIG) // same as what goes out in an AXFR
+      continue;
+    snapshot.insert(recordKey(rr));
+  }
+
+  DNSResourceRecord soa;
+  soa.qname=sd.qname;
+  soa.qtype=QType::SOA;
+  soa.content=serializeSOAData(sd);
+  soa.ttl=sd.ttl;
+  soa.domain_id=sd.domain_id;
+  soa.auth=true;
+  soa.d_place=DNSResourceRecord::ANSWER;
+
+  Lock l(&d_lock);
+  ZoneJournal& zj=d_zones[sd.qname];
+  if(zj.d_valid && zj.d_serial == sd.serial) // somebody beat us to it
+    return;
+
+  if(zj.d_valid && rfc1982LessThan(zj.d_serial, sd.serial)) {
+    IXFRDiff diff;
+    diff.fromSerial=zj.d_serial;
+    diff.toSerial=sd.serial;
+    diff.oldSOA=zj.d_soa;
+    diff.newSOA=soa;
+
+    // both snapshots are sorted on the same key, so a single merging pass finds the differences
+    snapshot_t::const_iterator o=zj.d_snapshot.begin(), n=snapshot.begin();
+    while(o != zj.d_snapshot.end() || n != snapshot.end()) {
+      if(n == snapshot.end() || (o != zj.d_snapshot.end() && *o < *n))
+        diff.removed.push_back(keyToRecord(*o++, sd.domain_id));
+      else if(o == zj.d_snapshot.end() || *n < *o)
+        diff.added.push_back(keyToRecord(*n++, sd.domain_id));
+      else {
+        ++o;
+        ++n;
+      }
+    }
+    pushDiff(zj, diff);
+    L<<Logger::Info<<"IXFR journal for '"<<sd.qname<<"' moved from serial "<<diff.fromSerial<<" to "<<diff.toSerial<<
+      ", "<<diff.removed.size()<<" records removed, "<<diff.added.size()<<" added"<<endl;
+  }
+  else {
+    if(zj.d_valid)
+      L<<Logger::Warning<<"Serial of '"<<sd.qname<<"' went back from "<<zj.d_serial<<" to "<<sd.serial<<", dropping its IXFR journal"<<endl;
+    zj.d_diffs.clear();
+  }
+
+  zj.d_serial=sd.serial;
+  zj.d_soa=soa;
+  zj.d_snapshot.swap(snapshot);
+  zj.d_valid=true;
+}
+
+bool IXFRJournal::getDiffs(const string& zone, uint32_t fromSerial, uint32_t toSerial, vector<IXFRDiff>& diffs)
+{
+  diffs.clear();
+  Lock l(&d_lock);
+  zones_t::const_iterator iter=d_zones.find(zone);
+  if(iter == d_zones.end() || !iter->second.d_valid || iter->second.d_serial != toSerial)
+    return false;
+
+  uint32_t serial=fromSerial;
+  for(deque<IXFRDiff>::const_iterator diff=iter->second.d_diffs.begin(); diff != iter->second.d_diffs.end(); ++diff) {
+    if(diffs.empty() && diff->fromSerial != serial)
+      continue;
+    if(diff->fromSerial != serial) { // a hole in the chain
+      diffs.clear();
+      return false;
+    }
+    diffs.push_back(*diff);
+    serial=diff->toSerial;
+  }
+  if(diffs.empty() || serial != toSerial) {
+    diffs.clear();
+    return false;
+  }
+  return true;
+}
+
+void IXFRJournal::addDiff(const string& zone, const IXFRDiff& diff)
+{
+  if(!d_maxDiffs)
+    return;
+
+  Lock l(&d_lock);
+  zones_t::iterator iter=d_zones.find(zone);
+  if(iter == d_zones.end())
+    return; // nobody asked for an IXFR of this zone yet, the first one will take the snapshot
+
+  ZoneJournal& zj=iter->second;
+  if(!zj.d_valid || zj.d_serial != diff.fromSerial) {
+    d_zones.erase(iter);
+    return;
+  }
+
+  BOOST_FOREACH(const DNSResourceRecord& rr, diff.removed)
+    zj.d_snapshot.erase(recordKey(rr));
+  BOOST_FOREACH(const DNSResourceRecord& rr, diff.added)
+    zj.d_snapshot.insert(recordKey(rr));
+
+  pushDiff(zj, diff);
+}
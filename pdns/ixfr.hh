@@ -0,0 +1,93 @@
+/*
+    PowerDNS Versatile Database Driven Nameserver
+    Copyright (C) 2002 - 2011  PowerDNS.COM BV
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation
+
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#ifndef PDNS_IXFR_HH
+#define PDNS_IXFR_HH
+
+#include <string>
+#include <map>
+#include <set>
+#include <deque>
+#include <vector>
+#include <pthread.h>
+#include <boost/utility.hpp>
+#include "dns.hh"
+#include "dnsbackend.hh"
+#include "misc.hh"
+#include "namespaces.hh"
+
+/** This class is the generic store of zone history used to answer IXFR queries for backends that do
+    not keep a history of their own. It keeps a snapshot of each zone that was asked for with IXFR, and
+    when the serial of such a zone has moved on, the difference with the snapshot becomes a new diff.
+    Zones updated by an incoming IXFR get the diffs that were applied to them recorded directly.
+
+    The journal lives in memory only, so it starts out empty after a restart, and keeps at most 'ixfr-journal-size'
+    diffs per zone. The snapshot only holds one compact key per record, see recordKey(). */
+class IXFRJournal : public boost::noncopyable
+{
+public:
+  IXFRJournal();
+  ~IXFRJournal();
+
+  //! brings the journal for this zone up to date with the backend, listing the zone only if its serial changed
+  void update(const SOAData& sd, DNSBackend* db);
+
+  //! fills out the chain of diffs from fromSerial to toSerial, returns false if the journal does not reach back that far
+  bool getDiffs(const string& zone, uint32_t fromSerial, uint32_t toSerial, vector<IXFRDiff>& diffs);
+
+  //! records a diff that was applied to the zone, used by the incoming IXFR path
+  void addDiff(const string& zone, const IXFRDiff& diff);
+
+  //! sets the number of diffs kept per zone, 0 disables the journal
+  void setMaxDiffs(unsigned int maxDiffs)
+  {
+    d_maxDiffs = maxDiffs;
+  }
+
+  bool enabled() const
+  {
+    return d_maxDiffs > 0;
+  }
+
+private:
+  typedef set<string> snapshot_t;
+
+  struct ZoneJournal
+  {
+    ZoneJournal() : d_serial(0), d_valid(false)
+    {}
+    uint32_t d_serial;
+    bool d_valid;
+    DNSResourceRecord d_soa;
+    snapshot_t d_snapshot;
+    deque<IXFRDiff> d_diffs;
+  };
+
+  static string recordKey(const DNSResourceRecord& rr);
+  static DNSResourceRecord keyToRecord(const string& key, int domain_id);
+  void pushDiff(ZoneJournal& zj, const IXFRDiff& diff);
+
+  typedef map<string, ZoneJournal, CIStringCompare> zones_t;
+  zones_t d_zones;
+  pthread_mutex_t d_lock;
+  unsigned int d_maxDiffs;
+};
+
+extern IXFRJournal IXJ;
+
+#endif
@@ -0,0 +1,164 @@
+/*
+    PowerDNS Versatile Database Driven Nameserver
+    Copyright (C) 2012  PowerDNS.COM BV
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation
+
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "knownnames.hh"
+#include "lock.hh"
+#include "logger.hh"
+#include <algorithm>
+#include <boost/foreach.hpp>
+
+KnownNames g_knownnames;
+
+KnownNames::KnownNames() : d_maxNames(0), d_enabled(false)
+{
+  pthread_rwlock_init(&d_lock, 0);
+  pthread_mutex_init(&d_loadlock, 0);
+}
+
+KnownNames::~KnownNames()
+{
+  pthread_mutex_destroy(&d_loadlock);
+  pthread_rwlock_destroy(&d_lock);
+}
+
+void KnownNames::setZones(const vector<string>& zones)
+{
+  WriteLock l(&d_lock);
+  d_zones.clear();
+  d_ids.clear();
+  BOOST_FOREACH(const string& zone, zones) {
+    ZoneNames& zn = d_zones[zone];
+    zn.d_zone = zone;
+  }
+  d_enabled = !d_zones.empty();
+}
+
+void KnownNames::noteSOA(const string& zone, const SOAData& sd)
+{
+  WriteLock l(&d_lock);
+  map<string, ZoneNames, CIStringCompare>::iterator iter = d_zones.find(zone);
+  if(iter == d_zones.end())
+    return;
+
+  ZoneNames& zn = iter->second;
+  if(zn.d_domain_id != sd.domain_id) {
+    d_ids.erase(zn.d_domain_id);
+    zn.d_domain_id = sd.domain_id;
+    d_ids[sd.domain_id] = zn.d_zone;
+  }
+  zn.d_serial = sd.serial;
+}
+
+void KnownNames::clear()
+{
+  WriteLock l(&d_lock);
+  for(map<string, ZoneNames, CIStringCompare>::iterator iter = d_zones.begin(); iter != d_zones.end(); ++iter)
+    iter->second.d_loaded = false;
+}
+
+bool KnownNames::load(DNSBackend& B, const string& zone, ZoneNames& zn)
+{
+  SOAData sd;
+  sd.db = (DNSBackend *)-1; // force uncached answer, and get the backend that has the zone
+  if(!B.getSOA(zone, sd) || !sd.db || sd.db == (DNSBackend *)-1)
+    return false;
+
+  zn.d_loadedSerial = sd.serial;
+  zn.d_usable = false;
+  shared_ptr<vector<string> > names(new vector<string>);
+  if(sd.db->list(zone, sd.domain_id)) {
+    DNSResourceRecord rr;
+    bool tooMany = false;
+    while(sd.db->get(rr)) {
+      if(names->size() >= d_maxNames)
+        tooMany = true; // keep reading, the backend has to get to the end of the list
+      else if(names->empty() || !pdns_iequals(names->back(), rr.qname))
+        names->push_back(toLower(rr.qname));
+    }
+    if(tooMany)
+      L<<Logger::Warning<<"Zone '"<<zone<<"' has more than known-names-max-names names, not filtering lookups for it"<<endl;
+    else {
+      sort(names->begin(), names->end());
+      names->erase(unique(names->begin(), names->end()), names->end());
+      zn.d_names = names;
+      zn.d_usable = true;
+      L<<Logger::Info<<"Loaded "<<names->size()<<" names of zone '"<<zone<<"' with serial "<<sd.serial<<" to filter lookups"<<endl;
+    }
+  }
+  else
+    L<<Logger::Warning<<"Backend can't list zone '"<<zone<<"', not filtering lookups for it"<<endl;
+
+  zn.d_serial = sd.serial;
+  zn.d_loaded = true;
+  return true;
+}
+
+int KnownNames::exists(DNSBackend& B, int zoneId, const string& qname)
+{
+  if(zoneId < 0)
+    return -1;
+
+  string zone;
+  shared_ptr<vector<string> > names;
+  {
+    ReadLock l(&d_lock);
+    map<int, string>::const_iterator id = d_ids.find(zoneId);
+    if(id == d_ids.end())
+      return -1;
+    zone = id->second;
+    const ZoneNames& zn = d_zones.find(zone)->second;
+    if(zn.d_loaded && zn.d_loadedSerial == zn.d_serial) {
+      if(!zn.d_usable)
+        return -1;
+      names = zn.d_names;
+    }
+  }
+
+  if(!names) {
+    // one thread loads, the others go to the backends until it is done
+    if(pthread_mutex_trylock(&d_loadlock))
+      return -1;
+    ZoneNames zn;
+    bool loaded;
+    try {
+      loaded = load(B, zone, zn);
+    }
+    catch(...) {
+      pthread_mutex_unlock(&d_loadlock);
+      throw;
+    }
+    pthread_mutex_unlock(&d_loadlock);
+    if(!loaded)
+      return -1;
+
+    WriteLock l(&d_lock);
+    ZoneNames& stored = d_zones[zone];
+    stored.d_loadedSerial = zn.d_loadedSerial;
+    stored.d_serial = zn.d_serial;
+    stored.d_loaded = true;
+    stored.d_usable = zn.d_usable;
+    stored.d_names = zn.d_names;
+    if(!stored.d_usable)
+      return -1;
+    names = stored.d_names;
+  }
+
+  if(!endsOn(qname, zone))
+    return -1;
+  return binary_search(names->begin(), names->end(), toLower(qname));
+}
@@ -0,0 +1,92 @@
+/*
+    PowerDNS Versatile Database Driven Nameserver
+    Copyright (C) 2012  PowerDNS.COM BV
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation
+
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#ifndef PDNS_KNOWNNAMES_HH
+#define PDNS_KNOWNNAMES_HH
+
+#include <string>
+#include <map>
+#include <vector>
+#include <pthread.h>
+#include <boost/utility.hpp>
+#include "dnsbackend.hh"
+#include "misc.hh"
+#include "namespaces.hh"
+
+/** Keeps the names of the zones listed in 'known-names-zones' in memory, so the UeberBackend can tell a lookup for a
+    name that is not in such a zone is negative without asking the backends. This keeps random subdomain floods
+    against a zone away from the database, which would otherwise see a different name, and a query cache miss, for
+    each query. Denial of existence, including NSEC and NSEC3, is still worked out by the normal lookups.
+
+    The UeberBackend reports the SOA of these zones to noteSOA() whenever it has one. The names are loaded with
+    DNSBackend::list() on the first lookup after the serial changed, and until then the zone is not filtered. */
+class KnownNames : public boost::noncopyable
+{
+public:
+  KnownNames();
+  ~KnownNames();
+
+  void setZones(const vector<string>& zones);
+
+  void setMaxNames(unsigned int maxNames)
+  {
+    d_maxNames = maxNames;
+  }
+
+  //! cheap check so the UeberBackend only does work when filtering is configured
+  bool enabled() const
+  {
+    return d_enabled;
+  }
+
+  //! remembers the domain_id and serial of a zone we filter, a new serial makes us reload its names
+  void noteSOA(const string& zone, const SOAData& sd);
+
+  //! reloads the names of all zones on their next lookup, for changes made without raising the serial
+  void clear();
+
+  //! 0 if qname is not in zone zoneId, 1 if it is, -1 if we don't know. B is used to list the zone if needed
+  int exists(DNSBackend& B, int zoneId, const string& qname);
+
+private:
+  struct ZoneNames
+  {
+    ZoneNames() : d_domain_id(-1), d_serial(0), d_loadedSerial(0), d_loaded(false), d_usable(false)
+    {}
+    string d_zone;
+    int d_domain_id;
+    uint32_t d_serial;        //!< latest serial seen by noteSOA
+    uint32_t d_loadedSerial;  //!< serial of the zone d_names was loaded from
+    bool d_loaded;
+    bool d_usable;            //!< false if the zone could not be listed or is too large
+    shared_ptr<vector<string> > d_names; //!< lowercase and sorted
+  };
+
+  bool load(DNSBackend& B, const string& zone, ZoneNames& zn);
+
+  map<string, ZoneNames, CIStringCompare> d_zones;
+  map<int, string> d_ids; //!< domain_id -> zone
+  pthread_rwlock_t d_lock;
+  pthread_mutex_t d_loadlock;
+  unsigned int d_maxNames;
+  bool d_enabled;
+};
+
+extern KnownNames g_knownnames;
+
+#endif
@@ -38,6 +38,7 @@
 #include "dnsparser.hh"
 #include "logger.hh"
 #include "dns_random.hh"
+#include "ednssubnet.hh"
 #include <boost/scoped_array.hpp>
 #include <boost/algorithm/string.hpp>
 
@@ -56,8 +57,9 @@ string dns0x20(const std::string& in)
 //! returns -2 for OS limits error, -1 for permanent error that has to do with remote **transport**, 0 for timeout, 1 for success
 /** lwr is only filled out in case 1 was returned, and even when returning 1 for 'success', lwr might contain DNS errors
     Never throws! 
+    If srcmask is set, the query carries it as EDNS Client Subnet, and lwr tells if the answer is only good for part of it
  */
-int asyncresolve(const ComboAddress& ip, const string& domain, int type, bool doTCP, bool sendRDQuery, int EDNS0Level, struct timeval* now, LWResult *lwr)
+int asyncresolve(const ComboAddress& ip, const string& domain, int type, bool doTCP, bool sendRDQuery, int EDNS0Level, struct timeval* now, LWResult *lwr, const Netmask* srcmask)
 {
   int len; 
   int bufsize=1500;
@@ -74,11 +76,18 @@ int asyncresolve(const ComboAddress& ip, const string& domain, int type, bool do
   uint32_t nonce=dns_random(0xffffffff);
   ping.assign((char*) &nonce, 4);
 
-  if(EDNS0Level && !doTCP) {
+  bool sendPing = EDNS0Level > 1 && !doTCP;
+  if(EDNS0Level && (!doTCP || srcmask)) { // over TCP, EDNS only goes out to carry the subnet
     DNSPacketWriter::optvect_t opts;
-    if(EDNS0Level > 1) {
+    if(sendPing) {
       opts.push_back(make_pair(5, ping));
     }
+    if(srcmask) {
+      EDNSSubnetOpts eso;
+      eso.source = *srcmask;
+      eso.scope = Netmask(srcmask->getNetwork(), 0);
+      opts.push_back(make_pair(SyncRes::s_ednsSubnetOption, makeEDNSSubnetOptsString(eso)));
+    }
 
     pw.addOpt(1200, 0, 0, opts); // 1200 bytes answer size
     pw.commit();
@@ -86,6 +95,7 @@ int asyncresolve(const ComboAddress& ip, const string& domain, int type, bool do
   lwr->d_rcode = 0;
   lwr->d_pingCorrect = false;
   lwr->d_haveEDNS = false;
+  lwr->d_haveEDNSScope = false;
 
   int ret;
 
@@ -97,56 +107,40 @@ int asyncresolve(const ComboAddress& ip, const string& domain, int type, bool do
     if(ip.sin4.sin_family==AF_INET6)
       g_stats.ipv6queries++;
 
+    // an answer for the subnet we sent is no good for other queries, so these are not shared with them
     if((ret=asendto((const char*)&*vpacket.begin(), (int)vpacket.size(), 0, ip, pw.getHeader()->id, 
-        	    domain, type, &queryfd)) < 0) {
+        	    domain, type, &queryfd, !srcmask)) < 0) {
       return ret; // passes back the -2 EMFILE
     }
   
     // sleep until we see an answer to this, interface to mtasker
     
     ret=arecvfrom(reinterpret_cast<char *>(buf.get()), bufsize-1,0, ip, &len, pw.getHeader()->id, 
-        	  domain, type, queryfd, now);
+        	  domain, type, queryfd, now, !srcmask);
   }
   else {
     try {
-      Socket s((AddressFamily)ip.sin4.sin_family, Stream);
-
-      s.setNonBlocking();
-      ComboAddress local = getQueryLocalAddress(ip.sin4.sin_family, 0);
-
-      s.bind(local);
-        
       ComboAddress remote = ip;
       remote.sin4.sin_port = htons(53);      
-      s.connect(remote);
       
       uint16_t tlen=htons(vpacket.size());
       char *lenP=(char*)&tlen;
       const char *msgP=(const char*)&*vpacket.begin();
       string packet=string(lenP, lenP+2)+string(msgP, msgP+vpacket.size());
       
-      ret=asendtcp(packet, &s);
-      if(!(ret>0))           
-        return ret;
-      
-      packet.clear();
-      ret=arecvtcp(packet, 2, &s);
+      string answer;
+      ret=asendrecvtcp(remote, packet, pw.getHeader()->id, answer);
       if(!(ret > 0))
         return ret;
       
-      memcpy(&tlen, packet.c_str(), 2);
-      len=ntohs(tlen); // switch to the 'len' shared with the rest of the function
-      
-      ret=arecvtcp(packet, len, &s);
-      if(!(ret > 0))
-        return ret;
+      len=answer.size(); // switch to the 'len' shared with the rest of the function
       
       if(len > bufsize) {
         bufsize=len;
         scoped_array<unsigned char> narray(new unsigned char[bufsize]);
         buf.swap(narray);
       }
-      memcpy(buf.get(), packet.c_str(), len);
+      memcpy(buf.get(), answer.c_str(), len);
 
       ret=1;
     }
@@ -194,16 +188,25 @@ int asyncresolve(const ComboAddress& ip, const string& domain, int type, bool do
     }
 
     EDNSOpts edo;
-    if(EDNS0Level > 1 && getEDNSOpts(mdp, &edo)) {
-      lwr->d_haveEDNS = true;
+    if((sendPing || (EDNS0Level && srcmask)) && getEDNSOpts(mdp, &edo)) {
+      if(sendPing)
+        lwr->d_haveEDNS = true;
       for(vector<pair<uint16_t, string> >::const_iterator iter = edo.d_options.begin();
           iter != edo.d_options.end(); 
           ++iter) {
-        if(iter->first == 5 || iter->first == 4) {// 'EDNS PING'
+        if(sendPing && (iter->first == 5 || iter->first == 4)) {// 'EDNS PING'
           if(iter->second == ping)  {
             lwr->d_pingCorrect = true;
           }
         }
+        else if(srcmask && iter->first == SyncRes::s_ednsSubnetOption) { // 'EDNS SUBNET', only believed if it is about what we sent
+          EDNSSubnetOpts reso;
+          if(getEDNSSubnetOptsFromString(iter->second, &reso) && reso.source.getBits() == srcmask->getBits() &&
+             reso.source.getNetwork().sin4.sin_family == srcmask->getNetwork().sin4.sin_family && reso.scope.getBits()) {
+            lwr->d_haveEDNSScope = true; // a scope longer than what we sent can only be cached for what we sent
+            lwr->d_ednsScope = Netmask(srcmask->getNetwork(), min(reso.scope.getBits(), srcmask->getBits()));
+          }
+        }
       }
     }
         
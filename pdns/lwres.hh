@@ -41,9 +41,9 @@
 #include "namespaces.hh"
 
 int asendto(const char *data, int len, int flags, const ComboAddress& ip, uint16_t id, 
-            const string& domain, uint16_t qtype,  int* fd);
+            const string& domain, uint16_t qtype,  int* fd, bool mayChain=true);
 int arecvfrom(char *data, int len, int flags, const ComboAddress& ip, int *d_len, uint16_t id, 
-              const string& domain, uint16_t, int fd, struct timeval* now);
+              const string& domain, uint16_t, int fd, struct timeval* now, bool mayChain=true);
 
 class LWResException : public AhuException
 {
@@ -55,6 +55,7 @@ public:
 class LWResult
 {
 public:
+  LWResult() : d_haveEDNSScope(false) {}
   typedef vector<DNSResourceRecord> res_t;
 
   vector<DNSResourceRecord> d_result;
@@ -63,8 +64,10 @@ public:
   uint32_t d_usec;
   bool d_pingCorrect;
   bool d_haveEDNS;
+  bool d_haveEDNSScope;   //!< the answer came with an EDNS Client Subnet scope that is not 0
+  Netmask d_ednsScope;    //!< and is only valid for clients in this subnet
 };
 
-int asyncresolve(const ComboAddress& ip, const string& domain, int type, bool doTCP, bool sendRDQuery, int EDNS0Level, struct timeval* now, LWResult* res);
+int asyncresolve(const ComboAddress& ip, const string& domain, int type, bool doTCP, bool sendRDQuery, int EDNS0Level, struct timeval* now, LWResult* res, const Netmask* srcmask=0);
 
 #endif // PDNS_LWRES_HH
@@ -219,6 +219,11 @@ inline int DTime::udiffNoReset()
 }
 
 
+template<typename T> bool rfc1982LessThan(T a, T b)
+{
+  return ((signed)(a - b)) < 0;
+}
+
 inline bool dns_isspace(char c)
 {
   return c==' ' || c=='\t' || c=='\r' || c=='\n';
@@ -353,6 +358,11 @@ public:
       return atomic_exchange_and_add( &value_, -1 ) - 1;
     }
 
+    unsigned int operator+=(int dv)
+    {
+      return atomic_exchange_and_add( &value_, dv ) + dv;
+    }
+
     operator unsigned int() const
     {
       return atomic_exchange_and_add( &value_, 0);
@@ -402,6 +412,46 @@ struct CIStringCompare: public std::binary_function<string, string, bool>
   }
 };
 
+/** Orders names label by label starting from the right, case insensitively, so a name is immediately followed by all names below it:
+    'powerdns.com.' < 'www.powerdns.com.' < 'zz.www.powerdns.com.' < 'powerdnsiscool.com.'. A trailing dot is ignored. */
+struct CICanonicalCompare: public std::binary_function<string, string, bool>
+{
+  bool operator()(const string& a, const string& b) const
+  {
+    const char *abegin=a.c_str(), *aend=abegin+a.size();
+    const char *bbegin=b.c_str(), *bend=bbegin+b.size();
+    if(aend != abegin && aend[-1]=='.')
+      --aend;
+    if(bend != bbegin && bend[-1]=='.')
+      --bend;
+
+    for(;;) {
+      if(aend == abegin)
+        return bend != bbegin;
+      if(bend == bbegin)
+        return false;
+
+      const char *alabel=aend, *blabel=bend;
+      while(alabel != abegin && alabel[-1] != '.')
+        --alabel;
+      while(blabel != bbegin && blabel[-1] != '.')
+        --blabel;
+
+      const char *ai=alabel, *bi=blabel;
+      for(; ai != aend && bi != bend; ++ai, ++bi) {
+        unsigned char ac=dns_tolower(*ai), bc=dns_tolower(*bi);
+        if(ac != bc)
+          return ac < bc;
+      }
+      if(ai != aend || bi != bend) // one label is a prefix of the other, the shorter one comes first
+        return bi != bend;
+
+      aend = alabel == abegin ? abegin : alabel-1;
+      bend = blabel == bbegin ? bbegin : blabel-1;
+    }
+  }
+};
+
 pair<string, string> splitField(const string& inp, char sepa);
 
 inline bool isCanonical(const string& dom)
@@ -0,0 +1,205 @@
+/*
+    PowerDNS Versatile Database Driven Nameserver
+    Copyright (C) 2011  PowerDNS.COM BV
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation
+
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "nsec3cache.hh"
+#include "dnssecinfra.hh"
+#include "base32.hh"
+#include "statbag.hh"
+#include "lock.hh"
+#include "logger.hh"
+#include <algorithm>
+
+NSEC3Cache g_nsec3cache;
+extern StatBag S;
+
+NSEC3Cache::NSEC3Cache() : d_maxEntries(0), d_generation(0), d_maxIndexNames(0)
+{
+  pthread_mutex_init(&d_hashlock, 0);
+  pthread_mutex_init(&d_indexlock, 0);
+  pthread_mutex_init(&d_buildlock, 0);
+}
+
+NSEC3Cache::~NSEC3Cache()
+{
+  pthread_mutex_destroy(&d_buildlock);
+  pthread_mutex_destroy(&d_indexlock);
+  pthread_mutex_destroy(&d_hashlock);
+}
+
+string NSEC3Cache::hash(unsigned int iterations, const string& salt, const string& qname)
+{
+  if(!d_maxEntries)
+    return hashQNameWithSalt(iterations, salt, qname);
+
+  string key((const char*)&iterations, sizeof(iterations));
+  key.append(1, (char)salt.length());
+  key.append(salt);
+  key.append(toLower(qname));
+
+  {
+    Lock l(&d_hashlock);
+    hashes_t::iterator iter = d_hashes.find(key);
+    if(iter != d_hashes.end()) {
+      d_hashes.get<1>().relocate(d_hashes.get<1>().end(), d_hashes.project<1>(iter)); // most recently used goes to the back
+      S.inc("nsec3-hash-cache-hit");
+      return iter->d_hash;
+    }
+  }
+
+  HashEntry he;
+  he.d_key = key;
+  he.d_hash = hashQNameWithSalt(iterations, salt, qname);
+  S.inc("nsec3-hash-cache-miss");
+
+  Lock l(&d_hashlock);
+  if(d_hashes.insert(he).second) {
+    while(d_hashes.size() > d_maxEntries)
+      d_hashes.get<1>().pop_front();
+  }
+  return he.d_hash;
+}
+
+shared_ptr<NSEC3Cache::ZoneIndex> NSEC3Cache::buildIndex(const SOAData& sd)
+{
+  shared_ptr<ZoneIndex> zi(new ZoneIndex);
+  zi->d_serial = sd.serial;
+
+  vector<pair<string, string> > ordernames;
+  if(!sd.db->getOrderNames(sd.domain_id, ordernames))
+    return zi;
+
+  if(ordernames.size() > d_maxIndexNames) {
+    L<<Logger::Info<<"Not indexing NSEC3 hashes of '"<<sd.qname<<"', "<<ordernames.size()<<" ordernames is more than nsec3-index-max-names"<<endl;
+    return zi;
+  }
+
+  zi->d_names.reserve(ordernames.size());
+  for(vector<pair<string, string> >::const_iterator i = ordernames.begin(); i != ordernames.end(); ++i)
+    if(!i->first.empty())
+      zi->d_names.push_back(make_pair(fromBase32Hex(i->first), i->second));
+
+  // a name has an ordername on each of its records, keep one
+  sort(zi->d_names.begin(), zi->d_names.end());
+  index_t::iterator last = zi->d_names.begin();
+  for(index_t::iterator i = zi->d_names.begin(); i != zi->d_names.end(); ++i)
+    if(last == zi->d_names.begin() || (last-1)->first != i->first)
+      *last++ = *i;
+  zi->d_names.erase(last, zi->d_names.end());
+
+  zi->d_usable = !zi->d_names.empty();
+  return zi;
+}
+
+shared_ptr<NSEC3Cache::ZoneIndex> NSEC3Cache::getIndex(const SOAData& sd)
+{
+  if(!d_maxIndexNames)
+    return shared_ptr<ZoneIndex>();
+
+  {
+    Lock l(&d_indexlock);
+    map<string, shared_ptr<ZoneIndex>, CIStringCompare>::const_iterator iter = d_indexes.find(sd.qname);
+    if(iter != d_indexes.end() && iter->second->d_serial == sd.serial)
+      return iter->second;
+  }
+
+  // only one thread lists zones at a time, the others either find its result or wait for their turn
+  Lock b(&d_buildlock);
+  unsigned int generation;
+  {
+    Lock l(&d_indexlock);
+    map<string, shared_ptr<ZoneIndex>, CIStringCompare>::const_iterator iter = d_indexes.find(sd.qname);
+    if(iter != d_indexes.end() && iter->second->d_serial == sd.serial)
+      return iter->second;
+    generation = d_generation;
+  }
+
+  shared_ptr<ZoneIndex> zi = buildIndex(sd);
+  DLOG(L<<"Built NSEC3 index for '"<<sd.qname<<"' with serial "<<sd.serial<<", "<<zi->d_names.size()<<" names"<<endl);
+
+  Lock l(&d_indexlock);
+  if(generation == d_generation) // if not, the zone may have changed while we listed it, the next question builds again
+    d_indexes[sd.qname] = zi;
+  return zi;
+}
+
+namespace {
+struct HashCompare
+{
+  bool operator()(const pair<string, string>& a, const string& b) const
+  {
+    return a.first < b;
+  }
+  bool operator()(const string& a, const pair<string, string>& b) const
+  {
+    return a < b.first;
+  }
+};
+}
+
+bool NSEC3Cache::getBeforeAndAfter(const SOAData& sd, const string& hashed, string& unhashed, string& before, string& after)
+{
+  shared_ptr<ZoneIndex> zi = getIndex(sd);
+  if(!zi || !zi->d_usable)
+    return false;
+
+  const index_t& names = zi->d_names;
+  // after is the first hash beyond ours, before the one at or below it, both wrapping around the zone
+  index_t::const_iterator iter = upper_bound(names.begin(), names.end(), hashed, HashCompare());
+
+  after = (iter == names.end() ? names.begin() : iter)->first;
+
+  if(iter == names.begin())
+    iter = names.end();
+  --iter;
+  before = iter->first;
+  unhashed = iter->second;
+
+  return true;
+}
+
+int NSEC3Cache::exists(const SOAData& sd, const string& hashed)
+{
+  shared_ptr<ZoneIndex> zi = getIndex(sd);
+  if(!zi || !zi->d_usable)
+    return -1;
+
+  return binary_search(zi->d_names.begin(), zi->d_names.end(), hashed, HashCompare());
+}
+
+void NSEC3Cache::clearIndexes()
+{
+  Lock l(&d_indexlock);
+  d_indexes.clear();
+  d_generation++;
+}
+
+void NSEC3Cache::clearIndexes(const string& name)
+{
+  string match(name);
+  if(!match.empty() && match[match.size()-1] == '$')
+    match.resize(match.size()-1);
+
+  Lock l(&d_indexlock);
+  for(map<string, shared_ptr<ZoneIndex>, CIStringCompare>::iterator iter = d_indexes.begin(); iter != d_indexes.end(); ) {
+    if(endsOn(match, iter->first) || endsOn(iter->first, match))
+      d_indexes.erase(iter++);
+    else
+      ++iter;
+  }
+  d_generation++;
+}
@@ -0,0 +1,117 @@
+/*
+    PowerDNS Versatile Database Driven Nameserver
+    Copyright (C) 2011  PowerDNS.COM BV
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation
+
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#ifndef PDNS_NSEC3CACHE_HH
+#define PDNS_NSEC3CACHE_HH
+
+#include <string>
+#include <map>
+#include <vector>
+#include <pthread.h>
+#include <boost/utility.hpp>
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/sequenced_index.hpp>
+#include <boost/multi_index/key_extractors.hpp>
+#include "dnsbackend.hh"
+#include "misc.hh"
+#include "namespaces.hh"
+
+using namespace boost::multi_index;
+
+/** This class speeds up NSEC3 denial for zones that are not nsec3-narrow. It remembers the most recently
+    calculated NSEC3 hashes, and keeps a sorted index of the hashed ordernames of each zone so the matching and
+    covering NSEC3 records can be found with a binary search instead of a database query.
+
+    An index is built from DNSBackend::getOrderNames() the first time a zone needs one, and rebuilt when the SOA
+    serial of the zone changes, or after clearIndexes() for changes made without a new serial. Zones the backend can't list, and zones larger than 'nsec3-index-max-names',
+    keep using getBeforeAndAfterNamesAbsolute(). */
+class NSEC3Cache : public boost::noncopyable
+{
+public:
+  NSEC3Cache();
+  ~NSEC3Cache();
+
+  //! returns hashQNameWithSalt(iterations, salt, qname), from the cache if possible
+  string hash(unsigned int iterations, const string& salt, const string& qname);
+
+  //! same as DNSBackend::getBeforeAndAfterNamesAbsolute, but with raw hashes. Returns false if there is no index for this zone
+  bool getBeforeAndAfter(const SOAData& sd, const string& hashed, string& unhashed, string& before, string& after);
+
+  //! 1 if a name with this raw hash exists in the zone, 0 if not, -1 if there is no index for this zone
+  int exists(const SOAData& sd, const string& hashed);
+
+  //! drops all zone indexes, they get rebuilt on next use
+  void clearIndexes();
+  //! drops the indexes of the zones name is in or above, so a rectify or edit without a new serial shows up. A trailing $ is ignored
+  void clearIndexes(const string& name);
+
+  void setMaxEntries(unsigned int maxEntries)
+  {
+    d_maxEntries = maxEntries;
+  }
+
+  void setMaxIndexNames(unsigned int maxNames)
+  {
+    d_maxIndexNames = maxNames;
+  }
+
+private:
+  struct HashEntry
+  {
+    string d_key;
+    string d_hash;
+  };
+
+  typedef multi_index_container<
+    HashEntry,
+    indexed_by <
+      ordered_unique<member<HashEntry,string,&HashEntry::d_key> >,
+      sequenced<>
+    >
+  > hashes_t;
+
+  //! raw hash, unhashed name, sorted by raw hash
+  typedef vector<pair<string, string> > index_t;
+
+  struct ZoneIndex
+  {
+    ZoneIndex() : d_serial(0), d_usable(false)
+    {}
+    uint32_t d_serial;
+    bool d_usable;
+    index_t d_names;
+  };
+
+  shared_ptr<ZoneIndex> getIndex(const SOAData& sd);
+  shared_ptr<ZoneIndex> buildIndex(const SOAData& sd);
+
+  hashes_t d_hashes;
+  pthread_mutex_t d_hashlock;
+  unsigned int d_maxEntries;
+
+  map<string, shared_ptr<ZoneIndex>, CIStringCompare> d_indexes;
+  pthread_mutex_t d_indexlock;
+  unsigned int d_generation; //!< bumped by clearIndexes() under d_indexlock, so a build that was already going on is not stored
+  pthread_mutex_t d_buildlock;
+  unsigned int d_maxIndexNames;
+};
+
+extern NSEC3Cache g_nsec3cache;
+
+#endif
@@ -22,6 +22,9 @@
 #include "statbag.hh"
 #include <map>
 #include <boost/algorithm/string.hpp>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 
 extern StatBag S;
 
@@ -320,6 +323,140 @@ int PacketCache::size()
   return d_map.size();
 }
 
+/* The snapshot format is meant for warm starts on the same machine, so everything is in host byte order:
+
+   magic "PDNSPC01"
+   per entry: uint8 ctype, uint8 flags (1=meritsRecursion, 2=dnssecOk), uint16 qtype, int32 zoneID, uint32 maxReplyLen,
+              uint32 ttd (absolute), uint16 qname length, qname, uint32 value length, value
+
+   Entries keep their absolute time of death, so whatever time passed between dump and restore is subtracted automatically. */
+
+static const char s_snapshotMagic[]="PDNSPC01";
+
+struct SnapshotHeader
+{
+  uint8_t ctype;
+  uint8_t flags;
+  uint16_t qtype;
+  int32_t zoneID;
+  uint32_t maxReplyLen;
+  uint32_t ttd;
+} GCCPACKATTRIBUTE;
+
+int PacketCache::dump(const string& fname)
+{
+  string tmpname=fname+".tmp";
+  FILE* fp=fopen(tmpname.c_str(), "w");
+  if(!fp)
+    throw AhuException("Unable to open cache snapshot '"+tmpname+"' for writing: "+stringerror());
+
+  // copy the live entries and write them out after the lock is gone, so inserts and the cleanup don't wait on the disk
+  vector<CacheEntry> entries;
+  time_t now=time(0);
+  {
+    ReadLock l(&d_mut);
+    entries.reserve(d_map.size());
+    for(cmap_t::const_iterator iter = d_map.begin() ; iter != d_map.end(); ++iter)
+      if(iter->ttd > now)
+        entries.push_back(*iter);
+  }
+
+  int count=0;
+  SnapshotHeader sh;
+  bool ok=fwrite(s_snapshotMagic, 1, 8, fp)==8;
+  for(vector<CacheEntry>::const_iterator iter = entries.begin() ; ok && iter != entries.end(); ++iter) {
+    sh.ctype=iter->ctype;
+    sh.flags=(iter->meritsRecursion ? 1 : 0) | (iter->dnssecOk ? 2 : 0);
+    sh.qtype=iter->qtype;
+    sh.zoneID=iter->zoneID;
+    sh.maxReplyLen=iter->maxReplyLen;
+    sh.ttd=iter->ttd;
+    uint16_t qlen=iter->qname.length();
+    uint32_t vlen=iter->value.length();
+    ok = fwrite(&sh, sizeof(sh), 1, fp)==1 && 
+      fwrite(&qlen, sizeof(qlen), 1, fp)==1 && fwrite(iter->qname.c_str(), 1, qlen, fp)==qlen &&
+      fwrite(&vlen, sizeof(vlen), 1, fp)==1 && fwrite(iter->value.c_str(), 1, vlen, fp)==vlen;
+    count++;
+  }
+  if(fclose(fp) || !ok) {
+    unlink(tmpname.c_str());
+    throw AhuException("Error writing cache snapshot '"+tmpname+"': "+stringerror());
+  }
+  if(rename(tmpname.c_str(), fname.c_str()) < 0) 
+    throw AhuException("Unable to move cache snapshot into place as '"+fname+"': "+stringerror());
+  return count;
+}
+
+int PacketCache::restore(const string& fname)
+{
+  int fd=open(fname.c_str(), O_RDONLY);
+  if(fd < 0)
+    throw AhuException("Unable to open cache snapshot '"+fname+"': "+stringerror());
+  
+  struct stat st;
+  if(fstat(fd, &st) < 0 || st.st_size < 8) {
+    close(fd);
+    throw AhuException("Cache snapshot '"+fname+"' is truncated");
+  }
+  
+  const char* base=(const char*)mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(base==MAP_FAILED)
+    throw AhuException("Unable to map cache snapshot '"+fname+"': "+stringerror());
+
+  if(memcmp(base, s_snapshotMagic, 8)) {
+    munmap((void*)base, st.st_size);
+    throw AhuException("File '"+fname+"' is not a cache snapshot");
+  }
+
+  const char* ptr=base+8;
+  const char* end=base+st.st_size;
+  time_t now=time(0);
+  int count=0;
+  SnapshotHeader sh;
+  uint16_t qlen;
+  uint32_t vlen;
+  CacheEntry val;
+
+  WriteLock l(&d_mut);
+  while(ptr + sizeof(sh) + sizeof(qlen) <= end) {
+    memcpy(&sh, ptr, sizeof(sh));
+    ptr+=sizeof(sh);
+    memcpy(&qlen, ptr, sizeof(qlen));
+    ptr+=sizeof(qlen);
+    if(ptr + qlen + sizeof(vlen) > end)
+      break;
+    val.qname.assign(ptr, qlen);
+    ptr+=qlen;
+    memcpy(&vlen, ptr, sizeof(vlen));
+    ptr+=sizeof(vlen);
+    if(vlen > (uint32_t)(end-ptr))
+      break;
+    if(sh.ttd <= now) {
+      ptr+=vlen;
+      continue;
+    }
+    val.value.assign(ptr, vlen);
+    ptr+=vlen;
+
+    val.ctype=sh.ctype;
+    val.meritsRecursion=sh.flags & 1;
+    val.dnssecOk=sh.flags & 2;
+    val.qtype=sh.qtype;
+    val.zoneID=sh.zoneID;
+    val.maxReplyLen=sh.maxReplyLen;
+    val.ttd=sh.ttd;
+    if(d_map.insert(val).second)
+      count++;
+  }
+  bool truncated = ptr!=end;
+  munmap((void*)base, st.st_size);
+  *d_statnumentries=d_map.size();
+  if(truncated)
+    L<<Logger::Warning<<"Cache snapshot '"<<fname<<"' was truncated, loaded what we could"<<endl;
+  return count;
+}
+
 /** readlock for figuring out which iterators to delete, upgrade to writelock when actually cleaning */
 void PacketCache::cleanup()
 {
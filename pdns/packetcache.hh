@@ -84,6 +84,9 @@ public:
   int purge(const string &match);
 
   map<char,int> getCounts();
+
+  int dump(const string& fname); //!< write all live entries to fname in our binary snapshot format, returns number of entries written
+  int restore(const string& fname); //!< load a snapshot written by dump(), skipping what has expired since
 private:
   bool getEntryLocked(const string &content, const QType& qtype, CacheEntryType cet, string& entry, int zoneID=-1, 
     bool meritsRecursion=false, unsigned int maxReplyLen=512, bool dnssecOk=false);
@@ -37,6 +37,8 @@
 #include "resolver.hh"
 #include "communicator.hh"
 #include "dnsproxy.hh"
+#include "nsec3cache.hh"
+#include "zoneapexes.hh"
 
 #if 0
 #undef DLOG
@@ -280,6 +282,12 @@ int PacketHandler::doVersionRequest(DNSPacket *p, DNSPacket *r, string &target)
 bool PacketHandler::getAuth(DNSPacket *p, SOAData *sd, const string &target, int *zoneId)
 {
   string subdomain(target);
+  if(g_zoneapexes.enabled()) {
+    // start at the zone we know encloses target, if it is gone the walk below goes on upwards. If no zone in the list
+    // encloses target, we still walk all the way: backends that can't list all their zones may have it
+    if(g_zoneapexes.getBestApex(B, target, p->qtype.getCode() == QType::DS, subdomain) != 1)
+      subdomain=target;
+  }
   do {
     if( B.getSOA( subdomain, *sd, p ) ) {
       if(p->qtype.getCode() == QType::DS && pdns_iequals(subdomain, target)) 
@@ -532,7 +540,7 @@ static void decrementHash(std::string& raw) // I wonder if this is correct, cmou
 }
 
 
-bool getNSEC3Hashes(bool narrow, DNSBackend* db, int id, const std::string& hashed, bool decrement, string& unhashed, string& before, string& after)
+bool getNSEC3Hashes(bool narrow, const SOAData& sd, const std::string& hashed, bool decrement, string& unhashed, string& before, string& after)
 {
   bool ret;
   if(narrow) { // nsec3-narrow
@@ -545,8 +553,11 @@ bool getNSEC3Hashes(bool narrow, DNSBackend* db, int id, const std::string& hash
     after=hashed;
     incrementHash(after);
   }
+  else if(g_nsec3cache.getBeforeAndAfter(sd, hashed, unhashed, before, after)) {
+    ret=true;
+  }
   else {
-    ret=db->getBeforeAndAfterNamesAbsolute(id, toLower(toBase32Hex(hashed)), unhashed, before, after);
+    ret=sd.db->getBeforeAndAfterNamesAbsolute(sd.domain_id, toLower(toBase32Hex(hashed)), unhashed, before, after);
     before=fromBase32Hex(before);
     after=fromBase32Hex(after);
   }
@@ -576,6 +587,11 @@ void PacketHandler::addNSEC3(DNSPacket *p, DNSPacket *r, const string& target, c
   if (mode == 1) {
     DNSResourceRecord rr;
     while( chopOff( closest ) && (closest != sd.qname))  { // stop at SOA
+      int known = narrow ? -1 : g_nsec3cache.exists(sd, g_nsec3cache.hash(ns3rc.d_iterations, ns3rc.d_salt, closest));
+      if(known == 1)
+        break;
+      if(known == 0)
+        continue;
       B.lookup(QType(QType::ANY), closest, p, sd.domain_id);
       if (B.get(rr)) {
         while(B.get(rr));
@@ -588,10 +604,10 @@ void PacketHandler::addNSEC3(DNSPacket *p, DNSPacket *r, const string& target, c
   if (mode != 3) {
     unhashed=(mode == 0 || mode == 5) ? target : closest;
 
-    hashed=hashQNameWithSalt(ns3rc.d_iterations, ns3rc.d_salt, unhashed);
+    hashed=g_nsec3cache.hash(ns3rc.d_iterations, ns3rc.d_salt, unhashed);
     // L<<"1 hash: "<<toBase32Hex(hashed)<<" "<<unhashed<<endl;
   
-    getNSEC3Hashes(narrow, sd.db, sd.domain_id,  hashed, false, unhashed, before, after);
+    getNSEC3Hashes(narrow, sd, hashed, false, unhashed, before, after);
     DLOG(L<<"Done calling for matching, hashed: '"<<toBase32Hex(hashed)<<"' before='"<<toBase32Hex(before)<<"', after='"<<toBase32Hex(after)<<"'"<<endl);
     emitNSEC3(ns3rc, sd, unhashed, before, after, target, r, mode);
   }
@@ -604,10 +620,10 @@ void PacketHandler::addNSEC3(DNSPacket *p, DNSPacket *r, const string& target, c
     }
     while( chopOff( next ) && !pdns_iequals(next, closest));
 
-    hashed=hashQNameWithSalt(ns3rc.d_iterations, ns3rc.d_salt, unhashed);
+    hashed=g_nsec3cache.hash(ns3rc.d_iterations, ns3rc.d_salt, unhashed);
     // L<<"2 hash: "<<toBase32Hex(hashed)<<" "<<unhashed<<endl;
 
-    getNSEC3Hashes(narrow, sd.db,sd.domain_id,  hashed, true, unhashed, before, after);
+    getNSEC3Hashes(narrow, sd, hashed, true, unhashed, before, after);
     DLOG(L<<"Done calling for covering, hashed: '"<<toBase32Hex(hashed)<<"' before='"<<toBase32Hex(before)<<"', after='"<<toBase32Hex(after)<<"'"<<endl);
     emitNSEC3( ns3rc, sd, unhashed, before, after, target, r, mode);
   }
@@ -616,10 +632,10 @@ void PacketHandler::addNSEC3(DNSPacket *p, DNSPacket *r, const string& target, c
   if (mode == 2 || mode == 4) {
     unhashed=dotConcat("*", closest);
 
-    hashed=hashQNameWithSalt(ns3rc.d_iterations, ns3rc.d_salt, unhashed);
+    hashed=g_nsec3cache.hash(ns3rc.d_iterations, ns3rc.d_salt, unhashed);
     // L<<"3 hash: "<<toBase32Hex(hashed)<<" "<<unhashed<<endl;
     
-    getNSEC3Hashes(narrow, sd.db, sd.domain_id,  hashed, (mode != 2), unhashed, before, after);
+    getNSEC3Hashes(narrow, sd, hashed, (mode != 2), unhashed, before, after);
     DLOG(L<<"Done calling for '*', hashed: '"<<toBase32Hex(hashed)<<"' before='"<<toBase32Hex(before)<<"', after='"<<toBase32Hex(after)<<"'"<<endl);
     emitNSEC3( ns3rc, sd, unhashed, before, after, target, r, mode);
   }
@@ -735,7 +751,7 @@ int PacketHandler::trySuperMasterSynchronous(DNSPacket *p)
     L<<Logger::Error<<"Database error trying to create "<<p->qdomain<<" for potential supermaster "<<p->getRemote()<<": "<<ae.reason<<endl;
     return RCode::ServFail;
   }
-  Communicator.addSuckRequest(p->qdomain, p->getRemote());  
+  Communicator.addSuckRequest(p->qdomain, p->getRemote(), SuckRequest::Notify);
   L<<Logger::Warning<<"Created new slave zone '"<<p->qdomain<<"' from supermaster "<<p->getRemote()<<", queued axfr"<<endl;
   return RCode::NoError;
 }
@@ -773,6 +789,8 @@ int PacketHandler::processNotify(DNSPacket *p)
   }
     
   // ok, we've done our checks
+  if(g_zoneapexes.enabled())
+    g_zoneapexes.add(p->qdomain);
   di.backend = 0;
   Communicator.addSlaveCheckRequest(di, p->d_remote);
   return 0;
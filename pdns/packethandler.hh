@@ -128,5 +128,5 @@ private:
   DNSSECKeeper d_dk; // same, might even share B?
 };
 void emitNSEC3(DNSBackend& B, const NSEC3PARAMRecordContent& ns3prc, const SOAData& sd, const std::string& unhashed, const std::string& begin, const std::string& end, const std::string& toNSEC3, DNSPacket *r, int mode);
-bool getNSEC3Hashes(bool narrow, DNSBackend* db, int id, const std::string& hashed, bool decrement, string& unhashed, string& before, string& after);
+bool getNSEC3Hashes(bool narrow, const SOAData& sd, const std::string& hashed, bool decrement, string& unhashed, string& before, string& after);
 #endif /* PACKETHANDLER */
@@ -65,6 +65,11 @@
 #include "mplexer.hh"
 #include "config.h"
 #include "lua-recursor.hh"
+#include "spscqueue.hh"
+#include "lock.hh"
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 
 #ifndef RECURSOR
 #include "statbag.hh"
@@ -81,6 +86,25 @@ __thread RemoteKeeper* t_remotes;
 
 RecursorControlChannel s_rcc; // only active in thread 0
 
+//! a UDP question on its way from the listening thread to the thread that handles its qname
+struct DistributedQuestion
+{
+  string question;
+  ComboAddress fromaddr;
+  int fd;
+};
+
+//! with coalesce-outgoing-queries, the answer to a query another thread asked for us. No answer means it timed out
+struct InFlightAnswer
+{
+  ComboAddress remote;
+  string domain;
+  uint16_t type;
+  uint16_t id;
+  bool haveAnswer;
+  string packet;
+};
+
 // for communicating with our threads
 struct ThreadPipeSet
 {
@@ -88,6 +112,18 @@ struct ThreadPipeSet
   int readToThread;
   int writeFromThread;
   int readFromThread;
+
+  // pdns-distributes-queries only, questions from thread 0, which wakes us once per round of its event loop
+  SPSCQueue<DistributedQuestion>* questions;
+  int readQuestionsWakeup;
+  int writeQuestionsWakeup; // the same eventfd as readQuestionsWakeup on Linux, a pipe elsewhere
+  bool wakeupWanted;        // only used by thread 0
+
+  // coalesce-outgoing-queries only, answers from each of the other threads, which wake us themselves
+  vector<SPSCQueue<InFlightAnswer>*> inFlightAnswers;
+  vector<unsigned int> inFlightPending; // answers we subscribed to per thread and did not pop yet, only used by this thread
+  int readAnswersWakeup;
+  int writeAnswersWakeup;
 };
 
 vector<ThreadPipeSet> g_pipes; // effectively readonly after startup
@@ -110,7 +146,11 @@ NetmaskGroup* g_dontQuery;
 string s_programname="pdns_recursor";
 
 typedef vector<int> tcpListenSockets_t;
-tcpListenSockets_t g_tcpListenSockets;   // shared across threads, but this is fine, never written to from a thread. All threads listen on all sockets
+vector<tcpListenSockets_t> g_tcpListenSockets;   // never written to from a thread. One set per thread with reuseport, otherwise all threads listen on set 0
+bool g_reusePort;
+bool g_coalesceQueries; // if true, threads share outstanding queries to the same server for the same question
+static const unsigned int s_inFlightQueueSize = 128; // per pair of threads, a thread waits for at most this many answers from another
+__thread uint64_t t_queries; // questions this thread answered, to see how evenly they are spread
 int g_tcpTimeout;
 unsigned int g_maxMThreads;
 struct timeval g_now; // timestamp, updated (too) frequently
@@ -181,28 +221,6 @@ int asendtcp(const string& data, Socket* sock)
   return ret;
 }
 
-void handleTCPClientReadable(int fd, FDMultiplexer::funcparam_t& var);
-
-// -1 is error, 0 is timeout, 1 is success
-int arecvtcp(string& data, int len, Socket* sock) 
-{
-  data.clear();
-  PacketID pident;
-  pident.sock=sock;
-  pident.inNeeded=len;
-  t_fdm->addReadFD(sock->getHandle(), handleTCPClientReadable, pident);
-
-  int ret=MT->waitEvent(pident,&data, g_networkTimeoutMsec);
-  if(!ret || ret==-1) { // timeout
-    t_fdm->removeReadFD(sock->getHandle());
-  }
-  else if(data.empty()) {// error, EOF or other
-    return -1;
-  }
-
-  return ret;
-}
-
 vector<ComboAddress> g_localQueryAddresses4, g_localQueryAddresses6; 
 const ComboAddress g_local4("0.0.0.0"), g_local6("::");
 
@@ -228,6 +246,227 @@ ComboAddress getQueryLocalAddress(int family, uint16_t port)
   return ret;
 }
 
+void handleTCPServerReadable(int fd, FDMultiplexer::funcparam_t& var);
+
+//! an outgoing TCP connection to an authoritative server, which can carry several queries at the same time
+struct TCPOutConnection : public boost::noncopyable
+{
+  explicit TCPOutConnection(const ComboAddress& remote) : d_sock((AddressFamily)remote.sin4.sin_family, Stream), d_remote(remote),
+                                                          d_lastUsed(0), d_connected(false), d_reading(false), d_retired(false)
+  {}
+
+  Socket d_sock;
+  ComboAddress d_remote;
+  set<uint16_t> d_waiting; // ids of the queries that are waiting for an answer on this connection
+  string d_inbuf;          // answers we did not receive completely yet
+  time_t d_lastUsed;
+  bool d_connected; // false until the first query went out, nobody else can send before that
+  bool d_reading;   // registered with t_fdm for reading
+  bool d_retired;   // takes no new queries, is closed once nobody waits on it anymore
+};
+
+//! per thread pool of outgoing TCP connections, kept open for reuse for outgoing-tcp-idle-timeout seconds
+class TCPOutConnections : public boost::noncopyable
+{
+public:
+  typedef shared_ptr<TCPOutConnection> conn_t;
+  typedef std::multimap<ComboAddress, conn_t> conns_t;
+
+  static unsigned int s_idleTimeout;
+  static unsigned int s_maxPipelined;
+
+  //! a connection to remote that can take a query with this id, 'fresh' is set if it is new and still needs the first query sent. Throws NetworkError
+  conn_t get(const ComboAddress& remote, uint16_t id, bool* fresh)
+  {
+    pair<conns_t::iterator, conns_t::iterator> range=d_conns.equal_range(remote);
+    for(conns_t::iterator i=range.first; i != range.second; ++i) {
+      const conn_t& conn=i->second;
+      if(conn->d_connected && !conn->d_retired && conn->d_waiting.size() < s_maxPipelined && !conn->d_waiting.count(id)) {
+        *fresh=false;
+        return conn;
+      }
+    }
+
+    conn_t conn(new TCPOutConnection(remote));
+    conn->d_sock.setNonBlocking();
+    conn->d_sock.bind(getQueryLocalAddress(remote.sin4.sin_family, 0));
+    conn->d_sock.connect(remote);
+    d_conns.insert(make_pair(remote, conn));
+    g_stats.tcpConnectionsOpened++;
+    *fresh=true;
+    return conn;
+  }
+
+  //! the first query went out, from now on answers are read as they come in
+  void startReading(const conn_t& conn)
+  {
+    t_fdm->addReadFD(conn->d_sock.getHandle(), handleTCPServerReadable, conn);
+    conn->d_reading=true;
+    conn->d_connected=true;
+  }
+
+  //! a query is done with conn
+  void release(const conn_t& conn)
+  {
+    conn->d_lastUsed=g_now.tv_sec;
+    if(conn->d_waiting.empty() && (conn->d_retired || !s_idleTimeout || !conn->d_connected))
+      close(conn);
+  }
+
+  //! takes conn out of the pool, the socket is closed once the last reference is gone
+  void close(const conn_t& conn)
+  {
+    conn->d_retired=true;
+    if(conn->d_reading) {
+      t_fdm->removeReadFD(conn->d_sock.getHandle());
+      conn->d_reading=false;
+    }
+    pair<conns_t::iterator, conns_t::iterator> range=d_conns.equal_range(conn->d_remote);
+    for(conns_t::iterator i=range.first; i != range.second; ++i) {
+      if(i->second == conn) {
+        d_conns.erase(i);
+        break;
+      }
+    }
+  }
+
+  //! closes the connections that have been idle for longer than s_idleTimeout
+  void expire(time_t now)
+  {
+    for(conns_t::iterator i=d_conns.begin(); i != d_conns.end(); ) {
+      const conn_t& conn=i->second;
+      if(conn->d_waiting.empty() && conn->d_lastUsed + (time_t)s_idleTimeout < now) {
+        conn->d_retired=true;
+        if(conn->d_reading) {
+          t_fdm->removeReadFD(conn->d_sock.getHandle());
+          conn->d_reading=false;
+        }
+        d_conns.erase(i++);
+      }
+      else
+        ++i;
+    }
+  }
+
+private:
+  conns_t d_conns;
+};
+
+unsigned int TCPOutConnections::s_idleTimeout;
+unsigned int TCPOutConnections::s_maxPipelined;
+
+static __thread TCPOutConnections* t_tcpOutConns;
+
+//! the stream can no longer be trusted, everybody still waiting for an answer gets an error. Only call this from outside the MThreads
+static void failTCPOutConnection(const TCPOutConnections::conn_t& conn)
+{
+  t_tcpOutConns->close(conn);
+
+  set<uint16_t> waiting;
+  waiting.swap(conn->d_waiting);
+
+  PacketID pident;
+  pident.sock=&conn->d_sock;
+  pident.remote=conn->d_remote;
+  string empty;
+  for(set<uint16_t>::const_iterator i=waiting.begin(); i != waiting.end(); ++i) {
+    pident.id=*i;
+    MT->sendEvent(pident, &empty); // this conveys error status
+  }
+}
+
+void handleTCPServerReadable(int fd, FDMultiplexer::funcparam_t& var)
+{
+  TCPOutConnections::conn_t conn=any_cast<TCPOutConnections::conn_t>(var); // our own reference, waking up a query may close the connection
+  char buffer[4096];
+
+  int ret=recv(fd, buffer, sizeof(buffer), 0);
+  if(ret <= 0) { // error or EOF, for example because the server closed an idle connection
+    failTCPOutConnection(conn);
+    return;
+  }
+  conn->d_inbuf.append(buffer, ret);
+
+  PacketID pident;
+  pident.sock=&conn->d_sock;
+  pident.remote=conn->d_remote;
+  // answers may come in any order, the id tells us who they are for
+  while(conn->d_reading && conn->d_inbuf.size() >= 2) {
+    string::size_type len=(unsigned char)conn->d_inbuf[0]*256 + (unsigned char)conn->d_inbuf[1];
+    if(conn->d_inbuf.size() < len + 2)
+      break;
+    if(len < sizeof(dnsheader)) {
+      failTCPOutConnection(conn);
+      return;
+    }
+    string msg=conn->d_inbuf.substr(2, len);
+    conn->d_inbuf.erase(0, len + 2);
+
+    uint16_t id;
+    memcpy(&id, msg.c_str(), sizeof(id));
+    if(conn->d_waiting.erase(id)) { // if not, this is a late answer to a query that timed out
+      pident.id=id;
+      MT->sendEvent(pident, &msg);
+    }
+  }
+}
+
+/* used by LWRes, sends 'query' (which has the TCP length prefix already) over a new or pooled connection and waits for the answer */
+// -1 is error, 0 is timeout, 1 is success, throws NetworkError for OS errors
+int asendrecvtcp(const ComboAddress& remote, const string& query, uint16_t id, string& answer)
+{
+  for(int tries=0; ; ++tries) {
+    bool fresh;
+    TCPOutConnections::conn_t conn=t_tcpOutConns->get(remote, id, &fresh);
+    bool pipelined=!conn->d_waiting.empty();
+    conn->d_waiting.insert(id);
+    conn->d_lastUsed=g_now.tv_sec;
+
+    int ret;
+    if(fresh) {
+      ret=asendtcp(query, &conn->d_sock);
+      if(ret > 0)
+        t_tcpOutConns->startReading(conn);
+    }
+    else {
+      // the connection is registered for reading, so we can't wait for it to become writable. Small queries fit in the socket buffer
+      ssize_t sent=send(conn->d_sock.getHandle(), query.c_str(), query.size(), 0);
+      if(sent == (ssize_t)query.size()) {
+        g_stats.tcpConnectionsReused++;
+        if(pipelined)
+          g_stats.tcpQueriesPipelined++;
+        ret=1;
+      }
+      else {
+        conn->d_waiting.erase(id);
+        conn->d_retired=true;
+        if(sent > 0) // half a query went out, the stream is no good anymore. The readable callback fails the other queries, we can't wake them from here
+          shutdown(conn->d_sock.getHandle(), SHUT_RDWR);
+        ret=-1;
+      }
+    }
+
+    if(ret > 0) {
+      PacketID pident;
+      pident.sock=&conn->d_sock;
+      pident.remote=remote;
+      pident.id=id;
+      ret=MT->waitEvent(pident, &answer, g_networkTimeoutMsec);
+      if(ret > 0 && answer.empty()) // the connection failed
+        ret=-1;
+      else if(ret <= 0)
+        conn->d_retired=true;
+    }
+    if(ret <= 0)
+      conn->d_waiting.erase(id);
+    t_tcpOutConns->release(conn);
+
+    // the server may have closed an idle connection just as we used it, so give a failure on a reused connection one more try on a new one
+    if(ret != -1 || fresh || tries)
+      return ret;
+  }
+}
+
 void handleUDPServerResponse(int fd, FDMultiplexer::funcparam_t&);
 
 void setSocketBuffer(int fd, int optname, uint32_t size)
@@ -259,21 +498,42 @@ static void setSocketSendBuffer(int fd, uint32_t size)
 // you can ask this class for a UDP socket to send a query from
 // this socket is not yours, don't even think about deleting it
 // but after you call 'returnSocket' on it, don't assume anything anymore
+//
+// with a pool size set, queries share a pool of unconnected sockets per thread, each replaced by a new one on a
+// new random port once it is older than the pool lifetime. Answers are matched on remote, id and question as always
 class UDPClientSocks
 {
   unsigned int d_numsocks;
   unsigned int d_maxsocks;
+
+  struct PooledSocket
+  {
+    time_t created;
+    unsigned int outstanding; // queries that have not returned this socket yet
+    bool retired;             // no longer handed out, closed once outstanding reaches 0
+  };
+  typedef map<int, PooledSocket> pooled_t;
+  pooled_t d_pooled;
+  vector<int> d_pool4, d_pool6;
+
 public:
   UDPClientSocks() : d_numsocks(0), d_maxsocks(5000)
   {
   }
 
+  static unsigned int s_poolSize;
+  static unsigned int s_poolLifetime;
+
   typedef set<int> socks_t;
   socks_t d_socks;
 
   // returning -1 means: temporary OS error (ie, out of files), -2 means OS error
-  int getSocket(const ComboAddress& toaddr, int* fd)
+  int getSocket(const ComboAddress& toaddr, int* fd, bool* pooled)
   {
+    *pooled = s_poolSize;
+    if(*pooled)
+      return getPooledSocket(toaddr, fd);
+
     *fd=makeClientSocket(toaddr.sin4.sin_family);
     if(*fd < 0) // temporary error - receive exception otherwise
       return -1;
@@ -294,6 +554,13 @@ public:
 
   void returnSocket(int fd)
   {
+    pooled_t::iterator pooled=d_pooled.find(fd);
+    if(pooled != d_pooled.end()) {
+      if(!--pooled->second.outstanding && pooled->second.retired)
+        closePooledSocket(pooled);
+      return;
+    }
+
     socks_t::iterator i=d_socks.find(fd);
     if(i==d_socks.end()) {
       throw AhuException("Trying to return a socket (fd="+lexical_cast<string>(fd)+") not in the pool");
@@ -350,28 +617,77 @@ public:
       throw AhuException("Resolver binding to local query client socket: "+stringerror());
     
     Utility::setNonBlocking(ret);
+    g_stats.udpSocketsOpened++;
     return ret;
   }
+
+private:
+  int getPooledSocket(const ComboAddress& toaddr, int* fd)
+  {
+    vector<int>& pool = toaddr.sin4.sin_family == AF_INET ? d_pool4 : d_pool6;
+    unsigned int pos = dns_random(s_poolSize);
+
+    if(pos < pool.size()) {
+      pooled_t::iterator iter=d_pooled.find(pool[pos]);
+      if(g_now.tv_sec < iter->second.created + (time_t)s_poolLifetime) {
+        iter->second.outstanding++;
+        *fd=iter->first;
+        return 0;
+      }
+      // too old, a new one on another port takes its place
+      iter->second.retired=true;
+      if(!iter->second.outstanding)
+        closePooledSocket(iter);
+      pool[pos]=pool.back();
+      pool.pop_back();
+    }
+
+    *fd=makeClientSocket(toaddr.sin4.sin_family);
+    if(*fd < 0)
+      return -1;
+    t_fdm->addReadFD(*fd, handleUDPServerResponse);
+
+    PooledSocket& ps=d_pooled[*fd];
+    ps.created=g_now.tv_sec;
+    ps.outstanding=1;
+    ps.retired=false;
+    pool.push_back(*fd);
+    return 0;
+  }
+
+  void closePooledSocket(pooled_t::iterator& iter)
+  {
+    t_fdm->removeReadFD(iter->first);
+    Utility::closesocket(iter->first);
+    d_pooled.erase(iter++);
+  }
 };
 
+unsigned int UDPClientSocks::s_poolSize;
+unsigned int UDPClientSocks::s_poolLifetime;
+
 static __thread UDPClientSocks* t_udpclientsocks;
 
+static bool subscribeInFlight(const PacketID& pident, const char* data, int len);
+static void releaseInFlight(const PacketID& pident, const string* packet);
+
 /* these two functions are used by LWRes */
 // -2 is OS error, -1 is error that depends on the remote, > 0 is success
 int asendto(const char *data, int len, int flags, 
-            const ComboAddress& toaddr, uint16_t id, const string& domain, uint16_t qtype, int* fd) 
+            const ComboAddress& toaddr, uint16_t id, const string& domain, uint16_t qtype, int* fd, bool mayChain) 
 {
 
   PacketID pident;
   pident.domain = domain;
   pident.remote = toaddr;
   pident.type = qtype;
+  pident.nochain = !mayChain;
 
   // see if there is an existing outstanding request we can chain on to, using partial equivalence function
   pair<MT_t::waiters_t::iterator, MT_t::waiters_t::iterator> chain=MT->d_waiters.equal_range(pident, PacketIDBirthdayCompare());
 
-  for(; chain.first != chain.second; chain.first++) {
-    if(chain.first->key.fd > -1) { // don't chain onto existing chained waiter!
+  for(; mayChain && chain.first != chain.second; chain.first++) {
+    if(chain.first->key.fd > -1 && !chain.first->key.nochain) { // don't chain onto existing chained waiter!
       /*
       cerr<<"Orig: "<<pident.domain<<", "<<pident.remote.toString()<<", id="<<id<<endl;
       cerr<<"Had hit: "<< chain.first->key.domain<<", "<<chain.first->key.remote.toString()<<", id="<<chain.first->key.id
@@ -383,20 +699,38 @@ int asendto(const char *data, int len, int flags,
     }
   }
 
-  int ret=t_udpclientsocks->getSocket(toaddr, fd);
-  if(ret < 0)
+  pident.id=id;
+  if(g_coalesceQueries && mayChain && subscribeInFlight(pident, data, len)) { // another thread is asking already, it will pass on the answer
+    *fd=-1;
+    return 1;
+  }
+
+  bool pooled;
+  int ret=t_udpclientsocks->getSocket(toaddr, fd, &pooled);
+  if(ret < 0) {
+    if(g_coalesceQueries && mayChain)
+      releaseInFlight(pident, 0);
     return ret;
+  }
 
   pident.fd=*fd;
-  pident.id=id;
   
-  t_fdm->addReadFD(*fd, handleUDPServerResponse, pident);
-  ret = send(*fd, data, len, 0);
+  if(pooled) 
+    ret = sendto(*fd, data, len, 0, (struct sockaddr*)(&toaddr), toaddr.getSocklen());
+  else {
+    t_fdm->addReadFD(*fd, handleUDPServerResponse, pident);
+    ret = send(*fd, data, len, 0);
+  }
 
   int tmp = errno;
 
-  if(ret < 0)
+  if(ret < 0) {
     t_udpclientsocks->returnSocket(*fd);
+    if(g_coalesceQueries && mayChain) {
+      string empty;
+      releaseInFlight(pident, &empty);
+    }
+  }
 
   errno = tmp; // this is for logging purposes only
   return ret;
@@ -404,7 +738,7 @@ int asendto(const char *data, int len, int flags,
 
 // -1 is error, 0 is timeout, 1 is success
 int arecvfrom(char *data, int len, int flags, const ComboAddress& fromaddr, int *d_len, 
-              uint16_t id, const string& domain, uint16_t qtype, int fd, struct timeval* now)
+              uint16_t id, const string& domain, uint16_t qtype, int fd, struct timeval* now, bool mayChain)
 {
   static optional<unsigned int> nearMissLimit;
   if(!nearMissLimit) 
@@ -416,26 +750,32 @@ int arecvfrom(char *data, int len, int flags, const ComboAddress& fromaddr, int
   pident.domain=domain;
   pident.type = qtype;
   pident.remote=fromaddr;
+  pident.nochain=!mayChain;
 
   string packet;
   int ret=MT->waitEvent(pident, &packet, g_networkTimeoutMsec, now);
 
   if(ret > 0) {
     if(packet.empty()) // means "error"
-      return -1; 
-
-    *d_len=(int)packet.size();
-    memcpy(data,packet.c_str(),min(len,*d_len));
-    if(*nearMissLimit && pident.nearMisses > *nearMissLimit) {
+      ret = -1; 
+    else if(*nearMissLimit && pident.nearMisses > *nearMissLimit) {
       L<<Logger::Error<<"Too many ("<<pident.nearMisses<<" > "<<*nearMissLimit<<") bogus answers for '"<<domain<<"' from "<<fromaddr.toString()<<", assuming spoof attempt."<<endl;
       g_stats.spoofCount++;
-      return -1;
+      packet.clear();
+      ret = -1;
+    }
+    else {
+      *d_len=(int)packet.size();
+      memcpy(data,packet.c_str(),min(len,*d_len));
     }
   }
   else {
     if(fd >= 0)
       t_udpclientsocks->returnSocket(fd);
   }
+
+  if(fd >= 0 && g_coalesceQueries && mayChain) // we sent the query, so other threads might be waiting for it too
+    releaseInFlight(pident, ret ? &packet : 0);
   return ret;
 }
 
@@ -515,6 +855,7 @@ void startDoResolve(void *p)
        <<DNSRecordContent::NumberToType(dc->d_mdp.d_qtype)<<"' from "<<dc->getRemote()<<endl;
 
     sr.setId(MT->getTid());
+    sr.setRequestor(dc->d_remote);
     if(!dc->d_mdp.d_header.rd)
       sr.setCacheOnly();
 
@@ -524,6 +865,8 @@ void startDoResolve(void *p)
     // if there is a RecursorLua active, and it 'took' the query in preResolve, we don't launch beginResolve
     if(!t_pdl->get() || !(*t_pdl)->preresolve(dc->d_remote, g_listenSocketsAddresses[dc->d_socket], dc->d_mdp.d_qname, QType(dc->d_mdp.d_qtype), ret, res, &variableAnswer)) {
        res = sr.beginResolve(dc->d_mdp.d_qname, QType(dc->d_mdp.d_qtype), dc->d_mdp.d_qclass, ret);
+       if(sr.wasVariable()) // tailored to the subnet of this client
+         variableAnswer = true;
 
       if(t_pdl->get()) {
         if(res == RCode::NoError) {
@@ -766,6 +1109,7 @@ void handleRunningTCPQuestion(int fd, FDMultiplexer::funcparam_t& var)
       else {
         ++g_stats.qcounter;
         ++g_stats.tcpqcounter;
+        ++t_queries;
         MT->makeThread(startDoResolve, dc); // deletes dc, will set state to BYTE0 again
         return;
       }
@@ -813,26 +1157,110 @@ void handleNewTCPQuestion(int fd, FDMultiplexer::funcparam_t& )
   }
 }
  
-string* doProcessUDPQuestion(const std::string& question, const ComboAddress& fromaddr, int fd)
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define HAVE_UDP_BATCHING
+#endif
+
+/* questions read with one recvmmsg, and the packet cache answers to them that go out with one sendmmsg.
+   The buffers are made once per thread and reused for every batch */
+struct UDPBatch
+{
+  explicit UDPBatch(unsigned int size) : d_size(size), d_numReplies(0), d_data(size*1500), d_from(size), d_replies(size), d_replyTo(size)
+  {
+#ifdef HAVE_UDP_BATCHING
+    d_inmsgs.resize(size);
+    d_iniovs.resize(size);
+    d_outmsgs.resize(size);
+    d_outiovs.resize(size);
+    for(unsigned int n=0; n < size; ++n) {
+      d_iniovs[n].iov_base=&d_data[n*1500];
+      d_iniovs[n].iov_len=1500;
+      memset(&d_inmsgs[n], 0, sizeof(d_inmsgs[n]));
+      d_inmsgs[n].msg_hdr.msg_name=&d_from[n];
+      d_inmsgs[n].msg_hdr.msg_iov=&d_iniovs[n];
+      d_inmsgs[n].msg_hdr.msg_iovlen=1;
+      memset(&d_outmsgs[n], 0, sizeof(d_outmsgs[n]));
+      d_outmsgs[n].msg_hdr.msg_iov=&d_outiovs[n];
+      d_outmsgs[n].msg_hdr.msg_iovlen=1;
+    }
+#endif
+  }
+
+  //! queues a packet cache answer, returns false if the batch is full
+  bool addReply(string& response, const ComboAddress& dest)
+  {
+    if(d_numReplies == d_size)
+      return false;
+    d_replies[d_numReplies].swap(response);
+    d_replyTo[d_numReplies]=dest;
+    d_numReplies++;
+    return true;
+  }
+
+  void sendReplies(int fd);
+
+  unsigned int d_size, d_numReplies;
+  vector<char> d_data;
+  vector<ComboAddress> d_from;
+  vector<string> d_replies;
+  vector<ComboAddress> d_replyTo;
+#ifdef HAVE_UDP_BATCHING
+  vector<struct mmsghdr> d_inmsgs, d_outmsgs;
+  vector<struct iovec> d_iniovs, d_outiovs;
+#endif
+};
+
+static __thread UDPBatch* t_udpBatch; // 0 if we read one question per system call
+
+void UDPBatch::sendReplies(int fd)
+{
+#ifdef HAVE_UDP_BATCHING
+  for(unsigned int n=0; n < d_numReplies; ++n) {
+    d_outiovs[n].iov_base=(void*)d_replies[n].c_str();
+    d_outiovs[n].iov_len=d_replies[n].length();
+    d_outmsgs[n].msg_hdr.msg_name=&d_replyTo[n];
+    d_outmsgs[n].msg_hdr.msg_namelen=d_replyTo[n].getSocklen();
+  }
+  unsigned int sent=0;
+  while(sent < d_numReplies) {
+    int ret=sendmmsg(fd, &d_outmsgs[sent], d_numReplies - sent, 0);
+    if(ret <= 0) { // like a failed sendto, the client will ask again
+      if(g_logCommonErrors)
+        L<<Logger::Error<<"Dropping "<<d_numReplies-sent<<" packet cache answers, sendmmsg failed: "<<stringerror()<<endl;
+      break;
+    }
+    sent+=ret;
+  }
+#else
+  for(unsigned int n=0; n < d_numReplies; ++n)
+    sendto(fd, d_replies[n].c_str(), d_replies[n].length(), 0, (struct sockaddr*) &d_replyTo[n], d_replyTo[n].getSocklen());
+#endif
+  d_numReplies=0;
+}
+
+static __thread string* t_packetCacheResponse; // reused for every packet cache hit, so a hit does not allocate
+
+// batch is where packet cache answers go instead of being sent right away, if set
+string* doProcessUDPQuestion(const char* question, unsigned int len, const ComboAddress& fromaddr, int fd, UDPBatch* batch=0)
 {
   ++g_stats.qcounter;
+  ++t_queries;
 
-  string response;
+  string& response=*t_packetCacheResponse;
   try {
-    uint32_t age;
-    if(!SyncRes::s_nopacketcache && t_packetCache->getResponsePacket(question, g_now.tv_sec, &response, &age)) {
+    if(!SyncRes::s_nopacketcache && t_packetCache->getResponsePacket(question, len, g_now.tv_sec, &response)) {
       if(!g_quiet)
 	L<<Logger::Error<<t_id<< " question answered from packet cache from "<<fromaddr.toString()<<endl;
 
       g_stats.packetCacheHits++;
       SyncRes::s_queries++;
-      ageDNSPacket(response, age);
-      sendto(fd, response.c_str(), response.length(), 0, (struct sockaddr*) &fromaddr, fromaddr.getSocklen());
       if(response.length() >= sizeof(struct dnsheader)) {
         struct dnsheader dh;
         memcpy(&dh, response.c_str(), sizeof(dh));
         updateRcodeStats(dh.rcode);
       }
+      if(!batch || !batch->addReply(response, fromaddr))
+        sendto(fd, response.c_str(), response.length(), 0, (struct sockaddr*) &fromaddr, fromaddr.getSocklen());
       g_stats.avgLatencyUsec=(uint64_t)((1-0.0001)*g_stats.avgLatencyUsec + 0); // we assume 0 usec
       return 0;
     }
@@ -848,7 +1276,7 @@ string* doProcessUDPQuestion(const std::string& question, const ComboAddress& fr
     return 0;
   }
   
-  DNSComboWriter* dc = new DNSComboWriter(question.c_str(), question.size(), g_now);
+  DNSComboWriter* dc = new DNSComboWriter(question, len, g_now);
   dc->setSocket(fd);
   dc->setRemote(&fromaddr);
 
@@ -857,44 +1285,75 @@ string* doProcessUDPQuestion(const std::string& question, const ComboAddress& fr
   return 0;
 } 
  
+void distributeQuestion(const char* data, unsigned int len, const ComboAddress& fromaddr, int fd);
+
+static void processNewUDPQuestion(const char* data, int len, const ComboAddress& fromaddr, int fd, UDPBatch* batch)
+{
+  t_remotes->addRemote(fromaddr);
+
+  if(t_allowFrom && !t_allowFrom->match(&fromaddr)) {
+    if(!g_quiet) 
+      L<<Logger::Error<<"["<<MT->getTid()<<"] dropping UDP query from "<<fromaddr.toString()<<", address not matched by allow-from"<<endl;
+
+    g_stats.unauthorizedUDP++;
+    return;
+  }
+  try {
+    dnsheader* dh=(dnsheader*)data;
+    
+    if(dh->qr) {
+      if(g_logCommonErrors)
+        L<<Logger::Error<<"Ignoring answer from "<<fromaddr.toString()<<" on server socket!"<<endl;
+    }
+    else if(g_weDistributeQueries)
+      distributeQuestion(data, len, fromaddr, fd);
+    else
+      doProcessUDPQuestion(data, len, fromaddr, fd, batch);
+  }
+  catch(MOADNSException& mde) {
+    g_stats.clientParseError++; 
+    if(g_logCommonErrors)
+      L<<Logger::Error<<"Unable to parse packet from remote UDP client "<<fromaddr.toString() <<": "<<mde.what()<<endl;
+  }
+}
+
+#ifdef HAVE_UDP_BATCHING
+// reads as many questions as are waiting, up to the batch size, and answers all packet cache hits among them with one sendmmsg
+static void handleNewUDPQuestions(int fd, UDPBatch& batch)
+{
+  for(unsigned int n=0; n < batch.d_size; ++n)
+    batch.d_inmsgs[n].msg_hdr.msg_namelen=sizeof(batch.d_from[n]);
+
+  int got=recvmmsg(fd, &batch.d_inmsgs[0], batch.d_size, MSG_DONTWAIT, 0);
+  if(got < 0) {
+    if(errno == EAGAIN)
+      g_stats.noPacketError++;
+    return;
+  }
+
+  for(int n=0; n < got; ++n) 
+    processNewUDPQuestion(&batch.d_data[n*1500], batch.d_inmsgs[n].msg_len, batch.d_from[n], fd, &batch);
+
+  if(batch.d_numReplies)
+    batch.sendReplies(fd);
+}
+#endif
+
 void handleNewUDPQuestion(int fd, FDMultiplexer::funcparam_t& var)
 {
+#ifdef HAVE_UDP_BATCHING
+  if(t_udpBatch) {
+    handleNewUDPQuestions(fd, *t_udpBatch);
+    return;
+  }
+#endif
   int len;
   char data[1500];
   ComboAddress fromaddr;
   socklen_t addrlen=sizeof(fromaddr);
   
-  if((len=recvfrom(fd, data, sizeof(data), 0, (sockaddr *)&fromaddr, &addrlen)) >= 0) {
-    t_remotes->addRemote(fromaddr);
-
-    if(t_allowFrom && !t_allowFrom->match(&fromaddr)) {
-      if(!g_quiet) 
-        L<<Logger::Error<<"["<<MT->getTid()<<"] dropping UDP query from "<<fromaddr.toString()<<", address not matched by allow-from"<<endl;
-
-      g_stats.unauthorizedUDP++;
-      return;
-    }
-    try {
-      dnsheader* dh=(dnsheader*)data;
-      
-      if(dh->qr) {
-        if(g_logCommonErrors)
-          L<<Logger::Error<<"Ignoring answer from "<<fromaddr.toString()<<" on server socket!"<<endl;
-      }
-      else {
-	string question(data, len);
-	if(g_weDistributeQueries)
-	  distributeAsyncFunction(boost::bind(doProcessUDPQuestion, question, fromaddr, fd));
-	else
-	  doProcessUDPQuestion(question, fromaddr, fd);
-      }
-    }
-    catch(MOADNSException& mde) {
-      g_stats.clientParseError++; 
-      if(g_logCommonErrors)
-        L<<Logger::Error<<"Unable to parse packet from remote UDP client "<<fromaddr.toString() <<": "<<mde.what()<<endl;
-    }
-  }
+  if((len=recvfrom(fd, data, sizeof(data), 0, (sockaddr *)&fromaddr, &addrlen)) >= 0) 
+    processNewUDPQuestion(data, len, fromaddr, fd, 0);
   else {
     // cerr<<t_id<<" had error: "<<stringerror()<<endl;
     if(errno == EAGAIN)
@@ -904,9 +1363,21 @@ void handleNewUDPQuestion(int fd, FDMultiplexer::funcparam_t& var)
 
 
 typedef vector<pair<int, function< void(int, any&) > > > deferredAdd_t;
-deferredAdd_t deferredAdd;
+vector<deferredAdd_t> g_deferredAdds; // indexed like g_tcpListenSockets
+
+// with reuseport, every thread gets its own sockets on the same addresses, and the kernel spreads the questions over them
+static void setReusePort(int fd)
+{
+#ifdef SO_REUSEPORT
+  int tmp=1;
+  if(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (char*)&tmp, sizeof tmp) < 0)
+    throw AhuException("Setting SO_REUSEPORT on listening socket: "+stringerror());
+#else
+  throw AhuException("reuseport is not supported on this platform");
+#endif
+}
 
-void makeTCPServerSockets()
+void makeTCPServerSockets(unsigned int set)
 {
   int fd;
   vector<string>locals;
@@ -942,9 +1413,12 @@ void makeTCPServerSockets()
       exit(1);
     }
     
+    if(g_reusePort)
+      setReusePort(fd);
+
 #ifdef TCP_DEFER_ACCEPT
     if(setsockopt(fd, SOL_TCP,TCP_DEFER_ACCEPT,(char*)&tmp,sizeof tmp) >= 0) {
-      if(i==locals.begin())
+      if(i==locals.begin() && !set)
         L<<Logger::Error<<"Enabled TCP data-ready filter for (slight) DoS protection"<<endl;
     }
 #endif
@@ -957,9 +1431,11 @@ void makeTCPServerSockets()
     Utility::setNonBlocking(fd);
     setSocketSendBuffer(fd, 65000);
     listen(fd, 128);
-    deferredAdd.push_back(make_pair(fd, handleNewTCPQuestion));
-    g_tcpListenSockets.push_back(fd);
+    g_deferredAdds[set].push_back(make_pair(fd, handleNewTCPQuestion));
+    g_tcpListenSockets[set].push_back(fd);
 
+    if(set)
+      continue;
     if(sin.sin4.sin_family == AF_INET) 
       L<<Logger::Error<<"Listening for TCP queries on "<< sin.toString() <<":"<<st.port<<endl;
     else
@@ -969,7 +1445,7 @@ void makeTCPServerSockets()
 
 
 
-void makeUDPServerSockets()
+void makeUDPServerSockets(unsigned int set)
 {
   vector<string>locals;
   stringtok(locals,::arg()["local-address"]," ,");
@@ -977,7 +1453,7 @@ void makeUDPServerSockets()
   if(locals.empty())
     throw AhuException("No local address specified");
   
-  if(::arg()["local-address"]=="0.0.0.0") {
+  if(::arg()["local-address"]=="0.0.0.0" && !set) {
     L<<Logger::Warning<<"It is advised to bind to explicit addresses with the --local-address option"<<endl;
   }
 
@@ -1006,14 +1482,19 @@ void makeUDPServerSockets()
     setSocketReceiveBuffer(fd, 200000);
     sin.sin4.sin_port = htons(st.port);
 
+    if(g_reusePort)
+      setReusePort(fd);
+
     int socklen=sin.sin4.sin_family==AF_INET ? sizeof(sin.sin4) : sizeof(sin.sin6);
     if (::bind(fd, (struct sockaddr *)&sin, socklen)<0) 
       throw AhuException("Resolver binding to server socket on port "+ lexical_cast<string>(st.port) +" for "+ st.host+": "+stringerror());
     
     Utility::setNonBlocking(fd);
 
-    deferredAdd.push_back(make_pair(fd, handleNewUDPQuestion));
+    g_deferredAdds[set].push_back(make_pair(fd, handleNewUDPQuestion));
     g_listenSocketsAddresses[fd]=sin;  // this is written to only from the startup thread, not from the workers
+    if(set)
+      continue;
     if(sin.sin4.sin_family == AF_INET) 
       L<<Logger::Error<<"Listening for UDP queries on "<< sin.toString() <<":"<<st.port<<endl;
     else
@@ -1117,6 +1598,7 @@ try
     t_packetCache->doPruneTo(::arg().asNum("max-packetcache-entries") / g_numThreads);
     
     pruneCollection(t_sstorage->negcache, ::arg().asNum("max-cache-entries") / (g_numThreads * 10), 200);
+    t_tcpOutConns->expire(now.tv_sec);
     
     if(!((cleanCounter++)%40)) {  // this is a full scan!
       time_t limit=now.tv_sec-300;
@@ -1159,6 +1641,35 @@ catch(AhuException& ae)
 }
 ;
 
+// an eventfd on Linux, a pipe elsewhere. Both ends are nonblocking, writers ignore a full pipe, it is awake enough
+static void makeWakeup(int* readfd, int* writefd)
+{
+#ifdef __linux__
+  *readfd = *writefd = eventfd(0, EFD_NONBLOCK);
+  if(*readfd < 0)
+    unixDie("Creating eventfd for inter-thread communications");
+#else
+  int fd[2];
+  if(pipe(fd) < 0)
+    unixDie("Creating pipe for inter-thread communications");
+  Utility::setNonBlocking(fd[0]);
+  Utility::setNonBlocking(fd[1]);
+  *readfd = fd[0];
+  *writefd = fd[1];
+#endif
+}
+
+static void wakeup(int fd)
+{
+#ifdef __linux__
+  uint64_t one = 1;
+#else
+  char one = 1;
+#endif
+  if(write(fd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN)
+    unixDie("write to thread wakeup returned wrong size or error");
+}
+
 void makeThreadPipes()
 {
   for(unsigned int n=0; n < g_numThreads; ++n) {
@@ -1174,7 +1685,23 @@ void makeThreadPipes()
       unixDie("Creating pipe for inter-thread communications");
     tps.readFromThread = fd[0];
     tps.writeFromThread = fd[1];
-    
+
+    tps.questions = 0;
+    tps.readQuestionsWakeup = tps.writeQuestionsWakeup = -1;
+    tps.wakeupWanted = false;
+    if(g_weDistributeQueries && n) {
+      tps.questions = new SPSCQueue<DistributedQuestion>(::arg().asNum("distributor-queue-size"));
+      makeWakeup(&tps.readQuestionsWakeup, &tps.writeQuestionsWakeup);
+    }
+
+    tps.readAnswersWakeup = tps.writeAnswersWakeup = -1;
+    if(g_coalesceQueries) {
+      for(unsigned int sender=0; sender < g_numThreads; ++sender)
+        tps.inFlightAnswers.push_back(new SPSCQueue<InFlightAnswer>(s_inFlightQueueSize));
+      tps.inFlightPending.resize(g_numThreads);
+      makeWakeup(&tps.readAnswersWakeup, &tps.writeAnswersWakeup);
+    }
+
     g_pipes.push_back(tps);
   }
 }
@@ -1212,23 +1739,197 @@ void broadcastFunction(const pipefunc_t& func, bool skipSelf)
     }
   }
 }
-void distributeAsyncFunction(const pipefunc_t& func)
+/* with coalesce-outgoing-queries, an outgoing UDP query is registered here by the thread that sends it. Threads that
+   want to ask the same server the same question in the meantime subscribe to it, instead of sending a query of their own.
+   The sender passes the answer to each subscriber through the SPSCQueue from the sender to the subscriber, where it wakes
+   up the waiting MThread as if the answer had arrived on its own socket. A thread only subscribes if it is sure to have
+   room in that queue, otherwise it sends its own query. Within one thread, the PacketID chain in asendto() already does this */
+struct InFlightKey
+{
+  ComboAddress remote;
+  string domain;
+  uint16_t type;
+  string extra; // the header flags and the additional section: EDNS, and EDNS Client Subnet in particular
+
+  bool operator<(const InFlightKey& b) const
+  {
+    if(tie(remote, type) < tie(b.remote, b.type))
+      return true;
+    if(tie(remote, type) > tie(b.remote, b.type))
+      return false;
+    if(pdns_ilexicographical_compare(domain, b.domain))
+      return true;
+    if(pdns_ilexicographical_compare(b.domain, domain))
+      return false;
+    return extra < b.extra;
+  }
+};
+
+struct InFlightQuery
+{
+  unsigned int owner;   // t_id of the thread that sent the query
+  uint16_t ownerID;     // and the id it used
+  vector<pair<unsigned int, uint16_t> > subscribers; // t_id and id of everybody waiting for the answer
+};
+
+typedef map<InFlightKey, InFlightQuery> inflight_t;
+static inflight_t g_inFlight;
+static pthread_mutex_t g_inFlightLock = PTHREAD_MUTEX_INITIALIZER;
+
+static InFlightKey makeInFlightKey(const PacketID& pident)
+{
+  InFlightKey key;
+  key.remote=pident.remote;
+  key.domain=pident.domain;
+  key.type=pident.type;
+  return key;
+}
+
+// returns true if the query is outstanding already, and we have been added as a subscriber. If not, we send the query
+// ourselves, and are the owner unless there is one already whose queue to us might be full
+static bool subscribeInFlight(const PacketID& pident, const char* data, int len)
 {
-  static unsigned int counter;
-  unsigned int target = 1 + (++counter % (g_pipes.size()-1));
-  // cerr<<"Sending to: "<<target<<endl;
-  if(target == t_id) {
-    func();
+  InFlightKey key=makeInFlightKey(pident);
+  key.extra.assign(data+2, 2);
+  int pos=sizeof(dnsheader);
+  while(pos < len && data[pos])
+    pos+=(unsigned char)data[pos]+1;
+  pos+=5; // the root label, qtype and qclass
+  if(pos < len)
+    key.extra.append(data+pos, len-pos);
+
+  Lock l(&g_inFlightLock);
+  inflight_t::iterator iter=g_inFlight.find(key);
+  if(iter != g_inFlight.end()) {
+    unsigned int& pending=g_pipes[t_id].inFlightPending[iter->second.owner];
+    if(pending >= s_inFlightQueueSize) {
+      g_stats.coalesceQueueFull++;
+      return false;
+    }
+    pending++;
+    iter->second.subscribers.push_back(make_pair(t_id, pident.id));
+    g_stats.coalescedQueries++;
+    return true;
+  }
+  InFlightQuery& ifq=g_inFlight[key];
+  ifq.owner=t_id;
+  ifq.ownerID=pident.id;
+  return false;
+}
+
+/* called by the owner when its query is done. An empty packet conveys an error to the subscribers, no packet at all
+   means the query timed out, in which case they will time out themselves. Every subscriber gets an InFlightAnswer
+   either way, so it knows the room it kept for it in the queue is free again */
+static void releaseInFlight(const PacketID& pident, const string* packet)
+{
+  vector<pair<unsigned int, uint16_t> > subscribers;
+  {
+    InFlightKey key=makeInFlightKey(pident);
+    Lock l(&g_inFlightLock);
+    // the extra part of the key is not in pident, but we own at most one query with this id
+    for(inflight_t::iterator iter=g_inFlight.lower_bound(key); iter != g_inFlight.end(); ++iter) {
+      if(!(iter->first.remote == key.remote) || iter->first.type != key.type || !pdns_iequals(iter->first.domain, key.domain))
+        break;
+      if(iter->second.owner == t_id && iter->second.ownerID == pident.id) {
+        subscribers.swap(iter->second.subscribers);
+        g_inFlight.erase(iter);
+        break;
+      }
+    }
+  }
+
+  vector<bool> woken(g_numThreads);
+  for(vector<pair<unsigned int, uint16_t> >::const_iterator i=subscribers.begin(); i != subscribers.end(); ++i) {
+    SPSCQueue<InFlightAnswer>* answers=g_pipes[i->first].inFlightAnswers[t_id];
+    InFlightAnswer* ifa=answers->prepare(); // never 0, the subscriber made sure there is room
+    ifa->remote=pident.remote;
+    ifa->domain=pident.domain;
+    ifa->type=pident.type;
+    ifa->id=i->second;
+    ifa->haveAnswer=(packet != 0);
+    if(packet)
+      ifa->packet.assign(*packet);
+    answers->push();
+    woken[i->first]=true;
+  }
+  for(unsigned int n=0; n < g_numThreads; ++n)
+    if(woken[n])
+      wakeup(g_pipes[n].writeAnswersWakeup); // also for ourselves, since only the kernel can send MTasker events
+}
+
+void handleInFlightAnswers(int fd, FDMultiplexer::funcparam_t& var)
+{
+  char buf[512];
+  if(read(fd, buf, sizeof(buf)) < 0 && errno != EAGAIN)
+    unixDie("read from thread wakeup returned error");
+
+  ThreadPipeSet& tps=g_pipes[t_id];
+  PacketID pident;
+  pident.fd=-1;
+  for(unsigned int sender=0; sender < g_numThreads; ++sender) {
+    SPSCQueue<InFlightAnswer>* answers=tps.inFlightAnswers[sender];
+    InFlightAnswer* ifa;
+    while((ifa = answers->front())) {
+      if(ifa->haveAnswer) {
+        pident.remote=ifa->remote;
+        pident.domain=ifa->domain;
+        pident.type=ifa->type;
+        pident.id=ifa->id;
+        MT->sendEvent(pident, &ifa->packet); // if it timed out already, nobody is interested anymore
+      }
+      answers->pop();
+      tps.inFlightPending[sender]--;
+    }
+  }
+}
+
+// FNV-1a of the lowercase qname in wire format, so all questions for a name end up with the same packet and record cache
+static unsigned int hashQuestionName(const char* packet, unsigned int len)
+{
+  unsigned int hash=2166136261U;
+  for(unsigned int pos=sizeof(dnsheader); pos < len && packet[pos]; ++pos)
+    hash = (hash ^ (unsigned char)dns_tolower(packet[pos])) * 16777619U;
+  return hash;
+}
+
+void distributeQuestion(const char* data, unsigned int len, const ComboAddress& fromaddr, int fd)
+{
+  ThreadPipeSet& tps = g_pipes[1 + hashQuestionName(data, len) % (g_pipes.size()-1)];
+  DistributedQuestion* dq = tps.questions->prepare();
+  if(!dq) { // this thread is far behind already
+    g_stats.overCapacityDrops++;
     return;
   }
-  ThreadPipeSet& tps = g_pipes[target];    
-  ThreadMSG* tmsg = new ThreadMSG();
-  tmsg->func = func;
-  tmsg->wantAnswer = false;
-  
-  if(write(tps.writeToThread, &tmsg, sizeof(tmsg)) != sizeof(tmsg))
-    unixDie("write to thread pipe returned wrong size or error");
-    
+  dq->question.assign(data, len);
+  dq->fromaddr = fromaddr;
+  dq->fd = fd;
+  tps.questions->push();
+  tps.wakeupWanted = true;
+}
+
+// called by thread 0 after each round of its event loop, so a burst of questions costs one wakeup per thread
+void wakeupDistributionTargets()
+{
+  BOOST_FOREACH(ThreadPipeSet& tps, g_pipes) {
+    if(!tps.wakeupWanted)
+      continue;
+    tps.wakeupWanted = false;
+    wakeup(tps.writeQuestionsWakeup);
+  }
+}
+
+void handleDistributedQuestions(int fd, FDMultiplexer::funcparam_t& var)
+{
+  char buf[512]; // an eventfd reads as 8 bytes, a pipe as all the wakeups written to it
+  if(read(fd, buf, sizeof(buf)) < 0 && errno != EAGAIN)
+    unixDie("read from thread wakeup returned error");
+
+  SPSCQueue<DistributedQuestion>* questions = g_pipes[t_id].questions;
+  DistributedQuestion* dq;
+  while((dq = questions->front())) {
+    doProcessUDPQuestion(dq->question.c_str(), dq->question.length(), dq->fromaddr, dq->fd);
+    questions->pop();
+  }
 }
 
 void handlePipeRequest(int fd, FDMultiplexer::funcparam_t& var)
@@ -1320,37 +2021,6 @@ void handleRCC(int fd, FDMultiplexer::funcparam_t& var)
   }
 }
 
-void handleTCPClientReadable(int fd, FDMultiplexer::funcparam_t& var)
-{
-  PacketID* pident=any_cast<PacketID>(&var);
-  //  cerr<<"handleTCPClientReadable called for fd "<<fd<<", pident->inNeeded: "<<pident->inNeeded<<", "<<pident->sock->getHandle()<<endl;
-
-  shared_array<char> buffer(new char[pident->inNeeded]);
-
-  int ret=recv(fd, buffer.get(), pident->inNeeded,0);
-  if(ret > 0) {
-    pident->inMSG.append(&buffer[0], &buffer[ret]);
-    pident->inNeeded-=ret;
-    if(!pident->inNeeded) {
-      //      cerr<<"Got entire load of "<<pident->inMSG.size()<<" bytes"<<endl;
-      PacketID pid=*pident;
-      string msg=pident->inMSG;
-      
-      t_fdm->removeReadFD(fd);
-      MT->sendEvent(pid, &msg); 
-    }
-    else {
-      //      cerr<<"Still have "<<pident->inNeeded<<" left to go"<<endl;
-    }
-  }
-  else {
-    PacketID tmp=*pident;
-    t_fdm->removeReadFD(fd); // pident might now be invalid (it isn't, but still)
-    string empty;
-    MT->sendEvent(tmp, &empty); // this conveys error status
-  }
-}
-
 void handleTCPClientWritable(int fd, FDMultiplexer::funcparam_t& var)
 {
   PacketID* pid=any_cast<PacketID>(&var);
@@ -1389,7 +2059,6 @@ void doResends(MT_t::waiters_t::iterator& iter, PacketID resend, const string& c
 
 void handleUDPServerResponse(int fd, FDMultiplexer::funcparam_t& var)
 {
-  PacketID pid=any_cast<PacketID>(var);
   int len;
   char data[1500];
   ComboAddress fromaddr;
@@ -1407,6 +2076,10 @@ void handleUDPServerResponse(int fd, FDMultiplexer::funcparam_t& var)
           ": packet smalller than DNS header"<<endl;
     }
 
+    if(var.empty()) // a pooled socket, shared by queries to many servers, the waiter will time out
+      return;
+
+    PacketID pid=any_cast<PacketID>(var);
     t_udpclientsocks->returnSocket(fd);
     string empty;
 
@@ -1705,6 +2378,34 @@ int serviceMain(int argc, char*argv[])
 
   SyncRes::s_nopacketcache = ::arg().mustDo("disable-packetcache");
 
+  try {
+    vector<string> parts;
+    uint32_t ip;
+    stringtok(parts, ::arg()["edns-subnet-whitelist"], ", ");
+    BOOST_FOREACH(const string& part, parts) {
+      if(part.find('/') != string::npos || part.find(':') != string::npos || IpToU32(part, &ip)) // a server, not a domain
+        SyncRes::s_ednsservers.addMask(part);
+      else
+        SyncRes::s_ednsdomains.insert(toCanonic("", part));
+    }
+  }
+  catch(std::exception& e) {
+    L<<Logger::Error<<"Parsing edns-subnet-whitelist: "<<e.what()<<endl;
+    exit(99);
+  }
+  catch(AhuException& ae) {
+    L<<Logger::Error<<"Parsing edns-subnet-whitelist: "<<ae.reason<<endl;
+    exit(99);
+  }
+  int ecsipv4bits = ::arg().asNum("ecs-ipv4-bits"), ecsipv6bits = ::arg().asNum("ecs-ipv6-bits");
+  if(ecsipv4bits < 0 || ecsipv4bits > 32 || ecsipv6bits < 0 || ecsipv6bits > 128) {
+    L<<Logger::Error<<"ecs-ipv4-bits must be between 0 and 32, ecs-ipv6-bits between 0 and 128"<<endl;
+    exit(99);
+  }
+  SyncRes::s_ecsipv4bits = ecsipv4bits;
+  SyncRes::s_ecsipv6bits = ecsipv6bits;
+  SyncRes::s_ednsSubnetOption = ::arg().asNum("edns-subnet-option-number");
+
   SyncRes::s_maxnegttl=::arg().asNum("max-negative-ttl");
   SyncRes::s_maxcachettl=::arg().asNum("max-cache-ttl");
   SyncRes::s_packetcachettl=::arg().asNum("packetcache-ttl");
@@ -1723,8 +2424,21 @@ int serviceMain(int argc, char*argv[])
     
   g_logCommonErrors=::arg().mustDo("log-common-errors");
   
-  makeUDPServerSockets();
-  makeTCPServerSockets();
+  g_reusePort=::arg().mustDo("reuseport");
+  if(g_reusePort && ::arg().mustDo("pdns-distributes-queries")) {
+    L<<Logger::Error<<"reuseport and pdns-distributes-queries can't be used together, exiting"<<endl;
+    exit(1);
+  }
+  // the sockets of all threads are made here, while we may still bind to privileged ports
+  unsigned int listenSets = g_reusePort ? ::arg().asNum("threads") : 1;
+  g_deferredAdds.resize(listenSets);
+  g_tcpListenSockets.resize(listenSets);
+  for(unsigned int n=0; n < listenSets; ++n) {
+    makeUDPServerSockets(n);
+    makeTCPServerSockets(n);
+  }
+  if(g_reusePort)
+    L<<Logger::Warning<<"Each of the "<<listenSets<<" threads listens on sockets of its own"<<endl;
 
   int forks;
   for(forks = 0; forks < ::arg().asNum("processes") - 1; ++forks) {
@@ -1766,11 +2480,16 @@ int serviceMain(int argc, char*argv[])
   Utility::dropPrivs(newuid, newgid);
   g_numThreads = ::arg().asNum("threads") + ::arg().mustDo("pdns-distributes-queries");
   
+  g_coalesceQueries=::arg().mustDo("coalesce-outgoing-queries") && g_numThreads > 1;
   makeThreadPipes();
   
   g_tcpTimeout=::arg().asNum("client-tcp-timeout");
   g_maxTCPPerClient=::arg().asNum("max-tcp-per-client");
   g_maxMThreads=::arg().asNum("max-mthreads");
+  UDPClientSocks::s_poolSize=::arg().asNum("outgoing-socket-pool-size");
+  UDPClientSocks::s_poolLifetime=::arg().asNum("outgoing-socket-pool-lifetime");
+  TCPOutConnections::s_idleTimeout=::arg().asNum("outgoing-tcp-idle-timeout");
+  TCPOutConnections::s_maxPipelined=max(1, ::arg().asNum("outgoing-tcp-max-pipelined"));
 
   if(g_numThreads == 1) {
     L<<Logger::Warning<<"Operating unthreaded"<<endl;
@@ -1790,20 +2509,58 @@ int serviceMain(int argc, char*argv[])
   return 0;
 }
 
+// keeps each thread, and so its caches, on a CPU of its own
+static void pinThread()
+{
+#ifdef __linux__
+  long cpus=sysconf(_SC_NPROCESSORS_ONLN);
+  if(cpus <= 0)
+    return;
+  cpu_set_t cpuset;
+  CPU_ZERO(&cpuset);
+  CPU_SET(t_id % cpus, &cpuset);
+  int res=pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+  if(res)
+    L<<Logger::Error<<"Unable to pin thread "<<t_id<<" to CPU "<<t_id % cpus<<": "<<strerror(res)<<endl;
+#else
+  if(!t_id)
+    L<<Logger::Error<<"pin-threads is not supported on this platform"<<endl;
+#endif
+}
+
+string* pleaseGetThreadQueries()
+{
+  return new string("thread "+lexical_cast<string>(t_id)+": "+lexical_cast<string>(t_queries)+" questions\n");
+}
+
 void* recursorThread(void* ptr)
 try
 {
   t_id=(int) (long) ptr;
+  if(::arg().mustDo("pin-threads"))
+    pinThread();
   SyncRes tmp(g_now); // make sure it allocates tsstorage before we do anything, like primeHints or so..
   t_sstorage->domainmap = g_initialDomainMap;
   t_allowFrom = g_initialAllowFrom;
   t_udpclientsocks = new UDPClientSocks();
+  t_tcpOutConns = new TCPOutConnections();
   t_tcpClientCounts = new tcpClientCounts_t();
   primeHints();
   
   t_packetCache = new RecursorPacketCache();
+  t_packetCacheResponse = new string();
+#ifdef HAVE_UDP_BATCHING
+  if(::arg().asNum("udp-batch-size") > 1)
+    t_udpBatch = new UDPBatch(::arg().asNum("udp-batch-size"));
+#endif
   
   L<<Logger::Warning<<"Done priming cache with root hints"<<endl;
+
+  if(!::arg()["load-cache-on-start"].empty()) {
+    uint64_t* count=pleaseLoadCache(::arg()["load-cache-on-start"]);
+    L<<Logger::Warning<<"Loaded "<<*count<<" cache entries from '"<<::arg()["load-cache-on-start"]<<"'"<<endl;
+    delete count;
+  }
     
   t_RC->d_followRFC2181=::arg().mustDo("auth-can-lower-ttl");
   t_pdl = new shared_ptr<RecursorLua>();
@@ -1836,10 +2593,18 @@ try
     L<<Logger::Error<<"Enabled '"<< t_fdm->getName() << "' multiplexer"<<endl;
 
   t_fdm->addReadFD(g_pipes[t_id].readToThread, handlePipeRequest);
-
-  if(!g_weDistributeQueries || !t_id)  // if we distribute queries, only t_id = 0 listens
+  if(g_pipes[t_id].questions)
+    t_fdm->addReadFD(g_pipes[t_id].readQuestionsWakeup, handleDistributedQuestions);
+  if(g_coalesceQueries)
+    t_fdm->addReadFD(g_pipes[t_id].readAnswersWakeup, handleInFlightAnswers);
+
+  tcpListenSockets_t noTCPListenSockets;
+  tcpListenSockets_t& tcpListenSockets = g_weDistributeQueries && t_id ? noTCPListenSockets : g_tcpListenSockets[g_reusePort ? t_id : 0];
+  if(!g_weDistributeQueries || !t_id) { // if we distribute queries, only t_id = 0 listens
+    const deferredAdd_t& deferredAdd = g_deferredAdds[g_reusePort ? t_id : 0];
     for(deferredAdd_t::const_iterator i=deferredAdd.begin(); i!=deferredAdd.end(); ++i) 
       t_fdm->addReadFD(i->first, i->second);
+  }
   
   if(!t_id) {
     t_fdm->addReadFD(s_rcc.d_fd, handleRCC); // control channel
@@ -1879,16 +2644,19 @@ try
     t_fdm->run(&g_now);
     // 'run' updates g_now for us
 
+    if(g_weDistributeQueries && !t_id)
+      wakeupDistributionTargets();
+
     if(listenOnTCP) {
       if(TCPConnection::getCurrentConnections() > maxTcpClients) {  // shutdown, too many connections
-        for(tcpListenSockets_t::iterator i=g_tcpListenSockets.begin(); i != g_tcpListenSockets.end(); ++i)
+        for(tcpListenSockets_t::iterator i=tcpListenSockets.begin(); i != tcpListenSockets.end(); ++i)
           t_fdm->removeReadFD(*i);
         listenOnTCP=false;
       }
     }
     else {
       if(TCPConnection::getCurrentConnections() <= maxTcpClients) {  // reenable
-        for(tcpListenSockets_t::iterator i=g_tcpListenSockets.begin(); i != g_tcpListenSockets.end(); ++i)
+        for(tcpListenSockets_t::iterator i=tcpListenSockets.begin(); i != tcpListenSockets.end(); ++i)
           t_fdm->addReadFD(*i, handleNewTCPQuestion);
         listenOnTCP=true;
       }
@@ -1988,6 +2756,7 @@ int main(int argc, char **argv)
     ::arg().set("max-mthreads", "Maximum number of simultaneous Mtasker threads")="2048";
     ::arg().set("max-tcp-clients","Maximum number of simultaneous TCP clients")="128";
     ::arg().set("hint-file", "If set, load root hints from this file")="";
+    ::arg().set("load-cache-on-start", "If set, load the cache from this file written by 'rec_control dump-cache-binary' on startup")="";
     ::arg().set("max-cache-entries", "If set, maximum number of entries in the main cache")="1000000";
     ::arg().set("max-negative-ttl", "maximum number of seconds to keep a negative cached entry in memory")="3600";
     ::arg().set("max-cache-ttl", "maximum number of seconds to keep a cached entry in memory")="86400";
@@ -2003,6 +2772,10 @@ int main(int argc, char **argv)
     ::arg().set("dont-query", "If set, do not query these netmasks for DNS data")=LOCAL_NETS; 
     ::arg().set("max-tcp-per-client", "If set, maximum number of TCP sessions per client (IP address)")="0";
     ::arg().set("spoof-nearmiss-max", "If non-zero, assume spoofing after this many near misses")="20";
+    ::arg().set("outgoing-socket-pool-size", "If non-zero, send queries from this many shared sockets per thread, instead of a new socket for each query")="0";
+    ::arg().set("outgoing-socket-pool-lifetime", "Seconds after which a shared outgoing socket is replaced by one on a new port")="10";
+    ::arg().set("outgoing-tcp-idle-timeout", "Seconds an idle outgoing TCP connection is kept open for further queries, 0 closes it after every query")="10";
+    ::arg().set("outgoing-tcp-max-pipelined", "Maximum number of queries waiting for an answer on one outgoing TCP connection")="8";
     ::arg().set("single-socket", "If set, only use a single socket for outgoing queries")="off";
     ::arg().set("auth-zones", "Zones for which we have authoritative data, comma separated domain=file pairs ")="";
     ::arg().set("forward-zones", "Zones for which we forward queries, comma separated domain=ip pairs")="";
@@ -2018,7 +2791,16 @@ int main(int argc, char **argv)
     ::arg().setSwitch( "disable-edns-ping", "Disable EDNSPing" )= "no"; 
     ::arg().setSwitch( "disable-edns", "Disable EDNS" )= ""; 
     ::arg().setSwitch( "disable-packetcache", "Disable packetcache" )= "no"; 
+    ::arg().set("edns-subnet-whitelist", "List of domains and server netmasks to send the subnet of our clients to with EDNS Client Subnet")="";
+    ::arg().set("ecs-ipv4-bits", "Number of bits of the IPv4 address of a client to send with EDNS Client Subnet")="24";
+    ::arg().set("ecs-ipv6-bits", "Number of bits of the IPv6 address of a client to send with EDNS Client Subnet")="56";
+    ::arg().set("edns-subnet-option-number", "EDNS option number to use for EDNS Client Subnet")="20730";
     ::arg().setSwitch( "pdns-distributes-queries", "If PowerDNS itself should distribute queries over threads (EXPERIMENTAL)")="no";
+    ::arg().setSwitch("reuseport", "Give each thread listening sockets of its own, so the kernel spreads the questions over them")="no";
+    ::arg().setSwitch("coalesce-outgoing-queries", "If threads should share outstanding queries for the same question to the same server")="no";
+    ::arg().setSwitch("pin-threads", "Keep each thread on a CPU of its own")="no";
+    ::arg().set("udp-batch-size", "Number of UDP questions to read, and packet cache answers to send, per system call (Linux only)")="16";
+    ::arg().set("distributor-queue-size", "With pdns-distributes-queries, questions that can wait for each thread before new ones are dropped")="1024";
     
 
     ::arg().setCmd("help","Provide a helpful message");
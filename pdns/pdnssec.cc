@@ -13,6 +13,7 @@
 #include "signingpipe.hh"
 #include <boost/scoped_ptr.hpp>
 #include "bindbackend2.hh"
+#include "lock.hh"
 
 StatBag S;
 PacketCache PC;
@@ -148,10 +149,20 @@ void rectifyZone(DNSSECKeeper& dk, const std::string& zone)
     
   bool realrr=true;
   string hashed;
+  vector<DNSSECOrderAndAuth> batch;
+  vector<string> hashes;
 
   uint32_t maxent = ::arg().asNum("max-ent-entries");
 
   dononterm:;
+  batch.clear();
+  batch.reserve(qnames.size());
+  if(haveNSEC3 && !narrow) {
+    // hashing is what makes rectifying a large NSEC3 zone slow, so it happens up front on all cores
+    vector<string> names(qnames.begin(), qnames.end());
+    hashQNamesWithSalt(ns3pr.d_iterations, ns3pr.d_salt, names, hashes, sysconf(_SC_NPROCESSORS_ONLN));
+  }
+  vector<string>::size_type hashidx = 0;
   BOOST_FOREACH(const string& qname, qnames)
   {
     bool auth=true;
@@ -166,44 +177,34 @@ void rectifyZone(DNSSECKeeper& dk, const std::string& zone)
       } while(chopOff(shorter));
     }
 
+    DNSSECOrderAndAuth doa;
+    doa.qname = qname;
+    doa.auth = auth;
     if(haveNSEC3)
     {
       if(!narrow) {
-        hashed=toLower(toBase32Hex(hashQNameWithSalt(ns3pr.d_iterations, ns3pr.d_salt, qname)));
+        hashed=toLower(toBase32Hex(hashes[hashidx++]));
         if(g_verbose)
           cerr<<"'"<<qname<<"' -> '"<< hashed <<"'"<<endl;
-        sd.db->updateDNSSECOrderAndAuthAbsolute(sd.domain_id, qname, hashed, auth);
+        doa.ordering = DNSSECOrderAndAuth::AbsoluteOrdername;
+        doa.ordername = hashed;
       }
-      else
-        sd.db->nullifyDNSSECOrderNameAndUpdateAuth(sd.domain_id, qname, auth);
       if(realrr)
       {
-        if (dsnames.count(qname))
-          sd.db->setDNSSECAuthOnDsRecord(sd.domain_id, qname);
-        if (!auth || nsset.count(qname)) {
-          sd.db->nullifyDNSSECOrderNameAndAuth(sd.domain_id, qname, "NS");
-          sd.db->nullifyDNSSECOrderNameAndAuth(sd.domain_id, qname, "A");
-          sd.db->nullifyDNSSECOrderNameAndAuth(sd.domain_id, qname, "AAAA");
-        }
+        doa.dsAuth = dsnames.count(qname);
+        doa.nullifyNS = doa.nullifyAddresses = (!auth || nsset.count(qname));
       }
     }
     else // NSEC
     {
       if(realrr)
       {
-        sd.db->updateDNSSECOrderAndAuth(sd.domain_id, zone, qname, auth);
-        if (dsnames.count(qname))
-          sd.db->setDNSSECAuthOnDsRecord(sd.domain_id, qname);
-        if (!auth || nsset.count(qname)) {
-          sd.db->nullifyDNSSECOrderNameAndAuth(sd.domain_id, qname, "A");
-          sd.db->nullifyDNSSECOrderNameAndAuth(sd.domain_id, qname, "AAAA");
-        }
-      }
-      else
-      {
-        sd.db->nullifyDNSSECOrderNameAndUpdateAuth(sd.domain_id, qname, auth);
+        doa.ordering = DNSSECOrderAndAuth::RelativeOrdername;
+        doa.dsAuth = dsnames.count(qname);
+        doa.nullifyAddresses = (!auth || nsset.count(qname));
       }
     }
+    batch.push_back(doa);
 
     if(auth && realrr && doent)
     {
@@ -231,6 +232,8 @@ void rectifyZone(DNSSECKeeper& dk, const std::string& zone)
     }
   }
 
+  sd.db->updateDNSSECOrderAndAuthBatch(sd.domain_id, zone, batch);
+
   if(realrr)
   {
     //cerr<<"Total: "<<nonterm.size()<<" Insert: "<<insnonterm.size()<<" Delete: "<<delnonterm.size()<<endl;
@@ -250,17 +253,65 @@ void rectifyZone(DNSSECKeeper& dk, const std::string& zone)
     sd.db->commitTransaction();
 }
 
-void rectifyAllZones(DNSSECKeeper &dk) 
+namespace {
+struct RectifyAllState
 {
-  scoped_ptr<UeberBackend> B(new UeberBackend("default"));
   vector<DomainInfo> domainInfo;
+  vector<DomainInfo>::size_type next;
+  pthread_mutex_t lock;
+};
 
-  B->getAllDomains(&domainInfo);
-  BOOST_FOREACH(DomainInfo di, domainInfo) {
-    cerr<<"Rectifying "<<di.zone<<": ";
-    rectifyZone(dk, di.zone);
+void* rectifyAllZonesThread(void* p)
+{
+  RectifyAllState* ras = (RectifyAllState*)p;
+  DNSSECKeeper dk; // not shared, each thread gets its own backends
+  for(;;) {
+    string zone;
+    {
+      Lock l(&ras->lock);
+      if(ras->next == ras->domainInfo.size())
+        break;
+      zone = ras->domainInfo[ras->next++].zone;
+      cerr<<"Rectifying "<<zone<<endl;
+    }
+    try {
+      rectifyZone(dk, zone);
+    }
+    catch(AhuException& ae) {
+      cerr<<"Error rectifying '"<<zone<<"': "<<ae.reason<<endl;
+    }
+    catch(std::exception& e) {
+      cerr<<"Error rectifying '"<<zone<<"': "<<e.what()<<endl;
+    }
   }
-  cout<<"Rectified "<<domainInfo.size()<<" zones."<<endl;
+  return 0;
+}
+}
+
+void rectifyAllZones(DNSSECKeeper &dk, unsigned int threads)
+{
+  scoped_ptr<UeberBackend> B(new UeberBackend("default"));
+  RectifyAllState ras;
+  ras.next = 0;
+  pthread_mutex_init(&ras.lock, 0);
+
+  B->getAllDomains(&ras.domainInfo);
+  threads = max(1U, min(threads, (unsigned int)ras.domainInfo.size()));
+  if(threads == 1) {
+    BOOST_FOREACH(DomainInfo di, ras.domainInfo) {
+      cerr<<"Rectifying "<<di.zone<<": ";
+      rectifyZone(dk, di.zone);
+    }
+  }
+  else {
+    vector<pthread_t> tids(threads);
+    for(unsigned int n = 0; n < threads; ++n)
+      pthread_create(&tids[n], 0, rectifyAllZonesThread, &ras);
+    for(unsigned int n = 0; n < threads; ++n)
+      pthread_join(tids[n], 0);
+  }
+  pthread_mutex_destroy(&ras.lock);
+  cout<<"Rectified "<<ras.domainInfo.size()<<" zones."<<endl;
 }
 
 int checkZone(UeberBackend *B, const std::string& zone)
@@ -361,6 +412,20 @@ void testAlgorithms()
   DNSCryptoKeyEngine::testAll();
 }
 
+// counts the RRSIGs per algorithm, the algorithm is the second field of the RRSIG content
+static void countSignatures(const vector<DNSResourceRecord>& rrs, map<unsigned int, unsigned int>& perAlgorithm)
+{
+  BOOST_FOREACH(const DNSResourceRecord& rr, rrs) {
+    if(rr.qtype.getCode() != QType::RRSIG)
+      continue;
+    std::istringstream str(rr.content);
+    string type;
+    unsigned int algorithm=0;
+    str >> type >> algorithm;
+    perAlgorithm[algorithm]++;
+  }
+}
+
 void testSpeed(DNSSECKeeper& dk, const string& zone, const string& remote, int cores)
 {
   DNSResourceRecord rr;
@@ -382,6 +447,7 @@ void testSpeed(DNSSECKeeper& dk, const string& zone, const string& remote, int c
   ChunkedSigningPipe csp(zone, 1, remote, cores);
   
   vector<DNSResourceRecord> signatures;
+  map<unsigned int, unsigned int> perAlgorithm;
   uint32_t rnd;
   unsigned char* octets = (unsigned char*)&rnd;
   char tmp[25];
@@ -398,14 +464,18 @@ void testSpeed(DNSSECKeeper& dk, const string& zone, const string& remote, int c
     
     if(csp.submit(rr))
       while(signatures = csp.getChunk(), !signatures.empty())
-        ;
+        countSignatures(signatures, perAlgorithm);
   }
   cerr<<"Flushing the pipe, "<<csp.d_signed<<" signed, "<<csp.d_queued<<" queued, "<<csp.d_outstanding<<" outstanding"<< endl;
   cerr<<"Net speed: "<<csp.d_signed/ (dt.udiffNoReset()/1000000.0) << " sigs/s\n";
   while(signatures = csp.getChunk(true), !signatures.empty())
-      ;
+    countSignatures(signatures, perAlgorithm);
+  double seconds = dt.udiff()/1000000.0;
   cerr<<"Done, "<<csp.d_signed<<" signed, "<<csp.d_queued<<" queued, "<<csp.d_outstanding<<" outstanding"<< endl;
-  cerr<<"Net speed: "<<csp.d_signed/ (dt.udiff()/1000000.0) << " sigs/s\n";
+  cerr<<"Net speed: "<<csp.d_signed/seconds << " sigs/s, "<<csp.d_signed/seconds/cores<<" sigs/s per core\n";
+  for(map<unsigned int, unsigned int>::const_iterator i = perAlgorithm.begin(); i != perAlgorithm.end(); ++i) {
+    cerr<<"Algorithm "<<i->first<<": "<<i->second<<" signatures, "<<i->second/seconds<<" sigs/s, "<<i->second/seconds/cores<<" sigs/s per core\n";
+  }
 }
 
 void verifyCrypto(const string& zone)
@@ -712,7 +782,7 @@ try
     cerr<<"import-zone-key ZONE FILE          Import from a file a private key, ZSK or KSK\n";            
     cerr<<"                [ksk|zsk]          Defaults to KSK\n";
     cerr<<"rectify-zone ZONE [ZONE ..]        Fix up DNSSEC fields (order, auth)\n";
-    cerr<<"rectify-all-zones                  Rectify all zones.\n";
+    cerr<<"rectify-all-zones [THREADS]        Rectify all zones, THREADS at a time (default: one per core)\n";
     cerr<<"remove-zone-key ZONE KEY-ID        Remove key with KEY-ID from ZONE\n";
     cerr<<"secure-zone ZONE [ZONE ..]         Add KSK and two ZSKs\n";
     cerr<<"set-nsec3 ZONE ['params' [narrow]] Enable NSEC3 with PARAMs. Optionally narrow\n";
@@ -778,7 +848,11 @@ try
       rectifyZone(dk, cmds[n]);
   }
   else if (cmds[0] == "rectify-all-zones") {
-    rectifyAllZones(dk);
+    if(cmds.size() > 2) {
+      cerr << "Syntax: pdnssec rectify-all-zones [THREADS]"<<endl;
+      return 0;
+    }
+    rectifyAllZones(dk, cmds.size() == 2 ? atoi(cmds[1].c_str()) : sysconf(_SC_NPROCESSORS_ONLN));
   }
   else if(cmds[0] == "check-zone") {
     if(cmds.size() != 2) {
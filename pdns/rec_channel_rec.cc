@@ -14,6 +14,7 @@
 #include <boost/foreach.hpp>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include "logger.hh"
 #include "dnsparser.hh"
@@ -159,6 +160,156 @@ string doDumpCache(T begin, T end)
   return "dumped "+lexical_cast<string>(total)+" records\n";
 }
 
+/* Binary cache dumps start with a magic, followed by tagged entries. A 'T' with a uint32 thread id starts the entries
+   of that thread, 'R' entries are described in MemRecursorCache::doDumpBinary(), and 'N' is a negcache entry:
+   uint16 qtype, uint32 ttd, name, qname. When loading, entries dumped by thread n go to thread n % g_numThreads. */
+static const char s_binaryCacheMagic[]="PDNSRC01";
+
+static uint64_t dumpNegCacheBinary(SyncRes::negcache_t& negcache, FILE* fp, time_t now)
+{
+  typedef SyncRes::negcache_t::nth_index<1>::type sequence_t;
+  sequence_t& sidx=negcache.get<1>();
+
+  uint64_t count=0;
+  BOOST_FOREACH(const NegCacheEntry& neg, sidx)
+  {
+    if(neg.d_ttd <= (uint32_t)now)
+      continue;
+    fputc('N', fp);
+    putBinaryCacheValue(fp, neg.d_qtype.getCode());
+    putBinaryCacheValue(fp, neg.d_ttd);
+    putBinaryCacheString(fp, neg.d_name);
+    putBinaryCacheString(fp, neg.d_qname);
+    ++count;
+  }
+  return count;
+}
+
+static bool loadNegCacheBinaryEntry(SyncRes::negcache_t& negcache, const char*& ptr, const char* end, time_t now, bool keep)
+{
+  uint16_t qtype;
+  NegCacheEntry ne;
+  if(!getBinaryCacheValue(ptr, end, qtype) || !getBinaryCacheValue(ptr, end, ne.d_ttd) || 
+     !getBinaryCacheString(ptr, end, ne.d_name) || !getBinaryCacheString(ptr, end, ne.d_qname))
+    return false;
+  if(keep && ne.d_ttd > (uint32_t)now) {
+    ne.d_qtype=QType(qtype);
+    negcache.insert(ne);
+  }
+  return true;
+}
+
+static uint64_t* pleaseDumpBinary(int fd)
+{
+  FILE* fp=fdopen(dup(fd), "w");
+  if(!fp) // dup probably failed
+    return new uint64_t(0);
+
+  time_t now=time(0);
+  uint32_t id=t_id;
+  fputc('T', fp);
+  putBinaryCacheValue(fp, id);
+  uint64_t count=t_RC->doDumpBinary(fp, now) + dumpNegCacheBinary(t_sstorage->negcache, fp, now);
+  fclose(fp);
+  return new uint64_t(count);
+}
+
+static uint64_t loadCacheBinary(const std::string& fname)
+{
+  int fd=open(fname.c_str(), O_RDONLY);
+  if(fd < 0) 
+    throw AhuException("Unable to open cache dump '"+fname+"': "+stringerror());
+  struct stat st;
+  if(fstat(fd, &st) < 0 || st.st_size < (off_t)strlen(s_binaryCacheMagic)) {
+    close(fd);
+    throw AhuException("Cache dump '"+fname+"' is truncated");
+  }
+  const char* base=(const char*)mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(base==MAP_FAILED)
+    throw AhuException("Unable to map cache dump '"+fname+"': "+stringerror());
+  if(memcmp(base, s_binaryCacheMagic, strlen(s_binaryCacheMagic))) {
+    munmap((void*)base, st.st_size);
+    throw AhuException("File '"+fname+"' is not a binary cache dump");
+  }
+
+  const char* ptr=base+strlen(s_binaryCacheMagic);
+  const char* end=base+st.st_size;
+  time_t now=time(0);
+  bool mine=false, ok=true;
+  uint32_t id;
+  uint64_t before=t_RC->size() + t_sstorage->negcache.size();
+  while(ok && ptr < end) {
+    switch(*ptr++) {
+    case 'T':
+      ok=getBinaryCacheValue(ptr, end, id);
+      mine = (id % g_numThreads) == t_id;
+      break;
+    case 'R':
+      ok=t_RC->doLoadBinaryEntry(ptr, end, now, mine);
+      break;
+    case 'N':
+      ok=loadNegCacheBinaryEntry(t_sstorage->negcache, ptr, end, now, mine);
+      break;
+    default:
+      ok=false;
+    }
+  }
+  munmap((void*)base, st.st_size);
+  if(!ok)
+    L<<Logger::Warning<<"Cache dump '"<<fname<<"' is corrupt or truncated, loaded what we could"<<endl;
+  return t_RC->size() + t_sstorage->negcache.size() - before;
+}
+
+uint64_t* pleaseLoadCache(const std::string& fname)
+{
+  try {
+    return new uint64_t(loadCacheBinary(fname));
+  }
+  catch(AhuException& ae) {
+    L<<Logger::Error<<"Not loading cache: "<<ae.reason<<endl;
+  }
+  return new uint64_t(0);
+}
+
+template<typename T>
+string doDumpCacheBinary(T begin, T end)
+{
+  T i=begin;
+  string fname;
+
+  if(i!=end) 
+    fname=*i;
+
+  int fd=open(fname.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0660);
+  if(fd < 0) 
+    return "Error opening dump file for writing: "+string(strerror(errno))+"\n";
+  uint64_t total = 0;
+  if(write(fd, s_binaryCacheMagic, strlen(s_binaryCacheMagic)) != (ssize_t)strlen(s_binaryCacheMagic)) {
+    close(fd);
+    return "Error writing to dump file: "+string(strerror(errno))+"\n";
+  }
+  try {
+    total = broadcastAccFunction<uint64_t>(boost::bind(pleaseDumpBinary, fd));
+  }
+  catch(...){}
+  
+  close(fd);
+  return "dumped "+lexical_cast<string>(total)+" records\n";
+}
+
+template<typename T>
+string doLoadCache(T begin, T end)
+{
+  if(begin==end)
+    return "Need a filename to load the cache from\n";
+  if(access(begin->c_str(), R_OK) < 0)
+    return "Error opening cache dump for reading: "+string(strerror(errno))+"\n";
+
+  uint64_t total = broadcastAccFunction<uint64_t>(boost::bind(pleaseLoadCache, *begin));
+  return "loaded "+lexical_cast<string>(total)+" cache entries\n";
+}
+
 template<typename T>
 string doDumpEDNSStatus(T begin, T end)
 {
@@ -177,18 +328,27 @@ string doDumpEDNSStatus(T begin, T end)
   return "done\n";
 }
 
-uint64_t* pleaseWipeCache(const std::string& canon)
+uint64_t* pleaseWipeCache(const std::string& canon, bool subtree)
 {
   // clear packet cache too
-  return new uint64_t(t_RC->doWipeCache(canon) + t_packetCache->doWipePacketCache(canon));
+  return new uint64_t(t_RC->doWipeCache(canon, 0xffff, subtree) + t_packetCache->doWipePacketCache(canon, 0xffff, subtree));
 }
 
 
-static uint64_t* pleaseWipeAndCountNegCache(const std::string& canon)
+static uint64_t* pleaseWipeAndCountNegCache(const std::string& canon, bool subtree)
 {
-  uint64_t res = t_sstorage->negcache.count(tie(canon));
-  pair<SyncRes::negcache_t::iterator, SyncRes::negcache_t::iterator> range=t_sstorage->negcache.equal_range(tie(canon));
-  t_sstorage->negcache.erase(range.first, range.second);
+  SyncRes::negcache_t& negcache=t_sstorage->negcache;
+  pair<SyncRes::negcache_t::iterator, SyncRes::negcache_t::iterator> range;
+  if(subtree) {  // the negcache is in label order, so everything below canon follows it
+    range.first=range.second=negcache.lower_bound(tie(canon));
+    while(range.second != negcache.end() && dottedEndsOn(range.second->d_name, canon))
+      ++range.second;
+  }
+  else
+    range=negcache.equal_range(tie(canon));
+
+  uint64_t res = distance(range.first, range.second);
+  negcache.erase(range.first, range.second);
   return new uint64_t(res);
 }
 
@@ -197,9 +357,15 @@ string doWipeCache(T begin, T end)
 {
   int count=0, countNeg=0;
   for(T i=begin; i != end; ++i) {
-    string canon=toCanonic("", *i);
-    count+= broadcastAccFunction<uint64_t>(boost::bind(pleaseWipeCache, canon));
-    countNeg+=broadcastAccFunction<uint64_t>(boost::bind(pleaseWipeAndCountNegCache, canon));
+    string name=*i;
+    bool subtree=false;
+    if(ends_with(name, "$")) { // 'powerdns.com$' wipes powerdns.com and everything below it
+      subtree=true;
+      name.resize(name.size()-1);
+    }
+    string canon=toCanonic("", name);
+    count+= broadcastAccFunction<uint64_t>(boost::bind(pleaseWipeCache, canon, subtree));
+    countNeg+=broadcastAccFunction<uint64_t>(boost::bind(pleaseWipeAndCountNegCache, canon, subtree));
   }
 
   return "wiped "+lexical_cast<string>(count)+" records, "+lexical_cast<string>(countNeg)+" negative records\n";
@@ -430,6 +596,13 @@ RecursorControlParser::RecursorControlParser()
   addGetStat("resource-limits", &g_stats.resourceLimits);
   addGetStat("over-capacity-drops", &g_stats.overCapacityDrops);
   addGetStat("no-packet-error", &g_stats.noPacketError);
+  addGetStat("udp-sockets-opened", &g_stats.udpSocketsOpened);
+  addGetStat("negcache-hits", &g_stats.negCacheHits);
+  addGetStat("negcache-ancestor-hits", &g_stats.negCacheAncestorHits);
+  addGetStat("negcache-misses", &g_stats.negCacheMisses);
+  addGetStat("tcp-connections-opened", &g_stats.tcpConnectionsOpened);
+  addGetStat("tcp-connections-reused", &g_stats.tcpConnectionsReused);
+  addGetStat("tcp-queries-pipelined", &g_stats.tcpQueriesPipelined);
   addGetStat("dlg-only-drops", &SyncRes::s_nodelegated);
   addGetStat("max-mthread-stack", &g_stats.maxMThreadStackUsage);
   
@@ -448,6 +621,8 @@ RecursorControlParser::RecursorControlParser()
   addGetStat("throttled-out", &SyncRes::s_throttledqueries);
   addGetStat("unreachables", &SyncRes::s_unreachables);
   addGetStat("chain-resends", &g_stats.chainResends);
+  addGetStat("coalesced-queries", &g_stats.coalescedQueries);
+  addGetStat("coalesce-queue-full", &g_stats.coalesceQueueFull);
   addGetStat("tcp-clients", boost::bind(TCPConnection::getCurrentConnections));
 
   addGetStat("edns-ping-matches", &g_stats.ednsPingMatches);
@@ -550,17 +725,20 @@ string RecursorControlParser::getAnswer(const string& question, RecursorControlP
     return
 "current-queries                  show currently active queries\n"
 "dump-cache <filename>            dump cache contents to the named file\n"
+"dump-cache-binary <filename>     dump cache contents to the named file, in a format load-cache can read\n"
 "dump-edns[status] <filename>     dump EDNS status to the named file\n"
 "get [key1] [key2] ..             get specific statistics\n"
 "get-all                          get all statistics\n"
 "get-parameter [key1] [key2] ..   get configuration parameters\n"
 "help                             get this list\n"
+"load-cache <filename>            load a cache dumped by dump-cache-binary\n"
 "ping                             check that all threads are alive\n"
 "quit                             stop the recursor daemon\n"
 "quit-nicely                      stop the recursor daemon nicely\n"
 "reload-acls                      reload ACLS\n"
 "reload-lua-script [filename]     (re)load Lua script\n"
 "reload-zones                     reload all auth and forward zones\n"
+"thread-queries                   show how many questions each thread answered\n"
 "top-remotes                      show top remotes\n"
 "unload-lua-script                unload Lua script\n"
 "wipe-cache domain0 [domain1] ..  wipe domain data from cache\n";
@@ -588,6 +766,12 @@ string RecursorControlParser::getAnswer(const string& question, RecursorControlP
   if(cmd=="dump-cache") 
     return doDumpCache(begin, end);
 
+  if(cmd=="dump-cache-binary") 
+    return doDumpCacheBinary(begin, end);
+
+  if(cmd=="load-cache") 
+    return doLoadCache(begin, end);
+
   if(cmd=="dump-ednsstatus" || cmd=="dump-edns") 
     return doDumpEDNSStatus(begin, end);
 
@@ -626,6 +810,9 @@ string RecursorControlParser::getAnswer(const string& question, RecursorControlP
 
   if(cmd=="current-queries")
     return doCurrentQueries();
+
+  if(cmd=="thread-queries")
+    return broadcastAccFunction<string>(pleaseGetThreadQueries);
   
   if(cmd=="ping") {
     return broadcastAccFunction<string>(nopFunction);
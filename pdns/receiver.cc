@@ -559,8 +559,11 @@ int main(int argc, char **argv)
     DynListener::registerFunc("VERSION",&DLVersionHandler, "get instance version");
     DynListener::registerFunc("PURGE",&DLPurgeHandler, "purge entries from packet cache", "[<record>]");
     DynListener::registerFunc("CCOUNTS",&DLCCHandler, "get cache statistics");
+    DynListener::registerFunc("DUMP-CACHE",&DLDumpCacheHandler, "write a snapshot of the packet and query cache", "[<filename>]");
     DynListener::registerFunc("SET",&DLSettingsHandler, "set config variables", "<var> <value>");
     DynListener::registerFunc("RETRIEVE",&DLNotifyRetrieveHandler, "retrieve slave domain", "<domain>");
+    DynListener::registerFunc("XFR-STATUS",&DLTransferStatusHandler, "show queued and active zone transfers, or the timings of the last transfer of a domain");
+    DynListener::registerFunc("BACKEND-LATENCY",&DLBackendLatencyHandler, "show how long each backend takes to answer");
 
     if(!::arg()["tcp-control-address"].empty()) {
       DynListener* dlTCP=new DynListener(ComboAddress(::arg()["tcp-control-address"], ::arg().asNum("tcp-control-port")));
@@ -3,6 +3,7 @@
 #include "recpacketcache.hh"
 #include "cachecleaner.hh"
 #include "dns.hh"
+#include "dnsparser.hh"
 #include "namespaces.hh"
 #include "lock.hh"
 
@@ -12,7 +13,7 @@ RecursorPacketCache::RecursorPacketCache()
   d_hits = d_misses = 0;
 }
 
-int RecursorPacketCache::doWipePacketCache(const string& name, uint16_t qtype)
+int RecursorPacketCache::doWipePacketCache(const string& name, uint16_t qtype, bool subtree)
 {
   int count=0;
   for(packetCache_t::iterator iter = d_packetCache.begin(); iter != d_packetCache.end();)
@@ -24,7 +25,7 @@ int RecursorPacketCache::doWipePacketCache(const string& name, uint16_t qtype)
 	const struct dnsrecordheader *header = reinterpret_cast<const struct dnsrecordheader*>((*iter).d_packet.c_str()+sizeof(struct dnsheader));
 	uint16_t type = header->d_type;
 	std::string domain=questionExpand((*iter).d_packet.c_str(), (*iter).d_packet.size(), type); 	
-	if (pdns_iequals(name,domain)) 
+	if (subtree ? dottedEndsOn(domain, name) : pdns_iequals(name,domain)) 
 	{ 
   	  iter = d_packetCache.erase(iter);
 	  count++;
@@ -34,13 +35,20 @@ int RecursorPacketCache::doWipePacketCache(const string& name, uint16_t qtype)
   return count;
 }
 
-bool RecursorPacketCache::getResponsePacket(const std::string& queryPacket, time_t now, 
-  std::string* responsePacket, uint32_t* age)
+/* this is the hot path for packet cache hits, so it works on the query as received and does not allocate: responsePacket
+   is meant to be reused, and gets the cached packet with the id of the query and the TTLs lowered by the age of the entry */
+bool RecursorPacketCache::getResponsePacket(const char* queryPacket, unsigned int queryLen, time_t now, 
+  std::string* responsePacket)
 {
-  struct Entry e;
-  e.d_packet=queryPacket;
+  if(queryLen < sizeof(struct dnsheader)) {
+    d_misses++;
+    return false;
+  }
+  QueryKey key;
+  key.d_packet=queryPacket;
+  key.d_len=queryLen;
   
-  packetCache_t::const_iterator iter = d_packetCache.find(e);
+  packetCache_t::const_iterator iter = d_packetCache.find(key, QueryKeyCompare());
   
   if(iter == d_packetCache.end()) {
     d_misses++;
@@ -49,11 +57,18 @@ bool RecursorPacketCache::getResponsePacket(const std::string& queryPacket, time
     
   if((uint32_t)now < iter->d_ttd) { // it is fresh!
 //    cerr<<"Fresh for another "<<iter->d_ttd - now<<" seconds!"<<endl;
-    *age = now - iter->d_creation;
-    uint16_t id;
-    memcpy(&id, queryPacket.c_str(), 2); 
-    *responsePacket = iter->d_packet;
-    responsePacket->replace(0, 2, (char*)&id, 2);
+    uint32_t age = now - iter->d_creation;
+    responsePacket->assign(iter->d_packet.c_str(), iter->d_packet.length()); // a copy into the buffer we have, never a shared one
+    char* response = &(*responsePacket)[0];
+    memcpy(response, queryPacket, 2); // id
+    if(age) {
+      uint32_t ttl;
+      BOOST_FOREACH(uint16_t offset, iter->d_ttlOffsets) {
+        memcpy(&ttl, response + offset, sizeof(ttl));
+        ttl = htonl(ntohl(ttl) - age);
+        memcpy(response + offset, &ttl, sizeof(ttl));
+      }
+    }
     d_hits++;
     moveCacheItemToBack(d_packetCache, iter);
 
@@ -74,11 +89,14 @@ void RecursorPacketCache::insertResponsePacket(const std::string& responsePacket
   
   if(iter != d_packetCache.end()) {
     iter->d_packet = responsePacket;
+    getDNSPacketTTLOffsets(iter->d_packet, iter->d_ttlOffsets);
     iter->d_ttd = now + ttl;
     iter->d_creation = now;
   }
-  else 
+  else {
+    getDNSPacketTTLOffsets(e.d_packet, e.d_ttlOffsets);
     d_packetCache.insert(e);
+  }
 }
 
 uint64_t RecursorPacketCache::size()
@@ -90,7 +108,7 @@ uint64_t RecursorPacketCache::bytes()
 {
   uint64_t sum=0;
   BOOST_FOREACH(const struct Entry& e, d_packetCache) {
-    sum += sizeof(e) + e.d_packet.length() + 4;
+    sum += sizeof(e) + e.d_packet.length() + 4 + e.d_ttlOffsets.size() * sizeof(uint16_t);
   }
   return sum;
 }
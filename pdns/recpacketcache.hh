@@ -2,6 +2,7 @@
 #define PDNS_RECPACKETCACHE_HH
 #include <string>
 #include <set>
+#include <vector>
 #include <inttypes.h>
 #include "dns.hh"
 #include "namespaces.hh"
@@ -19,10 +20,10 @@ class RecursorPacketCache
 {
 public:
   RecursorPacketCache();
-  bool getResponsePacket(const std::string& queryPacket, time_t now, std::string* responsePacket, uint32_t* age);
+  bool getResponsePacket(const char* queryPacket, unsigned int queryLen, time_t now, std::string* responsePacket);
   void insertResponsePacket(const std::string& responsePacket, time_t now, uint32_t ttd);
   void doPruneTo(unsigned int maxSize=250000);
-  int doWipePacketCache(const string& name, uint16_t qtype=0xffff);
+  int doWipePacketCache(const string& name, uint16_t qtype=0xffff, bool subtree=false);
   
   void prune();
   uint64_t d_hits, d_misses;
@@ -36,6 +37,7 @@ private:
     mutable uint32_t d_ttd;
     mutable uint32_t d_creation;
     mutable std::string d_packet; // "I know what I am doing"
+    mutable std::vector<uint16_t> d_ttlOffsets; //!< where the TTLs are in d_packet, for aging it without parsing
 
     inline bool operator<(const struct Entry& rhs) const;
     
@@ -44,6 +46,27 @@ private:
       return d_ttd;
     }
   };
+
+  //! a query as it came in, so we can look it up without copying it into an Entry
+  struct QueryKey
+  {
+    const char* d_packet;
+    unsigned int d_len;
+  };
+
+  struct QueryKeyCompare
+  {
+    bool operator()(const QueryKey& a, const Entry& b) const
+    {
+      return packetLessThan(a.d_packet, a.d_len, b.d_packet.c_str(), b.d_packet.length());
+    }
+    bool operator()(const Entry& a, const QueryKey& b) const
+    {
+      return packetLessThan(a.d_packet.c_str(), a.d_packet.length(), b.d_packet, b.d_len);
+    }
+  };
+
+  static inline bool packetLessThan(const char* a, unsigned int alen, const char* b, unsigned int blen);
  
   typedef multi_index_container<
     Entry,
@@ -57,16 +80,21 @@ private:
 };
 
 // needs to take into account: qname, qtype, opcode, rd, qdcount, EDNS size
-inline bool RecursorPacketCache::Entry::operator<(const struct RecursorPacketCache::Entry &rhs) const
+inline bool RecursorPacketCache::packetLessThan(const char* a, unsigned int alen, const char* b, unsigned int blen)
 {
   const struct dnsheader* 
-    dh=(const struct dnsheader*) d_packet.c_str(), 
-    *rhsdh=(const struct dnsheader*)rhs.d_packet.c_str();
+    dh=(const struct dnsheader*) a, 
+    *rhsdh=(const struct dnsheader*) b;
   if(make_tuple(dh->opcode, dh->rd, dh->qdcount) < 
      make_tuple(rhsdh->opcode, rhsdh->rd, rhsdh->qdcount))
     return true;
 
-  return dnspacketLessThan(d_packet, rhs.d_packet);
+  return dnspacketLessThan(a, alen, b, blen);
+}
+
+inline bool RecursorPacketCache::Entry::operator<(const struct RecursorPacketCache::Entry &rhs) const
+{
+  return packetLessThan(d_packet.c_str(), d_packet.length(), rhs.d_packet.c_str(), rhs.d_packet.length());
 }
 
 
@@ -86,25 +86,220 @@ string DNSRR2String(const DNSResourceRecord& rr)
   }
 }
 
+MemRecursorCache::SharedName::SharedName(const string& wire, uint64_t* bytes)
+{
+  d_rep=(Rep*)new char[offsetof(Rep, data) + wire.size()]; // new[] is aligned for any type, and counted by speedtest
+  d_rep->bytes=bytes;
+  d_rep->refs=1;
+  d_rep->len=wire.size();
+  memcpy(d_rep->data, wire.c_str(), wire.size());
+  *bytes+=offsetof(Rep, data) + d_rep->len;
+}
+
+MemRecursorCache::SharedName::~SharedName()
+{
+  if(!--d_rep->refs) {
+    *d_rep->bytes-=offsetof(Rep, data) + d_rep->len;
+    delete[] (char*)d_rep;
+  }
+}
+
+MemRecursorCache::RecordBlob::RecordBlob(const RecordBlob& rhs) : d_data(0)
+{
+  if(rhs.d_data) {
+    d_data=new char[rhs.bytes()];
+    memcpy(d_data, rhs.d_data, rhs.bytes());
+  }
+}
+
+void MemRecursorCache::RecordBlob::pack(const vector<StoredRecord>& records)
+{
+  delete[] d_data;
+  d_data=0;
+  if(records.empty())
+    return;
+
+  uint32_t len=sizeof(uint32_t);
+  for(vector<StoredRecord>::const_iterator i=records.begin(); i != records.end(); ++i)
+    len+=6 + i->d_string.size();
+  d_data=new char[len];
+  memcpy(d_data, &len, sizeof(len));
+
+  char* pos=d_data + sizeof(len);
+  for(vector<StoredRecord>::const_iterator i=records.begin(); i != records.end(); ++i) {
+    uint16_t rlen=i->d_string.size();
+    memcpy(pos, &i->d_ttd, 4);
+    memcpy(pos+4, &rlen, 2);
+    memcpy(pos+6, i->d_string.c_str(), rlen);
+    pos+=6 + rlen;
+  }
+}
+
+void MemRecursorCache::RecordBlob::unpack(vector<StoredRecord>& records) const
+{
+  records.clear();
+  StoredRecord sr;
+  for(const char* i=first(); i; i=next(i)) {
+    sr.d_ttd=getTTD(i);
+    sr.d_string.assign(getData(i), getLength(i));
+    records.push_back(sr);
+  }
+}
+
+void MemRecursorCache::RecordBlob::setTTDs(uint32_t ttd)
+{
+  for(const char* i=first(); i; i=next(i))
+    memcpy(const_cast<char*>(i), &ttd, sizeof(ttd));
+}
+
+//! the earliest ttd of the records
+uint32_t MemRecursorCache::RecordBlob::getTTD() const
+{
+  uint32_t earliest=std::numeric_limits<uint32_t>::max();
+  for(const char* i=first(); i; i=next(i))
+    earliest=min(earliest, getTTD(i));
+  return earliest;
+}
+
+MemRecursorCache::CacheEntry::CacheEntry(const CacheEntry& rhs) : d_qname(rhs.d_qname), d_qtype(rhs.d_qtype), d_auth(rhs.d_auth),
+                                                                  d_records(rhs.d_records), d_scoped(0)
+{
+  if(rhs.d_scoped)
+    d_scoped=new scoped_t(*rhs.d_scoped);
+  *d_qname.bytesCounter()+=heapBytes();
+}
+
+MemRecursorCache::CacheEntry& MemRecursorCache::CacheEntry::operator=(const CacheEntry& rhs)
+{
+  CacheEntry tmp(rhs); // both of us are counted already, so we can simply trade contents
+  std::swap(d_qname, tmp.d_qname);
+  d_qtype=tmp.d_qtype;
+  d_auth=tmp.d_auth;
+  std::swap(d_records, tmp.d_records);
+  std::swap(d_scoped, tmp.d_scoped);
+  return *this;
+}
+
+MemRecursorCache::CacheEntry::~CacheEntry()
+{
+  *d_qname.bytesCounter()-=heapBytes();
+  delete d_scoped;
+}
+
+void MemRecursorCache::CacheEntry::setRecords(const vector<StoredRecord>& records)
+{
+  *d_qname.bytesCounter()-=d_records.bytes();
+  d_records.pack(records);
+  *d_qname.bytesCounter()+=d_records.bytes();
+}
+
+void MemRecursorCache::CacheEntry::setScoped(scoped_t& scoped)
+{
+  unsigned int before=heapBytes();
+  if(scoped.empty()) {
+    delete d_scoped;
+    d_scoped=0;
+  }
+  else {
+    if(!d_scoped)
+      d_scoped=new scoped_t;
+    d_scoped->swap(scoped);
+  }
+  *d_qname.bytesCounter()+=heapBytes();
+  *d_qname.bytesCounter()-=before;
+}
+
+//! what this entry allocated, except its name which is shared
+unsigned int MemRecursorCache::CacheEntry::heapBytes() const
+{
+  unsigned int ret=d_records.bytes();
+  if(d_scoped) {
+    ret+=sizeof(scoped_t) + d_scoped->capacity() * sizeof(scoped_t::value_type);
+    for(scoped_t::const_iterator i=d_scoped->begin(); i != d_scoped->end(); ++i)
+      ret+=i->second.bytes();
+  }
+  return ret;
+}
+
+//! 'www.PowerDNS.com.' is looked up as '\3www\10powerdns\3com\0', the trailing dot is optional
+void MemRecursorCache::setLookupName(const string& qname)
+{
+  d_lookupName.clear();
+  string::size_type pos=0, end;
+  while(pos < qname.size()) {
+    end=qname.find('.', pos);
+    if(end == string::npos)
+      end=qname.size();
+    if(end > pos) {
+      d_lookupName.append(1, (char)(end-pos));
+      for(; pos < end; ++pos)
+        d_lookupName.append(1, dns_tolower(qname[pos]));
+    }
+    pos=end+1;
+  }
+  d_lookupName.append(1, (char)0);
+}
+
+//! d_lookupName as a SharedName, which shares storage with the other types we have for it
+MemRecursorCache::SharedName MemRecursorCache::getSharedName()
+{
+  cache_t::iterator i=d_cache.lower_bound(tie(d_lookupName));
+  if(i != d_cache.end() && !NameCompare()(d_lookupName, i->d_qname)) // lower_bound, so it is not smaller
+    return i->d_qname;
+  return SharedName(d_lookupName, &d_bytes);
+}
+
+static string wireToName(const char* wire)
+{
+  string ret;
+  for(unsigned char len; (len=*wire); wire+=len+1) {
+    ret.append(wire+1, len);
+    ret.append(1, '.');
+  }
+  if(ret.empty())
+    ret=".";
+  return ret;
+}
+
+//! is the lowercase wire format name equal to or below suffix, which is lowercase wire format too
+static bool wireEndsOn(const char* wire, unsigned int len, const string& suffix)
+{
+  for(unsigned int pos=0; pos < len; pos+=1 + (unsigned char)wire[pos]) {
+    if(len - pos == suffix.size() && !memcmp(wire+pos, suffix.c_str(), suffix.size()))
+      return true;
+  }
+  return false;
+}
+
 unsigned int MemRecursorCache::size()
 {
   return (unsigned int)d_cache.size();
 }
 
-unsigned int MemRecursorCache::bytes()
+/* everything the cache allocated: the names, records and subnet answers counted in d_bytes, plus an entry and the pointers
+   of our two indexes per entry. Only the overhead of the allocator itself is not in here */
+uint64_t MemRecursorCache::bytes()
 {
-  unsigned int ret=0;
+  return d_bytes + (uint64_t)d_cache.size() * (sizeof(CacheEntry) + 5*sizeof(void*));
+}
 
-  for(cache_t::const_iterator i=d_cache.begin(); i!=d_cache.end(); ++i) {
-    ret+=sizeof(struct CacheEntry);
-    ret+=(unsigned int)i->d_qname.length();
-    for(vector<StoredRecord>::const_iterator j=i->d_records.begin(); j!= i->d_records.end(); ++j)
-      ret+=j->size();
+//! the records for who: from the most specific subnet that contains it, or those valid for everybody
+const MemRecursorCache::CacheEntry::records_t& MemRecursorCache::CacheEntry::getRecords(const ComboAddress* who, bool* wasScoped) const
+{
+  if(who && d_scoped) {
+    for(scoped_t::const_iterator i=d_scoped->begin(); i != d_scoped->end(); ++i) {
+      if(i->first.match(who)) {
+        if(wasScoped)
+          *wasScoped=true;
+        return i->second;
+      }
+    }
   }
-  return ret;
+  return d_records;
 }
 
-int MemRecursorCache::get(time_t now, const string &qname, const QType& qt, set<DNSResourceRecord>* res)
+// who is the client we are resolving for, if it might get an answer for its subnet. wasScoped is set if it did
+int MemRecursorCache::get(time_t now, const string &qname, const QType& qt, set<DNSResourceRecord>* res, const ComboAddress* who, bool* wasScoped)
 {
   unsigned int ttd=0;
   //  cerr<<"looking up "<< qname+"|"+qt.getName()<<"\n";
@@ -112,7 +307,8 @@ int MemRecursorCache::get(time_t now, const string &qname, const QType& qt, set<
   if(!d_cachecachevalid || !pdns_iequals(d_cachedqname, qname)) {
     //    cerr<<"had cache cache miss"<<endl;
     d_cachedqname=qname;
-    d_cachecache=d_cache.equal_range(tie(qname));
+    setLookupName(qname);
+    d_cachecache=d_cache.equal_range(tie(d_lookupName));
     d_cachecachevalid=true;
   }
   else
@@ -123,15 +319,19 @@ int MemRecursorCache::get(time_t now, const string &qname, const QType& qt, set<
     res->clear();
 
   if(d_cachecache.first!=d_cachecache.second) { 
+    string serial;
     for(cache_t::const_iterator i=d_cachecache.first; i != d_cachecache.second; ++i) 
       if(i->d_qtype == qt.getCode() || qt.getCode()==QType::ANY || 
          (qt.getCode()==QType::ADDR && (i->d_qtype == QType::A || i->d_qtype == QType::AAAA) )
          ) {     
-        for(vector<StoredRecord>::const_iterator k=i->d_records.begin(); k != i->d_records.end(); ++k) {
-          if(k->d_ttd < 1000000000 || k->d_ttd > (uint32_t) now) {  // FIXME what does the 100000000 number mean?
-            ttd=k->d_ttd;
+        const CacheEntry::records_t& records=i->getRecords(who, wasScoped);
+        for(const char* k=records.first(); k; k=records.next(k)) {
+          uint32_t kttd=RecordBlob::getTTD(k);
+          if(kttd < 1000000000 || kttd > (uint32_t) now) {  // FIXME what does the 100000000 number mean?
+            ttd=kttd;
             if(res) {
-              DNSResourceRecord rr=String2DNSRR(qname, QType(i->d_qtype),  k->d_string, ttd); 
+              serial.assign(RecordBlob::getData(k), RecordBlob::getLength(k));
+              DNSResourceRecord rr=String2DNSRR(qname, QType(i->d_qtype), serial, ttd); 
               res->insert(rr);
             }
           }
@@ -152,11 +352,10 @@ int MemRecursorCache::get(time_t now, const string &qname, const QType& qt, set<
   return -1;
 }
 
-
  
-bool MemRecursorCache::attemptToRefreshNSTTL(const QType& qt, const set<DNSResourceRecord>& content, const CacheEntry& stored)
+bool MemRecursorCache::attemptToRefreshNSTTL(const QType& qt, const set<DNSResourceRecord>& content, bool auth, const vector<StoredRecord>& records)
 {
-  if(!stored.d_auth) {
+  if(!auth) {
     //~ cerr<<"feel free to scribble non-auth data!"<<endl;
     return false;
   }
@@ -165,14 +364,14 @@ bool MemRecursorCache::attemptToRefreshNSTTL(const QType& qt, const set<DNSResou
     //~ cerr<<"Not NS record"<<endl;
     return false;
   }
-  if(content.size()!=stored.d_records.size()) {
+  if(content.size()!=records.size()) {
     //~ cerr<<"Not equal number of records"<<endl;
     return false;
   }
-  if(stored.d_records.empty())
+  if(records.empty())
     return false;
 
-  if(stored.d_records.begin()->d_ttd > content.begin()->ttl) {
+  if(records.begin()->d_ttd > content.begin()->ttl) {
     //~ cerr<<"attempt to LOWER TTL - fine by us"<<endl;
     return false;
   }
@@ -185,35 +384,43 @@ bool MemRecursorCache::attemptToRefreshNSTTL(const QType& qt, const set<DNSResou
 /* the code below is rather tricky - it basically replaces the stuff cached for qname by content, but it is special
    cased for when inserting identical records with only differing ttls, in which case the entry is not
    touched, but only given a new ttd */
-void MemRecursorCache::replace(time_t now, const string &qname, const QType& qt,  const set<DNSResourceRecord>& content, bool auth)
+void MemRecursorCache::replace(time_t now, const string &qname, const QType& qt,  const set<DNSResourceRecord>& content, bool auth, const Netmask* scope)
 {
   d_cachecachevalid=false;
-  tuple<string, uint16_t> key=make_tuple(qname, qt.getCode());
-  cache_t::iterator stored=d_cache.find(key);
+  setLookupName(qname);
+  uint16_t qtype=qt.getCode();
+  cache_t::iterator stored=d_cache.find(tie(d_lookupName, qtype));
 
   bool isNew=false;
   if(stored == d_cache.end()) {
-    stored=d_cache.insert(CacheEntry(key,vector<StoredRecord>(), auth)).first;
+    stored=d_cache.insert(CacheEntry(getSharedName(), qtype, auth)).first;
     isNew=true;
   }
+
+  if(scope) {
+    replaceScoped(now, stored, content, *scope);
+    return;
+  }
   pair<vector<StoredRecord>::iterator, vector<StoredRecord>::iterator> range;
 
   StoredRecord dr;
   CacheEntry ce=*stored;
+  vector<StoredRecord> records;
+  ce.d_records.unpack(records);
 
   //~ cerr<<"asked to store "<< qname+"|"+qt.getName()<<" -> '"<<content.begin()->content<<"', isnew="<<isNew<<", auth="<<auth<<", ce.auth="<<ce.d_auth<<"\n";
 
   if(qt.getCode()==QType::SOA || qt.getCode()==QType::CNAME)  { // you can only have one (1) each of these
     //    cerr<<"\tCleaning out existing store because of SOA and CNAME\n";
-    ce.d_records.clear();
+    records.clear();
   }
 
   if(!auth && ce.d_auth) {  // unauth data came in, we have some auth data, but is it fresh?
     vector<StoredRecord>::iterator j;
-    for(j = ce.d_records.begin() ; j != ce.d_records.end(); ++j) 
+    for(j = records.begin() ; j != records.end(); ++j) 
       if((time_t)j->d_ttd > now) 
         break;
-    if(j != ce.d_records.end()) { // we still have valid data, ignore unauth data
+    if(j != records.end()) { // we still have valid data, ignore unauth data
       //      cerr<<"\tStill hold valid auth data, and the new data is unauth, return\n";
       return;
     }
@@ -223,9 +430,9 @@ void MemRecursorCache::replace(time_t now, const string &qname, const QType& qt,
   }
   
   // make sure that we CAN refresh the root
-  if(auth && ((qname.length()==1 && qname[0]=='.') || !attemptToRefreshNSTTL(qt, content, ce) ) ) {
+  if(auth && ((qname.length()==1 && qname[0]=='.') || !attemptToRefreshNSTTL(qt, content, ce.d_auth, records) ) ) {
     // cerr<<"\tGot auth data, and it was not refresh attempt of an NS record, nuking storage"<<endl;
-    ce.d_records.clear(); // clear non-auth data
+    records.clear(); // clear non-auth data
     ce.d_auth = true;
     isNew=true;           // data should be sorted again
   }
@@ -239,9 +446,9 @@ void MemRecursorCache::replace(time_t now, const string &qname, const QType& qt,
     dr.d_string=DNSRR2String(*i);
     
     if(isNew) 
-      ce.d_records.push_back(dr);
+      records.push_back(dr);
     else {
-      range=equal_range(ce.d_records.begin(), ce.d_records.end(), dr);
+      range=equal_range(records.begin(), records.end(), dr);
 
       if(range.first != range.second) {
        // cerr<<"\t\tMay need to modify TTL of stored record\n";
@@ -262,32 +469,77 @@ void MemRecursorCache::replace(time_t now, const string &qname, const QType& qt,
       }
       else {
         //~ cerr<<"\t\tThere was no exact copy of this record, so adding & sorting\n";
-        ce.d_records.push_back(dr);
-        sort(ce.d_records.begin(), ce.d_records.end());
+        records.push_back(dr);
+        sort(records.begin(), records.end());
       }
     }
   }
 
   if(isNew) {
     //    cerr<<"\tSorting (because of isNew)\n";
-    sort(ce.d_records.begin(), ce.d_records.end());
+    sort(records.begin(), records.end());
   }
   
-  if(ce.d_records.capacity() != ce.d_records.size())
-    vector<StoredRecord>(ce.d_records).swap(ce.d_records);
-  
+  ce.setRecords(records);
+  d_cache.replace(stored, ce);
+}
+
+/* an answer that is only valid for clients within scope replaces the one we had for that exact subnet. Subnets with
+   only stale records go at the same time, the entry itself is pruned as usual */
+void MemRecursorCache::replaceScoped(time_t now, cache_t::iterator stored, const set<DNSResourceRecord>& content, const Netmask& scope)
+{
+  CacheEntry ce=*stored;
+
+  vector<StoredRecord> records;
+  StoredRecord dr;
+  for(set<DNSResourceRecord>::const_iterator i=content.begin(); i != content.end(); ++i) {
+    dr.d_ttd=i->ttl;
+    dr.d_string=DNSRR2String(*i);
+    records.push_back(dr);
+  }
+  sort(records.begin(), records.end());
+
+  CacheEntry::scoped_t scoped;
+  if(ce.d_scoped) {
+    for(CacheEntry::scoped_t::const_iterator i=ce.d_scoped->begin(); i != ce.d_scoped->end(); ++i) {
+      if(!(i->first.getBits() == scope.getBits() && i->first.match(scope.getNetwork())) && i->second.getTTD() > (uint32_t)now)
+        scoped.push_back(*i);
+    }
+  }
+
+  CacheEntry::scoped_t::iterator pos=scoped.begin();
+  while(pos != scoped.end() && pos->first.getBits() >= scope.getBits())
+    ++pos;
+  pos=scoped.insert(pos, make_pair(scope, CacheEntry::records_t()));
+  pos->second.pack(records);
+
+  ce.setScoped(scoped);
   d_cache.replace(stored, ce);
 }
 
-int MemRecursorCache::doWipeCache(const string& name, uint16_t qtype)
+// with 'subtree', wipes name and everything below it regardless of qtype, which needs a full scan
+int MemRecursorCache::doWipeCache(const string& name, uint16_t qtype, bool subtree)
 {
   int count=0;
   d_cachecachevalid=false;
+  setLookupName(name);
+  if(subtree) {
+    for(cache_t::iterator i=d_cache.begin(); i != d_cache.end(); ) {
+      if(wireEndsOn(i->d_qname.data(), i->d_qname.size(), d_lookupName)) {
+        count++;
+        d_cache.erase(i++);
+      }
+      else
+        ++i;
+    }
+    return count;
+  }
+
   pair<cache_t::iterator, cache_t::iterator> range;
   if(qtype==0xffff)
-    range=d_cache.equal_range(tie(name));
+    range=d_cache.equal_range(tie(d_lookupName));
   else
-    range=d_cache.equal_range(tie(name, qtype));
+    range=d_cache.equal_range(tie(d_lookupName, qtype));
 
   for(cache_t::const_iterator i=range.first; i != range.second; ) {
     count++;
@@ -298,7 +550,8 @@ int MemRecursorCache::doWipeCache(const string& name, uint16_t qtype)
 
 bool MemRecursorCache::doAgeCache(time_t now, const string& name, uint16_t qtype, int32_t newTTL)
 {
-  cache_t::iterator iter = d_cache.find(tie(name, qtype));
+  setLookupName(name);
+  cache_t::iterator iter = d_cache.find(tie(d_lookupName, qtype));
   if(iter == d_cache.end()) 
     return false;
 
@@ -313,9 +566,7 @@ bool MemRecursorCache::doAgeCache(time_t now, const string& name, uint16_t qtype
     uint32_t newTTD = now + ttl;
     
     CacheEntry ce = *iter;
-    for(vector<StoredRecord>::iterator j = ce.d_records.begin() ; j != ce.d_records.end(); ++j)  {
-      j->d_ttd = newTTD;
-    }
+    ce.d_records.setTTDs(newTTD);
     
     d_cache.replace(iter, ce);
     return true;
@@ -337,14 +588,15 @@ uint64_t MemRecursorCache::doDump(int fd)
   uint64_t count=0;
   time_t now=time(0);
   for(sequence_t::const_iterator i=sidx.begin(); i != sidx.end(); ++i) {
-    for(vector<StoredRecord>::const_iterator j=i->d_records.begin(); j != i->d_records.end(); ++j) {
+    string qname=wireToName(i->d_qname.data());
+    for(const char* j=i->d_records.first(); j; j=i->d_records.next(j)) {
       count++;
       try {
-        DNSResourceRecord rr=String2DNSRR(i->d_qname, QType(i->d_qtype), j->d_string, j->d_ttd - now);
+        DNSResourceRecord rr=String2DNSRR(qname, QType(i->d_qtype), string(RecordBlob::getData(j), RecordBlob::getLength(j)), RecordBlob::getTTD(j) - now);
         fprintf(fp, "%s %d IN %s %s\n", rr.qname.c_str(), rr.ttl, rr.qtype.getName().c_str(), rr.content.c_str());
       }
       catch(...) {
-        fprintf(fp, "; error printing '%s'\n", i->d_qname.c_str());
+        fprintf(fp, "; error printing '%s'\n", qname.c_str());
       }
     }
   }
@@ -352,6 +604,86 @@ uint64_t MemRecursorCache::doDump(int fd)
   return count;
 }
 
+bool getBinaryCacheString(const char*& ptr, const char* end, string& str)
+{
+  uint16_t len;
+  if(!getBinaryCacheValue(ptr, end, len) || end-ptr < len)
+    return false;
+  str.assign(ptr, len);
+  ptr+=len;
+  return true;
+}
+
+void putBinaryCacheString(FILE* fp, const string& str)
+{
+  uint16_t len=str.length();
+  putBinaryCacheValue(fp, len);
+  fwrite(str.c_str(), 1, len, fp);
+}
+
+/* per entry: 'R', uint16 qtype, uint8 auth, qname, uint16 record count, and per record uint32 ttd plus the stored rdata.
+   TTDs are absolute, so entries that expire while we are down are simply not loaded back. */
+uint64_t MemRecursorCache::doDumpBinary(FILE* fp, time_t now)
+{
+  typedef cache_t::nth_index<1>::type sequence_t;
+  sequence_t& sidx=d_cache.get<1>();
+
+  uint64_t count=0;
+  vector<const char*> live;
+  for(sequence_t::const_iterator i=sidx.begin(); i != sidx.end(); ++i) {
+    live.clear();
+    for(const char* j=i->d_records.first(); j; j=i->d_records.next(j))
+      if(RecordBlob::getTTD(j) < 1000000000 || RecordBlob::getTTD(j) > (uint32_t) now)  // same rule as in get()
+        live.push_back(j);
+    if(live.empty())
+      continue;
+
+    fputc('R', fp);
+    putBinaryCacheValue(fp, i->d_qtype);
+    putBinaryCacheValue(fp, (uint8_t)i->d_auth);
+    putBinaryCacheString(fp, wireToName(i->d_qname.data()));
+    putBinaryCacheValue(fp, (uint16_t)live.size());
+    for(vector<const char*>::const_iterator j=live.begin(); j != live.end(); ++j) {
+      putBinaryCacheValue(fp, RecordBlob::getTTD(*j));
+      putBinaryCacheString(fp, string(RecordBlob::getData(*j), RecordBlob::getLength(*j)));
+      count++;
+    }
+  }
+  return count;
+}
+
+//! reads the entry after the 'R' at ptr, and stores it if 'keep' is set and we don't have anything for it already. Returns false on truncation
+bool MemRecursorCache::doLoadBinaryEntry(const char*& ptr, const char* end, time_t now, bool keep)
+{
+  uint16_t qtype, count;
+  uint8_t auth;
+  string qname;
+  if(!getBinaryCacheValue(ptr, end, qtype) || !getBinaryCacheValue(ptr, end, auth) || 
+     !getBinaryCacheString(ptr, end, qname) || !getBinaryCacheValue(ptr, end, count))
+    return false;
+
+  vector<StoredRecord> records;
+  StoredRecord sr;
+  for(uint16_t n=0; n < count; ++n) {
+    if(!getBinaryCacheValue(ptr, end, sr.d_ttd) || !getBinaryCacheString(ptr, end, sr.d_string))
+      return false;
+    if(keep && (sr.d_ttd < 1000000000 || sr.d_ttd > (uint32_t) now))
+      records.push_back(sr);
+  }
+  if(records.empty())
+    return true;
+
+  d_cachecachevalid=false;
+  setLookupName(qname);
+  if(d_cache.find(tie(d_lookupName, qtype)) == d_cache.end()) {
+    sort(records.begin(), records.end());
+    CacheEntry ce(getSharedName(), qtype, auth);
+    ce.setRecords(records);
+    d_cache.insert(ce);
+  }
+  return true;
+}
+
 void MemRecursorCache::doPrune(void)
 {
   d_cachecachevalid=false;
@@ -5,6 +5,7 @@
 #include "dns.hh"
 #include "qtype.hh"
 #include "misc.hh"
+#include "iputils.hh"
 #include <iostream>
 
 #include <boost/utility.hpp>
@@ -25,28 +26,31 @@ using namespace ::boost::multi_index;
 class MemRecursorCache : public boost::noncopyable //  : public RecursorCache
 {
 public:
-  MemRecursorCache() : d_followRFC2181(false), d_cachecachevalid(false)
+  MemRecursorCache() : d_followRFC2181(false), d_bytes(0), d_cachecachevalid(false)
   {
     cacheHits = cacheMisses = 0;
   }
   unsigned int size();
-  unsigned int bytes();
-  int get(time_t, const string &qname, const QType& qt, set<DNSResourceRecord>* res);
+  uint64_t bytes();
+  int get(time_t, const string &qname, const QType& qt, set<DNSResourceRecord>* res, const ComboAddress* who=0, bool* wasScoped=0);
 
   int getDirect(time_t now, const char* qname, const QType& qt, uint32_t ttd[10], char* data[10], uint16_t len[10]);
-  void replace(time_t, const string &qname, const QType& qt,  const set<DNSResourceRecord>& content, bool auth);
+  void replace(time_t, const string &qname, const QType& qt,  const set<DNSResourceRecord>& content, bool auth, const Netmask* scope=0);
   void doPrune(void);
   void doSlash(int perc);
   uint64_t doDump(int fd);
-  int doWipeCache(const string& name, uint16_t qtype=0xffff);
+  uint64_t doDumpBinary(FILE* fp, time_t now);
+  bool doLoadBinaryEntry(const char*& ptr, const char* end, time_t now, bool keep);
+  int doWipeCache(const string& name, uint16_t qtype=0xffff, bool subtree=false);
   bool doAgeCache(time_t now, const string& name, uint16_t qtype, int32_t newTTL);
   uint64_t cacheHits, cacheMisses;
   bool d_followRFC2181;
 
 private:
+  //! a record while we work on an RRset, they are stored packed in a RecordBlob
   struct StoredRecord
   {
-    mutable uint32_t d_ttd;
+    uint32_t d_ttd;
 
     string d_string;
 
@@ -54,37 +58,167 @@ private:
     {
       return d_string < rhs.d_string;
     }
+  };
+
+  //! lowercase wire format name, shared by the entries for the different types of one name
+  class SharedName
+  {
+  public:
+    SharedName(const string& wire, uint64_t* bytes);
+    SharedName(const SharedName& rhs) : d_rep(rhs.d_rep)
+    {
+      d_rep->refs++;
+    }
+    SharedName& operator=(const SharedName& rhs)
+    {
+      SharedName tmp(rhs);
+      std::swap(d_rep, tmp.d_rep);
+      return *this;
+    }
+    ~SharedName();
 
+    const char* data() const
+    {
+      return d_rep->data;
+    }
     unsigned int size() const
     {
-      return sizeof(*this) + d_string.size();
+      return d_rep->len;
+    }
+    //! the bytes counter of the cache we are in, see MemRecursorCache::bytes()
+    uint64_t* bytesCounter() const
+    {
+      return d_rep->bytes;
+    }
+  private:
+    struct Rep
+    {
+      uint64_t* bytes;
+      uint32_t refs;
+      uint16_t len;
+      char data[1];
+    };
+    Rep* d_rep;
+  };
+
+  //! compares lowercase wire format names, stored or as a string we look up
+  struct NameCompare
+  {
+    static bool less(const char* a, unsigned int alen, const char* b, unsigned int blen)
+    {
+      int res=memcmp(a, b, min(alen, blen));
+      return res ? res < 0 : alen < blen;
+    }
+    bool operator()(const SharedName& a, const SharedName& b) const
+    {
+      return less(a.data(), a.size(), b.data(), b.size());
+    }
+    bool operator()(const SharedName& a, const string& b) const
+    {
+      return less(a.data(), a.size(), b.c_str(), b.size());
+    }
+    bool operator()(const string& a, const SharedName& b) const
+    {
+      return less(a.c_str(), a.size(), b.data(), b.size());
+    }
+  };
+
+  /** all records of an RRset in a single allocation: per record a uint32_t ttd, a uint16_t length and the serialized record.
+      Walk it with first() and next(), changes go through pack() */
+  class RecordBlob
+  {
+  public:
+    RecordBlob() : d_data(0)
+    {}
+    RecordBlob(const RecordBlob& rhs);
+    RecordBlob& operator=(const RecordBlob& rhs)
+    {
+      RecordBlob tmp(rhs);
+      std::swap(d_data, tmp.d_data);
+      return *this;
+    }
+    ~RecordBlob()
+    {
+      delete[] d_data;
+    }
+
+    void pack(const vector<StoredRecord>& records);
+    void unpack(vector<StoredRecord>& records) const;
+    void setTTDs(uint32_t ttd);
+    uint32_t getTTD() const;
+
+    unsigned int bytes() const
+    {
+      uint32_t len=0;
+      if(d_data)
+        memcpy(&len, d_data, sizeof(len));
+      return len;
+    }
+
+    const char* first() const
+    {
+      return d_data ? d_data + sizeof(uint32_t) : 0;
+    }
+    const char* next(const char* record) const
+    {
+      record+=6 + getLength(record);
+      return record < d_data + bytes() ? record : 0;
+    }
+    static uint32_t getTTD(const char* record)
+    {
+      uint32_t ttd;
+      memcpy(&ttd, record, sizeof(ttd));
+      return ttd;
+    }
+    static uint16_t getLength(const char* record)
+    {
+      uint16_t len;
+      memcpy(&len, record+4, sizeof(len));
+      return len;
+    }
+    static const char* getData(const char* record)
+    {
+      return record+6;
     }
 
+  private:
+    char* d_data; //!< the uint32_t size of the whole allocation, then the records. 0 if there are none
   };
 
+  /** Copies of an entry add what they allocate to the bytes counter of the cache, and take it off again when they are
+      destroyed, so MemRecursorCache::bytes() stays accurate whichever way entries leave the cache. This is why
+      d_records and d_scoped only change through setRecords() and setScoped() */
   struct CacheEntry
   {
-    CacheEntry(const tuple<string, uint16_t>& key, const vector<StoredRecord>& records, bool auth) : 
-      d_qname(key.get<0>()), d_qtype(key.get<1>()), d_auth(auth), d_records(records)
+    CacheEntry(const SharedName& qname, uint16_t qtype, bool auth) : d_qname(qname), d_qtype(qtype), d_auth(auth), d_scoped(0)
     {}
+    CacheEntry(const CacheEntry& rhs);
+    CacheEntry& operator=(const CacheEntry& rhs);
+    ~CacheEntry();
 
-    typedef vector<StoredRecord> records_t;
+    typedef RecordBlob records_t;
+    //! answers that were only valid for a subnet of clients (EDNS Client Subnet), the longest netmask first
+    typedef vector<pair<Netmask, records_t> > scoped_t;
 
     uint32_t getTTD() const
     {
-      if(d_records.size()==1)
-        return d_records.begin()->d_ttd;
-
-      uint32_t earliest=std::numeric_limits<uint32_t>::max();
-      for(records_t::const_iterator i=d_records.begin(); i != d_records.end(); ++i)
-        earliest=min(earliest, i->d_ttd);
+      uint32_t earliest=d_records.getTTD();
+      if(d_scoped)
+        for(scoped_t::const_iterator i=d_scoped->begin(); i != d_scoped->end(); ++i)
+          earliest=min(earliest, i->second.getTTD());
       return earliest;
     }
 
-    string d_qname;
+    const records_t& getRecords(const ComboAddress* who, bool* wasScoped) const;
+    void setRecords(const vector<StoredRecord>& records);
+    void setScoped(scoped_t& scoped); //!< takes the contents of scoped
+    unsigned int heapBytes() const;
+
+    SharedName d_qname;
     uint16_t d_qtype;
     bool d_auth;
     records_t d_records;
+    scoped_t* d_scoped; //!< 0 unless there are answers for subnets, which is rare
   };
 
   typedef multi_index_container<
@@ -93,22 +227,44 @@ private:
                 ordered_unique<
                       composite_key< 
                         CacheEntry,
-                        member<CacheEntry,string,&CacheEntry::d_qname>,
+                        member<CacheEntry,SharedName,&CacheEntry::d_qname>,
                         member<CacheEntry,uint16_t,&CacheEntry::d_qtype>
                       >,
-                      composite_key_compare<CIStringCompare, std::less<uint16_t> >
+                      composite_key_compare<NameCompare, std::less<uint16_t> >
                 >,
                sequenced<>
                >
   > cache_t;
 
+  uint64_t d_bytes; //!< what the entries allocated, see CacheEntry. Declared before d_cache, which uses it until it is gone
   cache_t d_cache;
   pair<cache_t::iterator, cache_t::iterator> d_cachecache;
   string d_cachedqname;
   bool d_cachecachevalid;
-  bool attemptToRefreshNSTTL(const QType& qt, const set<DNSResourceRecord>& content, const CacheEntry& stored);
+  string d_lookupName; //!< lowercase wire format of the name we are looking for, reused to save allocations
+  void setLookupName(const string& qname);
+  SharedName getSharedName();
+  bool attemptToRefreshNSTTL(const QType& qt, const set<DNSResourceRecord>& content, bool auth, const vector<StoredRecord>& records);
+  void replaceScoped(time_t now, cache_t::iterator stored, const set<DNSResourceRecord>& content, const Netmask& scope);
 };
 string DNSRR2String(const DNSResourceRecord& rr);
+
+// helpers for the binary cache dumps, which are length prefixed and in host byte order since they are only read back on the same machine
+template<typename T> bool getBinaryCacheValue(const char*& ptr, const char* end, T& val)
+{
+  if((size_t)(end-ptr) < sizeof(val))
+    return false;
+  memcpy(&val, ptr, sizeof(val));
+  ptr+=sizeof(val);
+  return true;
+}
+bool getBinaryCacheString(const char*& ptr, const char* end, string& str);
+template<typename T> void putBinaryCacheValue(FILE* fp, const T& val)
+{
+  fwrite(&val, sizeof(val), 1, fp);
+}
+void putBinaryCacheString(FILE* fp, const string& str);
+
 DNSResourceRecord String2DNSRR(const string& qname, const QType& qt, const string& serial, uint32_t ttd);
 
 #endif
@@ -234,7 +234,7 @@ string reloadAuthAndForwards()
   
     for(SyncRes::domainmap_t::const_iterator i = t_sstorage->domainmap->begin(); i != t_sstorage->domainmap->end(); ++i) {
       for(SyncRes::AuthDomain::records_t::const_iterator j = i->second.d_records.begin(); j != i->second.d_records.end(); ++j) 
-	broadcastAccFunction<uint64_t>(boost::bind(pleaseWipeCache, j->qname));
+	broadcastAccFunction<uint64_t>(boost::bind(pleaseWipeCache, j->qname, false));
     }
 
     string configname=::arg()["config-dir"]+"/recursor.conf";
@@ -253,7 +253,7 @@ string reloadAuthAndForwards()
     // purge again - new zones need to blank out the cache
     for(SyncRes::domainmap_t::const_iterator i = newDomainMap->begin(); i != newDomainMap->end(); ++i) {
       for(SyncRes::AuthDomain::records_t::const_iterator j = i->second.d_records.begin(); j != i->second.d_records.end(); ++j) 
-	broadcastAccFunction<uint64_t>(boost::bind(pleaseWipeCache, j->qname));
+	broadcastAccFunction<uint64_t>(boost::bind(pleaseWipeCache, j->qname, false));
     }
 
     // this is pretty blunt
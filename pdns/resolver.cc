@@ -296,8 +296,10 @@ AXFRRetriever::AXFRRetriever(const ComboAddress& remote,
 	const string& tsigkeyname,
 	const string& tsigalgorithm, 
 	const string& tsigsecret,
-	const ComboAddress* laddr)
-: d_tsigkeyname(tsigkeyname), d_tsigsecret(tsigsecret), d_tsigPos(0), d_nonSignedMessages(0)
+	const ComboAddress* laddr,
+	const SOAData* ixfrSOA)
+: d_ixfr(ixfrSOA != NULL), d_ixfrSerial(ixfrSOA ? ixfrSOA->serial : 0), d_firstSerial(0), d_receivedBytes(0),
+  d_tsigkeyname(tsigkeyname), d_tsigsecret(tsigsecret), d_tsigPos(0), d_nonSignedMessages(0)
 {
   ComboAddress local;
   if (laddr != NULL) {
@@ -319,8 +321,20 @@ AXFRRetriever::AXFRRetriever(const ComboAddress& remote,
     d_soacount = 0;
   
     vector<uint8_t> packet;
-    DNSPacketWriter pw(packet, domain, QType::AXFR);
+    DNSPacketWriter pw(packet, domain, d_ixfr ? QType::IXFR : QType::AXFR);
     pw.getHeader()->id = dns_random(0xffff);
+
+    if(d_ixfr) { // RFC 1995, 3: the SOA we have goes in the authority section
+      struct soatimes st;
+      st.serial=ixfrSOA->serial;
+      st.refresh=ixfrSOA->refresh;
+      st.retry=ixfrSOA->retry;
+      st.expire=ixfrSOA->expire;
+      st.minimum=ixfrSOA->default_ttl;
+      pw.startRecord(domain, QType::SOA, ixfrSOA->ttl, 1, DNSPacketWriter::AUTHORITY);
+      SOARecordContent(ixfrSOA->nameserver, ixfrSOA->hostmaster, st).toPacket(pw);
+      pw.commit();
+    }
   
     if(!tsigkeyname.empty()) {
       d_trc.d_algoName = tsigalgorithm + ".sig-alg.reg.int.";
@@ -368,7 +382,7 @@ AXFRRetriever::~AXFRRetriever()
 
 int AXFRRetriever::getChunk(Resolver::res_t &res) // Implementation is making sure RFC2845 4.4 is followed.
 {
-  if(d_soacount > 1)
+  if(d_soacount > (d_ixfr ? 2 : 1))
     return false;
 
   // d_sock is connected and is about to spit out a packet
@@ -377,15 +391,42 @@ int AXFRRetriever::getChunk(Resolver::res_t &res) // Implementation is making su
     throw ResolverException("EOF trying to read axfr chunk from remote TCP client");
   
   timeoutReadn(len); 
+  d_receivedBytes+=2+len;
   MOADNSParser mdp(d_buf.get(), len);
 
   int err = parseResult(mdp, "", 0, 0, &res);
+  if(err && d_ixfr) { // NOTIMP, REFUSED and the like: no IXFR from this remote, the caller does an AXFR instead
+    res.clear();
+    d_soacount=3;
+    return false;
+  }
   if(err) 
     throw ResolverException("AXFR chunk with a non-zero rcode "+lexical_cast<string>(err));
 
-  BOOST_FOREACH(const MOADNSParser::answers_t::value_type& answer, mdp.d_answers)
-    if (answer.first.d_type == QType::SOA)
+  bool firstChunk = !d_soacount;
+  unsigned int records=0;
+  BOOST_FOREACH(const MOADNSParser::answers_t::value_type& answer, mdp.d_answers) {
+    if(answer.first.d_type == QType::OPT || answer.first.d_type == QType::TSIG)
+      continue;
+    records++;
+    if (answer.first.d_type != QType::SOA)
+      continue;
+    if(!d_ixfr) {
       d_soacount++;
+      continue;
+    }
+    // an incremental transfer has the new SOA up front, as the start of the last diff and at the end
+    shared_ptr<SOARecordContent> src=boost::dynamic_pointer_cast<SOARecordContent>(answer.first.d_content);
+    uint32_t serial = src ? src->d_st.serial : 0;
+    if(!d_soacount++)
+      d_firstSerial=serial;
+    else if(serial != d_firstSerial)
+      d_soacount--;
+  }
+  if(d_ixfr && d_soacount && !rfc1982LessThan(d_ixfrSerial, d_firstSerial))
+    d_soacount=3; // the remote has nothing newer for us
+  else if(d_ixfr && firstChunk && records == 1 && d_soacount == 1)
+    d_soacount=3; // a lone SOA with a newer serial (RFC 1995, 4), the caller does an AXFR instead
  
   if(!d_tsigkeyname.empty()) { // TSIG verify message
     // If we have multiple messages, we need to concatenate them together. We also need to make sure we know the location of 
@@ -86,9 +86,14 @@ class AXFRRetriever : public boost::noncopyable
         const string& tsigkeyname=string(),
         const string& tsigalgorithm=string(),
         const string& tsigsecret=string(),
-        const ComboAddress* laddr = NULL);
+        const ComboAddress* laddr = NULL,
+        const SOAData* ixfrSOA = NULL);
 	~AXFRRetriever();
     int getChunk(Resolver::res_t &res);  
+    uint64_t getReceivedBytes() const
+    {
+      return d_receivedBytes;
+    }
   
   private:
     void connect();
@@ -100,6 +105,11 @@ class AXFRRetriever : public boost::noncopyable
     int d_sock;
     int d_soacount;
     ComboAddress d_remote;
+
+    bool d_ixfr; // we asked for an IXFR, the transfer ends differently (RFC 1995, 4)
+    uint32_t d_ixfrSerial;
+    uint32_t d_firstSerial;
+    uint64_t d_receivedBytes;
     
     string d_tsigkeyname;
     string d_tsigsecret;
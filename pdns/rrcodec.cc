@@ -0,0 +1,131 @@
+/*
+    PowerDNS Versatile Database Driven Nameserver
+    Copyright (C) 2012  PowerDNS.COM BV
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation
+
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "rrcodec.hh"
+#include <string.h>
+
+namespace {
+const char c_version = 1;
+
+template<typename T> void put(string& out, T val)
+{
+  out.append((const char*)&val, sizeof(val));
+}
+
+void putString(string& out, const string& str)
+{
+  put<uint32_t>(out, str.length());
+  out.append(str);
+}
+
+class Reader
+{
+public:
+  Reader(const string& blob) : d_pos(blob.c_str()), d_end(blob.c_str() + blob.length())
+  {}
+
+  template<typename T> bool get(T& val)
+  {
+    if(d_end - d_pos < (ptrdiff_t)sizeof(val))
+      return false;
+    memcpy(&val, d_pos, sizeof(val));
+    d_pos += sizeof(val);
+    return true;
+  }
+
+  bool getString(string& str)
+  {
+    uint32_t len;
+    if(!get(len) || (uint32_t)(d_end - d_pos) < len)
+      return false;
+    str.assign(d_pos, len);
+    d_pos += len;
+    return true;
+  }
+
+  bool atEnd() const
+  {
+    return d_pos == d_end;
+  }
+
+private:
+  const char* d_pos;
+  const char* d_end;
+};
+}
+
+void encodeResourceRecords(const vector<DNSResourceRecord>& rrs, string& out)
+{
+  string::size_type size = 5;
+  for(vector<DNSResourceRecord>::const_iterator i = rrs.begin(); i != rrs.end(); ++i)
+    size += 40 + i->qname.length() + i->wildcardname.length() + i->content.length();
+  out.reserve(out.length() + size);
+
+  out.append(1, c_version);
+  put<uint32_t>(out, rrs.size());
+  for(vector<DNSResourceRecord>::const_iterator i = rrs.begin(); i != rrs.end(); ++i) {
+    put<uint16_t>(out, i->qtype.getCode());
+    put<uint16_t>(out, i->qclass);
+    put<uint16_t>(out, i->priority);
+    put<uint32_t>(out, i->ttl);
+    put<int32_t>(out, i->domain_id);
+    put<int64_t>(out, i->last_modified);
+    put<uint8_t>(out, i->d_place);
+    put<uint8_t>(out, i->auth);
+    putString(out, i->qname);
+    putString(out, i->wildcardname);
+    putString(out, i->content);
+  }
+}
+
+bool decodeResourceRecords(const string& blob, vector<DNSResourceRecord>& rrs)
+{
+  Reader r(blob);
+  char version;
+  uint32_t count;
+  if(!r.get(version) || version != c_version || !r.get(count) || count > blob.length()) {
+    rrs.clear();
+    return false;
+  }
+
+  rrs.resize(count);
+  for(vector<DNSResourceRecord>::iterator i = rrs.begin(); i != rrs.end(); ++i) {
+    uint16_t qtype;
+    int32_t domain_id;
+    int64_t last_modified;
+    uint8_t place, auth;
+    if(!r.get(qtype) || !r.get(i->qclass) || !r.get(i->priority) || !r.get(i->ttl) || !r.get(domain_id) ||
+       !r.get(last_modified) || !r.get(place) || !r.get(auth) ||
+       !r.getString(i->qname) || !r.getString(i->wildcardname) || !r.getString(i->content)) {
+      rrs.clear();
+      return false;
+    }
+    i->qtype = qtype;
+    i->domain_id = domain_id;
+    i->last_modified = last_modified;
+    i->d_place = (DNSResourceRecord::Place)place;
+    i->auth = auth;
+    i->signttl = 0;
+    i->scopeMask = 0;
+  }
+  if(!r.atEnd()) {
+    rrs.clear();
+    return false;
+  }
+  return true;
+}
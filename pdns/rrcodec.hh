@@ -0,0 +1,38 @@
+/*
+    PowerDNS Versatile Database Driven Nameserver
+    Copyright (C) 2012  PowerDNS.COM BV
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation
+
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#ifndef PDNS_RRCODEC_HH
+#define PDNS_RRCODEC_HH
+
+#include <string>
+#include <vector>
+#include "dns.hh"
+#include "namespaces.hh"
+
+/* Flat binary encoding of DNSResourceRecords, as stored by the UeberBackend in the query cache. A version byte is
+   followed by the number of records, and per record its fixed size fields and the length prefixed qname, wildcardname
+   and content. Numbers are in host byte order, the encoding never leaves the process (or host, for cache snapshots). */
+
+//! appends the encoding of rrs to out
+void encodeResourceRecords(const vector<DNSResourceRecord>& rrs, string& out);
+
+/** replaces the contents of rrs with the records encoded in blob, reusing the strings already in rrs.
+    Returns false, with rrs empty, if blob is not a valid encoding of this version */
+bool decodeResourceRecords(const string& blob, vector<DNSResourceRecord>& rrs);
+
+#endif
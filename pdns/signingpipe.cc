@@ -72,6 +72,7 @@ ChunkedSigningPipe::ChunkedSigningPipe(const std::string& signerName, bool mustS
     d_mustSign(mustSign), d_final(false), d_submitted(0)
 {
   d_rrsetToSign = new rrset_t;
+  d_chunkToSign = new chunk_t;
   d_chunks.push_back(vector<DNSResourceRecord>()); // load an empty chunk
   
   if(!d_mustSign)
@@ -93,6 +94,7 @@ ChunkedSigningPipe::ChunkedSigningPipe(const std::string& signerName, bool mustS
 ChunkedSigningPipe::~ChunkedSigningPipe()
 {
   delete d_rrsetToSign;
+  delete d_chunkToSign;
   if(!d_mustSign)
     return;
   BOOST_FOREACH(int fd, d_sockets) {
@@ -139,8 +141,9 @@ bool ChunkedSigningPipe::submit(const DNSResourceRecord& rr)
   // check if we have a full RRSET to sign
   if(!d_rrsetToSign->empty() && (d_rrsetToSign->begin()->qtype.getCode() != rr.qtype.getCode()  ||  !pdns_iequals(d_rrsetToSign->begin()->qname, rr.qname))) 
   {
-    dedupRRSet();
-    sendRRSetToWorker();
+    queueRRSet();
+    if(d_chunkToSign->size() >= d_maxchunkrecords)
+      sendChunkToWorker();
   }
   d_rrsetToSign->push_back(rr);
   return !d_chunks.empty() && d_chunks.front().size() >= d_maxchunkrecords; // "you can send more"
@@ -195,11 +198,22 @@ void ChunkedSigningPipe::addSignedToChunks(chunk_t* signedChunk)
   }
 }
 
-void ChunkedSigningPipe::sendRRSetToWorker() // it sounds so socialist!
+void ChunkedSigningPipe::queueRRSet()
+{
+  if(d_rrsetToSign->empty())
+    return;
+  dedupRRSet();
+  d_chunkToSign->insert(d_chunkToSign->end(), d_rrsetToSign->begin(), d_rrsetToSign->end());
+  d_rrsetToSign->clear();
+}
+
+/* workers get whole chunks of RRSETs, so addRRSigs can hand all signatures of a chunk made with the same key to
+   DNSCryptoKeyEngine::signBatch() at once */
+void ChunkedSigningPipe::sendChunkToWorker() // it sounds so socialist!
 {
   if(!d_mustSign) {
-    addSignedToChunks(d_rrsetToSign);
-    d_rrsetToSign->clear();
+    addSignedToChunks(d_chunkToSign);
+    d_chunkToSign->clear();
     return;
   }
   
@@ -208,7 +222,7 @@ void ChunkedSigningPipe::sendRRSetToWorker() // it sounds so socialist!
   
   bool wantRead, wantWrite;
   
-  wantWrite = !d_rrsetToSign->empty();
+  wantWrite = !d_chunkToSign->empty();
   wantRead = d_outstanding || wantWrite;  // if we wrote, we want to read
   
   pair<vector<int>, vector<int> > rwVect;
@@ -217,8 +231,8 @@ void ChunkedSigningPipe::sendRRSetToWorker() // it sounds so socialist!
   
   if(wantWrite && !rwVect.second.empty()) {
     random_shuffle(rwVect.second.begin(), rwVect.second.end()); // pick random available worker
-    writen2(*rwVect.second.begin(), &d_rrsetToSign, sizeof(d_rrsetToSign));
-    d_rrsetToSign = new rrset_t;
+    writen2(*rwVect.second.begin(), &d_chunkToSign, sizeof(d_chunkToSign));
+    d_chunkToSign = new chunk_t;
     d_outstanding++;
     d_queued++;
     wantWrite=false;
@@ -261,8 +275,8 @@ void ChunkedSigningPipe::sendRRSetToWorker() // it sounds so socialist!
   if(wantWrite) {  // our optimization above failed, we now wait synchronously
     rwVect = waitForRW(0, wantWrite, -1); // wait for something to happen  
     random_shuffle(rwVect.second.begin(), rwVect.second.end()); // pick random available worker
-    writen2(*rwVect.second.begin(), &d_rrsetToSign, sizeof(d_rrsetToSign));
-    d_rrsetToSign = new rrset_t;
+    writen2(*rwVect.second.begin(), &d_chunkToSign, sizeof(d_chunkToSign));
+    d_chunkToSign = new chunk_t;
     d_outstanding++;
     d_queued++;
   }
@@ -293,8 +307,9 @@ try
       unixDie("reading object pointer to sign from pdns");
     set<string, CIStringCompare> authSet;
     authSet.insert(d_signer);
+    chunk_t::size_type unsignedSize = chunk->size();
     addRRSigs(dk, db, authSet, *chunk);
-    ++d_signed;
+    d_signed += chunk->size() - unsignedSize;
     
     writen2(fd, &chunk, sizeof(chunk));
   }
@@ -308,8 +323,9 @@ catch(std::exception& e)
 
 void ChunkedSigningPipe::flushToSign()
 {
-  sendRRSetToWorker();
-  d_rrsetToSign->clear();
+  queueRRSet();
+  sendChunkToWorker();
+  d_chunkToSign->clear();
 }
 
 vector<DNSResourceRecord> ChunkedSigningPipe::getChunk(bool final)
@@ -32,7 +32,8 @@ public:
 private:
   void flushToSign();	
   void dedupRRSet();
-  void sendRRSetToWorker(); // dispatch RRSET to worker
+  void queueRRSet(); // add the RRSET to the chunk that goes to the next worker
+  void sendChunkToWorker(); // dispatch that chunk to a worker
   void addSignedToChunks(chunk_t* signedChunk);
   pair<vector<int>, vector<int> > waitForRW(bool rd, bool wr, int seconds);
 
@@ -40,6 +41,7 @@ private:
   
   static void* helperWorker(void* p);
   rrset_t* d_rrsetToSign;
+  chunk_t* d_chunkToSign;
   std::deque< std::vector<DNSResourceRecord> > d_chunks;
   string d_signer;
   
@@ -40,30 +40,435 @@
 #include "lua-auth.hh"
 #include "namespaces.hh"
 #include "common_startup.hh"
+#include "ixfr.hh"
+#include "zoneapexes.hh"
+#include "nsec3cache.hh"
 #include <boost/scoped_ptr.hpp>
 using boost::scoped_ptr;
 
-template<typename T> bool rfc1982LessThan(T a, T b)
-{
-  return ((signed)(a - b)) < 0;
-}
-
-void CommunicatorClass::addSuckRequest(const string &domain, const string &master)
+void CommunicatorClass::addSuckRequest(const string &domain, const string &master, int priority)
 {
   Lock l(&d_lock);
   SuckRequest sr;
   sr.domain = domain;
   sr.master = master;
-  pair<UniQueue::iterator, bool>  res;
+  sr.priority = priority;
+  sr.attempts = 0;
+  queueSuckRequest(sr);
+}
 
-  res=d_suckdomains.push_back(sr);
-  
-  if(res.second) {
-    d_suck_sem.post();
+//! needs d_lock. A request that is already queued keeps its place, unless it now has a higher priority
+void CommunicatorClass::queueSuckRequest(const SuckRequest& request)
+{
+  SuckRequest sr(request);
+  domains_by_name_t& nameindex=boost::multi_index::get<IDTag>(d_suckdomains);
+  domains_by_name_t::iterator iter=nameindex.find(sr);
+  if(iter != nameindex.end()) {
+    if(iter->priority >= sr.priority)
+      return;
+    sr.attempts=iter->attempts;
+    nameindex.erase(iter);
+  }
+  sr.order=d_suckorder++;
+  d_suckdomains.insert(sr);
+  S.set("xfr-queue", d_suckdomains.size());
+  pthread_cond_signal(&d_suck_cond);
+}
+
+/** needs d_lock. Picks the first request in priority order whose master is not at its 'max-transfers-per-master' limit,
+    and is not backing off after failed transfers. A master that is backing off gets one transfer at a time to probe it */
+bool CommunicatorClass::pickSuckRequest(SuckRequest& sr)
+{
+  time_t now=time(0);
+  domains_by_priority_t& queue=boost::multi_index::get<QueueTag>(d_suckdomains);
+  for(domains_by_priority_t::iterator iter=queue.begin(); iter != queue.end(); ++iter) {
+    map<string, MasterTransferState>::const_iterator ms=d_masterstates.find(iter->master);
+    if(ms != d_masterstates.end()) {
+      if(d_maxtransferspermaster && ms->second.active >= d_maxtransferspermaster)
+        continue;
+      if(ms->second.failures && (ms->second.nextAttempt > now || ms->second.active))
+        continue;
+    }
+    sr=*iter;
+    queue.erase(iter);
+    d_masterstates[sr.master].active++;
+    d_activetransfers++;
+    S.set("xfr-queue", d_suckdomains.size());
+    S.set("xfr-active", d_activetransfers);
+    return true;
+  }
+  return false;
+}
+
+/** needs d_lock. Failed transfers double the backoff of their master, from 5 seconds up to 5 minutes, and are queued again
+    a few times before we leave the zone to the next refresh cycle */
+void CommunicatorClass::finishSuckRequest(const SuckRequest& sr, bool ok)
+{
+  MasterTransferState& ms=d_masterstates[sr.master];
+  ms.active--;
+  d_activetransfers--;
+  S.set("xfr-active", d_activetransfers);
+
+  if(ok) {
+    ms.failures=0;
+    ms.nextAttempt=0;
+    if(!ms.active)
+      d_masterstates.erase(sr.master);
+    return;
+  }
+
+  S.inc("xfr-failed");
+  ms.failures++;
+  time_t backoff=std::min(300, 5 << std::min(ms.failures-1, 6U));
+  ms.nextAttempt=time(0)+backoff;
+  L<<Logger::Warning<<"Transfer of '"<<sr.domain<<"' from master "<<sr.master<<" failed, "<<ms.failures<<
+    " failure"<<(ms.failures > 1 ? "s" : "")<<" in a row, backing off this master for "<<backoff<<" seconds"<<endl;
+
+  if(sr.attempts < 4) {
+    SuckRequest retry(sr);
+    retry.attempts++;
+    queueSuckRequest(retry);
+  }
+}
+
+namespace {
+  // names at or below a delegation are not authoritative, like the rectify after an AXFR decides
+  bool isBelowDelegation(DNSBackend* db, uint32_t domain_id, const string& domain, string qname)
+  {
+    DNSResourceRecord rr;
+    bool found=false;
+    while(!pdns_iequals(qname, domain)) {
+      db->lookup(QType(QType::NS), qname, 0, domain_id);
+      while(db->get(rr))
+        found=true;
+      if(found || !chopOff(qname))
+        break;
+    }
+    return found;
+  }
+
+  /* Hashes the names of an incoming AXFR on worker threads while the zone is still being received and stored, so the
+     NSEC3 ordernames are mostly known by the time the transfer ends */
+  class AsyncNSEC3Hasher : public boost::noncopyable
+  {
+  public:
+    AsyncNSEC3Hasher(const NSEC3PARAMRecordContent& ns3pr, unsigned int threads) : d_iterations(ns3pr.d_iterations), d_salt(ns3pr.d_salt), d_done(false)
+    {
+      pthread_mutex_init(&d_lock, 0);
+      pthread_cond_init(&d_cond, 0);
+      d_tids.resize(threads);
+      for(unsigned int n = 0; n < threads; ++n)
+        pthread_create(&d_tids[n], 0, workerHelper, this);
+    }
+
+    ~AsyncNSEC3Hasher()
+    {
+      vector<pair<string, string> > ignored;
+      finish(ignored);
+      pthread_cond_destroy(&d_cond);
+      pthread_mutex_destroy(&d_lock);
+    }
+
+    bool matches(const NSEC3PARAMRecordContent& ns3pr) const
+    {
+      return ns3pr.d_iterations == d_iterations && ns3pr.d_salt == d_salt;
+    }
+
+    void add(const string& qname)
+    {
+      d_pending.push_back(qname);
+      if(d_pending.size() >= 256)
+        flush();
+    }
+
+    //! waits for the workers, hashes are (name, raw hash) sorted by name
+    void finish(vector<pair<string, string> >& hashes)
+    {
+      if(d_tids.empty())
+        return;
+      flush();
+      {
+        Lock l(&d_lock);
+        d_done = true;
+      }
+      pthread_cond_broadcast(&d_cond);
+      BOOST_FOREACH(pthread_t tid, d_tids)
+        pthread_join(tid, 0);
+      d_tids.clear();
+
+      hashes.swap(d_hashes);
+      sort(hashes.begin(), hashes.end());
+      hashes.erase(unique(hashes.begin(), hashes.end()), hashes.end());
+    }
+
+  private:
+    void flush()
+    {
+      if(d_pending.empty())
+        return;
+      {
+        Lock l(&d_lock);
+        d_queue.push_back(vector<string>());
+        d_queue.back().swap(d_pending);
+      }
+      pthread_cond_signal(&d_cond);
+    }
+
+    static void* workerHelper(void* p)
+    {
+      static_cast<AsyncNSEC3Hasher*>(p)->worker();
+      return 0;
+    }
+
+    void worker()
+    {
+      vector<string> names;
+      vector<pair<string, string> > hashes;
+      for(;;) {
+        {
+          Lock l(&d_lock);
+          while(d_queue.empty() && !d_done)
+            pthread_cond_wait(&d_cond, &d_lock);
+          if(d_queue.empty())
+            return;
+          names.swap(d_queue.front());
+          d_queue.pop_front();
+        }
+        hashes.clear();
+        BOOST_FOREACH(const string& qname, names)
+          hashes.push_back(make_pair(qname, hashQNameWithSalt(d_iterations, d_salt, qname)));
+        Lock l(&d_lock);
+        d_hashes.insert(d_hashes.end(), hashes.begin(), hashes.end());
+      }
+    }
+
+    unsigned int d_iterations;
+    string d_salt;
+    vector<pthread_t> d_tids;
+    vector<string> d_pending;            //!< only touched by the retrieval thread
+    deque<vector<string> > d_queue;
+    vector<pair<string, string> > d_hashes;
+    pthread_mutex_t d_lock;
+    pthread_cond_t d_cond;
+    bool d_done;
+  };
+
+  //! the names of an incoming AXFR, sorted and deduplicated once the transfer is done
+  struct AXFRNames
+  {
+    AXFRNames() : hasher(0)
+    {}
+
+    void add(const DNSResourceRecord& rr, const string& domain)
+    {
+      if(rr.qtype.getCode() == QType::NS && !pdns_iequals(rr.qname, domain))
+        nsnames.push_back(rr.qname);
+      if(rr.qtype.getCode() == QType::DS)
+        dsnames.push_back(rr.qname);
+      if(rr.qtype.getCode() != QType::RRSIG) { // this excludes us hashing RRSIGs for NSEC(3)
+        // records arrive grouped by name, so this skips most duplicates
+        if(qnames.empty() || qnames.back() != rr.qname) {
+          qnames.push_back(rr.qname);
+          if(hasher)
+            hasher->add(rr.qname);
+        }
+      }
+    }
+
+    static void sortUnique(vector<string>& names)
+    {
+      sort(names.begin(), names.end());
+      names.erase(unique(names.begin(), names.end()), names.end());
+    }
+
+    void sortUnique()
+    {
+      sortUnique(qnames);
+      sortUnique(nsnames);
+      sortUnique(dsnames);
+    }
+
+    //! true if qname, or a name above it, is delegated
+    bool belowDelegation(string qname) const
+    {
+      do {
+        if(binary_search(nsnames.begin(), nsnames.end(), qname))
+          return true;
+      } while(chopOff(qname));
+      return false;
+    }
+
+    vector<string> qnames, nsnames, dsnames;
+    AsyncNSEC3Hasher* hasher;
+  };
+
+  //! hashes[n] becomes the hash of names[n], taken from 'known' where possible
+  void getNSEC3Hashes(const NSEC3PARAMRecordContent& ns3pr, const vector<string>& names, const vector<pair<string, string> >& known, vector<string>& hashes)
+  {
+    hashes.resize(names.size());
+    vector<pair<string, string> >::const_iterator iter = known.begin();
+    for(vector<string>::size_type n = 0; n < names.size(); ++n) {
+      // both are sorted by name, so one walk through 'known' does
+      while(iter != known.end() && iter->first < names[n])
+        ++iter;
+      if(iter != known.end() && iter->first == names[n])
+        hashes[n] = iter->second;
+      else
+        hashes[n] = hashQNameWithSalt(ns3pr.d_iterations, ns3pr.d_salt, names[n]);
+    }
+  }
+}
+
+/** Tries to bring a slave zone up to date with an incremental transfer (RFC 1995), applying the diffs with removeRecord()
+    and feedRecord() in a transaction that leaves the rest of the zone alone. Returns false if a full AXFR is needed instead,
+    for example when the remote only sends full transfers, the backend can't remove records, or delegations change */
+bool CommunicatorClass::ixfrSuck(const string &domain, const ComboAddress& raddr, const SOAData& sd, const DomainInfo& di,
+                                 const string& tsigkeyname, const string& tsigalgorithm, const string& tsigsecret, const ComboAddress* laddr)
+{
+  L<<Logger::Error<<"Initiating IXFR of '"<<domain<<"' from serial "<<sd.serial<<" from remote '"<<raddr.toStringWithPort()<<"'"<<endl;
+  AXFRRetriever retriever(raddr, domain, tsigkeyname, tsigalgorithm, tsigsecret, laddr, &sd);
+
+  Resolver::res_t recs, answers;
+  uint64_t received=0;
+  while(retriever.getChunk(recs)) {
+    S.deposit("xfr-bytes", retriever.getReceivedBytes()-received);
+    received=retriever.getReceivedBytes();
+    BOOST_FOREACH(const DNSResourceRecord& rr, recs) 
+      if(rr.qtype.getCode() != QType::OPT && rr.qtype.getCode() != QType::TSIG) // ignore EDNS0 & TSIG
+        answers.push_back(rr);
+    if(answers.size() > 1 && answers[1].qtype.getCode() != QType::SOA) {
+      L<<Logger::Warning<<"Remote "<<raddr.toStringWithPort()<<" answered IXFR of '"<<domain<<"' with a full transfer, retrying with AXFR"<<endl;
+      return false;
+    }
+  }
+
+  if(answers.empty()) {
+    L<<Logger::Warning<<"Remote "<<raddr.toStringWithPort()<<" refused IXFR of '"<<domain<<"', retrying with AXFR"<<endl;
+    return false;
+  }
+  if(answers.front().qtype.getCode() != QType::SOA || answers.back().qtype.getCode() != QType::SOA)
+    throw ResolverException("IXFR of '"+domain+"' from remote "+raddr.toStringWithPort()+" did not start and end with a SOA");
+
+  SOAData newsd;
+  fillSOAData(answers.front().content, newsd);
+  if(answers.size() == 1) {
+    if(rfc1982LessThan(sd.serial, newsd.serial))
+      return false; // RFC 1995, 4: the remote could not fit the changes in, asks us to do an AXFR
+    L<<Logger::Error<<"IXFR of '"<<domain<<"': remote has nothing newer than serial "<<sd.serial<<endl;
+    di.backend->setFresh(di.id);
+    return true;
+  }
+
+  vector<IXFRDiff> diffs;
+  set<string> names, dsnames;
+  SOAData diffsd;
+  uint32_t serial=sd.serial;
+  size_t n=1, last=answers.size()-1;
+  while(n < last) {
+    IXFRDiff diff;
+    diff.oldSOA=answers[n++];
+    while(n < last && answers[n].qtype.getCode() != QType::SOA)
+      diff.removed.push_back(answers[n++]);
+    if(n == last)
+      throw ResolverException("IXFR of '"+domain+"' from remote "+raddr.toStringWithPort()+" ended halfway through a diff");
+    diff.newSOA=answers[n++];
+    while(n < last && answers[n].qtype.getCode() != QType::SOA)
+      diff.added.push_back(answers[n++]);
+
+    fillSOAData(diff.oldSOA.content, diffsd);
+    diff.fromSerial=diffsd.serial;
+    fillSOAData(diff.newSOA.content, diffsd);
+    diff.toSerial=diffsd.serial;
+    if(diff.fromSerial != serial) {
+      L<<Logger::Warning<<"IXFR of '"<<domain<<"' starts at serial "<<diff.fromSerial<<" instead of "<<serial<<", retrying with AXFR"<<endl;
+      return false;
+    }
+    serial=diff.toSerial;
+
+    for(int pass=0; pass < 2; ++pass) {
+      BOOST_FOREACH(DNSResourceRecord& rr, pass ? diff.added : diff.removed) {
+        uint16_t qtype=rr.qtype.getCode();
+        if(qtype == QType::NSEC || qtype == QType::NSEC3 || qtype == QType::NSEC3PARAM || qtype == QType::RRSIG) {
+          L<<Logger::Warning<<"IXFR of '"<<domain<<"' carries DNSSEC records, retrying with AXFR"<<endl;
+          return false;
+        }
+        if(qtype == QType::NS && !pdns_iequals(rr.qname, domain)) {
+          L<<Logger::Warning<<"IXFR of '"<<domain<<"' changes the delegation of '"<<rr.qname<<"', retrying with AXFR"<<endl;
+          return false;
+        }
+        if(!endsOn(rr.qname, domain))
+          throw ResolverException("Remote "+raddr.toStringWithPort()+" tried to sneak in out-of-zone data '"+rr.qname+"' during IXFR of zone '"+domain+"'");
+        rr.domain_id=di.id;
+        if(qtype == QType::SRV)
+          rr.content = stripDot(rr.content);
+        if(pass) {
+          names.insert(rr.qname);
+          if(qtype == QType::DS)
+            dsnames.insert(rr.qname);
+        }
+      }
+    }
+    diff.oldSOA.domain_id=diff.newSOA.domain_id=di.id;
+    diffs.push_back(diff);
+  }
+  if(serial != newsd.serial) {
+    L<<Logger::Warning<<"IXFR of '"<<domain<<"' ends at serial "<<serial<<" instead of "<<newsd.serial<<", retrying with AXFR"<<endl;
+    return false;
+  }
+
+  di.backend->startTransaction(domain, -1); // -1: keep the zone, we only apply the diffs
+  try {
+    BOOST_FOREACH(const IXFRDiff& diff, diffs) {
+      if(!di.backend->removeRecord(diff.oldSOA)) {
+        L<<Logger::Warning<<"Backend for '"<<domain<<"' can't remove records, retrying with AXFR"<<endl;
+        di.backend->abortTransaction();
+        return false;
+      }
+      BOOST_FOREACH(const DNSResourceRecord& rr, diff.removed) {
+        if(!di.backend->removeRecord(rr)) {
+          L<<Logger::Warning<<"Backend for '"<<domain<<"' could not remove '"<<rr.qname<<"|"<<rr.qtype.getName()<<"', retrying with AXFR"<<endl;
+          di.backend->abortTransaction();
+          return false;
+        }
+      }
+      di.backend->feedRecord(diff.newSOA);
+      BOOST_FOREACH(const DNSResourceRecord& rr, diff.added)
+        di.backend->feedRecord(rr);
+    }
+
+    vector<DNSSECOrderAndAuth> batch;
+    BOOST_FOREACH(const string& qname, names) {
+      DNSSECOrderAndAuth doa;
+      doa.qname = qname;
+      doa.ordering = DNSSECOrderAndAuth::RelativeOrdername;
+      doa.auth = !isBelowDelegation(di.backend, di.id, domain, qname);
+      doa.dsAuth = dsnames.count(qname);
+      batch.push_back(doa);
+    }
+    di.backend->updateDNSSECOrderAndAuthBatch(di.id, domain, batch);
   }
+  catch(...) {
+    L<<Logger::Error<<"Aborting open transaction for domain '"<<domain<<"' IXFR"<<endl;
+    di.backend->abortTransaction();
+    throw;
+  }
+  di.backend->commitTransaction();
+  di.backend->setFresh(di.id);
+  PC.purge(domain+"$");
+  g_nsec3cache.clearIndexes(domain);
+
+  BOOST_FOREACH(const IXFRDiff& diff, diffs)
+    IXJ.addDiff(domain, diff);
+
+  L<<Logger::Error<<"IXFR done for '"<<domain<<"', "<<diffs.size()<<" diffs applied, zone committed with serial number "<<newsd.serial<<endl;
+  if(::arg().mustDo("slave-renotify"))
+    notifyDomain(domain);
+  return true;
 }
 
-void CommunicatorClass::suck(const string &domain,const string &remote)
+/** Transfers a zone from its master, with IXFR if the zone asks for that, with AXFR otherwise. Returns false if the transfer
+    failed in a way that may go away if we try again later. Local problems, like a broken Lua script, don't count */
+bool CommunicatorClass::suck(const string &domain,const string &remote)
 {
   L<<Logger::Error<<"Initiating transfer of '"<<domain<<"' from remote '"<<remote<<"'"<<endl;
   uint32_t domain_id;
@@ -103,12 +508,12 @@ void CommunicatorClass::suck(const string &domain,const string &remote)
 
     if(!B->getDomainInfo(domain, di) || !di.backend) { // di.backend and B are mostly identical
       L<<Logger::Error<<"Can't determine backend for domain '"<<domain<<"'"<<endl;
-      return;
+      return true;
     }
     domain_id=di.id;
 
     Resolver::res_t recs;
-    set<string> nsset, qnames, dsnames, nonterm, delnonterm;
+    AXFRNames names;
     
     ComboAddress raddr(remote, 53);
     
@@ -136,7 +541,7 @@ void CommunicatorClass::suck(const string &domain,const string &remote)
       }
       catch(std::exception& e) {
         L<<Logger::Error<<"Failed to load Lua editing script '"<<scripts[0]<<"' for incoming AXFR of '"<<domain<<"': "<<e.what()<<endl;
-        return;
+        return true;
       }
     }
     
@@ -150,12 +555,43 @@ void CommunicatorClass::suck(const string &domain,const string &remote)
       }
       catch(std::exception& e) {
         L<<Logger::Error<<"Failed to load AXFR source '"<<localaddr[0]<<"' for incoming AXFR of '"<<domain<<"': "<<e.what()<<endl;
-        return;
+        return true;
       }
     } else {
 		  laddr.sin4.sin_family = 0;
     }
 
+    vector<string> ixfr;
+    SOAData sd;
+    sd.db=(DNSBackend *)-1; // force uncached answer
+    if(!pdl && !hadDnssecZone && B->getDomainMetadata(domain, "IXFR", ixfr) && !ixfr.empty() && ixfr[0]=="1" && B->getSOA(domain, sd)) {
+      try {
+        if(ixfrSuck(domain, raddr, sd, di, tsigkeyname, tsigalgorithm, tsigsecret, (laddr.sin4.sin_family == 0) ? NULL : &laddr))
+          return true;
+      }
+      catch(ResolverException &re) {
+        L<<Logger::Warning<<"IXFR of '"<<domain<<"' from remote "<<raddr.toStringWithPort()<<" failed: "<<re.reason<<", retrying with AXFR"<<endl;
+      }
+      catch(AhuException &ae) {
+        L<<Logger::Warning<<"IXFR of '"<<domain<<"' from remote "<<raddr.toStringWithPort()<<" failed: "<<ae.reason<<", retrying with AXFR"<<endl;
+      }
+      catch(std::exception &e) {
+        L<<Logger::Warning<<"IXFR of '"<<domain<<"' from remote "<<raddr.toStringWithPort()<<" failed: "<<e.what()<<", retrying with AXFR"<<endl;
+      }
+    }
+
+    struct timeval start, now;
+    Utility::gettimeofday(&start, 0);
+    CommunicatorClass::TransferTiming tt;
+    tt.when=time(0);
+
+    scoped_ptr<AsyncNSEC3Hasher> hasher;
+    unsigned int hashThreads=::arg().asNum("axfr-hash-threads");
+    if(dnssecZone && haveNSEC3 && !narrow && hashThreads) {
+      hasher.reset(new AsyncNSEC3Hasher(ns3pr, hashThreads));
+      names.hasher=hasher.get();
+    }
+
     AXFRRetriever retriever(raddr, domain.c_str(), tsigkeyname, tsigalgorithm, tsigsecret,
 		(laddr.sin4.sin_family == 0) ? NULL : &laddr);
 
@@ -163,7 +599,10 @@ void CommunicatorClass::suck(const string &domain,const string &remote)
     bool gotNSEC3 = false;
     bool gotOptOutFlag = false;
     unsigned int soa_serial = 0;
+    uint64_t received=0;
     while(retriever.getChunk(recs)) {
+      S.deposit("xfr-bytes", retriever.getReceivedBytes()-received);
+      received=retriever.getReceivedBytes();
       if(first) {
         L<<Logger::Error<<"AXFR started for '"<<domain<<"', transaction started"<<endl;
         di.backend->startTransaction(domain, domain_id);
@@ -213,22 +652,14 @@ void CommunicatorClass::suck(const string &domain,const string &remote)
         if(pdl && pdl->axfrfilter(raddr, domain, *i, out)) {
           BOOST_FOREACH(const DNSResourceRecord& rr, out) {
             di.backend->feedRecord(rr);
-            if(rr.qtype.getCode() == QType::NS && !pdns_iequals(rr.qname, domain)) 
-              nsset.insert(rr.qname);
-            if(rr.qtype.getCode() != QType::RRSIG) // this excludes us hashing RRSIGs for NSEC(3)
-              qnames.insert(rr.qname);
-            if(i->qtype.getCode() == QType::DS)
-              dsnames.insert(i->qname);
+            names.add(rr, domain);
+            tt.records++;
           }
         }
         else {
           di.backend->feedRecord(*i);
-          if(i->qtype.getCode() == QType::NS && !pdns_iequals(i->qname, domain)) 
-            nsset.insert(i->qname);
-          if(i->qtype.getCode() != QType::RRSIG) // this excludes us hashing RRSIGs for NSEC(3)
-            qnames.insert(i->qname);
-          if(i->qtype.getCode() == QType::DS)
-           dsnames.insert(i->qname);
+          names.add(*i, domain);
+          tt.records++;
         }
       }
     }
@@ -239,89 +670,85 @@ void CommunicatorClass::suck(const string &domain,const string &remote)
       haveNSEC3 = false;
     }
 
-    bool doent=true;
-    bool realrr=true;
-    string hashed;
+    Utility::gettimeofday(&now, 0);
+    tt.transfer=makeFloat(now - start);
+    start=now;
 
-    uint32_t maxent = ::arg().asNum("max-ent-entries");
+    // one linear pass over the sorted names decides auth and ordername, and finds the empty non-terminals
+    names.sortUnique();
+    const bool hashed=dnssecZone && haveNSEC3 && !narrow;
+    vector<pair<string, string> > known;
+    if(hasher) {
+      hasher->finish(known);
+      if(!hasher->matches(ns3pr)) // a presigned zone brought its own NSEC3PARAM
+        known.clear();
+    }
+    vector<string> hashes;
+    if(hashed)
+      getNSEC3Hashes(ns3pr, names.qnames, known, hashes);
 
-    dononterm:;
-    BOOST_FOREACH(const string& qname, qnames)
+    vector<DNSSECOrderAndAuth> batch;
+    batch.reserve(names.qnames.size());
+    vector<string> nonterm;
+    for(vector<string>::size_type n = 0; n < names.qnames.size(); ++n)
     {
-      bool auth=true;
-      string shorter(qname);
-
-      if(realrr) {
-        do {
-          if(nsset.count(shorter)) {
-            auth=false;
-            break;
-          }
-        }while(chopOff(shorter));
-      }
+      const string& qname=names.qnames[n];
+      bool auth=!names.belowDelegation(qname);
 
+      DNSSECOrderAndAuth doa;
+      doa.qname = qname;
+      doa.auth = auth;
+      doa.dsAuth = binary_search(names.dsnames.begin(), names.dsnames.end(), qname);
+      bool delegation = !auth || binary_search(names.nsnames.begin(), names.nsnames.end(), qname);
       if(dnssecZone && haveNSEC3)
       {
-        if(!narrow) { 
-          hashed=toLower(toBase32Hex(hashQNameWithSalt(ns3pr.d_iterations, ns3pr.d_salt, qname)));
-          di.backend->updateDNSSECOrderAndAuthAbsolute(domain_id, qname, hashed, auth);
-        }
-        else
-          di.backend->nullifyDNSSECOrderNameAndUpdateAuth(domain_id, qname, auth);
-        if(realrr)
-        {
-          if (dsnames.count(qname))
-            di.backend->setDNSSECAuthOnDsRecord(domain_id, qname);
-          if (!auth || nsset.count(qname)) {
-            di.backend->nullifyDNSSECOrderNameAndAuth(domain_id, qname, "NS");
-            di.backend->nullifyDNSSECOrderNameAndAuth(domain_id, qname, "A");
-            di.backend->nullifyDNSSECOrderNameAndAuth(domain_id, qname, "AAAA");
-          }
+        if(hashed) {
+          doa.ordering = DNSSECOrderAndAuth::AbsoluteOrdername;
+          doa.ordername = toLower(toBase32Hex(hashes[n]));
         }
+        doa.nullifyNS = doa.nullifyAddresses = delegation;
       }
       else // NSEC
       {
-        if(realrr)
-        {
-          di.backend->updateDNSSECOrderAndAuth(domain_id, domain, qname, auth);
-          if (dsnames.count(qname))
-            di.backend->setDNSSECAuthOnDsRecord(domain_id, qname);
-          if (!auth || nsset.count(qname)) {
-            di.backend->nullifyDNSSECOrderNameAndAuth(domain_id, qname, "A");
-            di.backend->nullifyDNSSECOrderNameAndAuth(domain_id, qname, "AAAA");
-          }
-        }
+        doa.ordering = DNSSECOrderAndAuth::RelativeOrdername;
+        doa.nullifyAddresses = delegation;
       }
+      batch.push_back(doa);
 
-      if(auth && realrr && doent)
+      if(auth)
       {
-        shorter=qname;
+        string shorter=qname;
         while(!pdns_iequals(shorter, domain) && chopOff(shorter))
-        {
-          if(!qnames.count(shorter) && !nonterm.count(shorter))
-          {
-            if(!(maxent))
-            {
-              L<<Logger::Error<<"AXFR zone "<<domain<<" has too many empty non terminals."<<endl;
-              nonterm.empty();
-              doent=false;
-              break;
-            }
-            nonterm.insert(shorter);
-            --maxent;
-          }
-        }
+          if(!binary_search(names.qnames.begin(), names.qnames.end(), shorter))
+            nonterm.push_back(shorter);
       }
     }
+    di.backend->updateDNSSECOrderAndAuthBatch(domain_id, domain, batch);
 
-    if(!nonterm.empty() && realrr && doent)
+    AXFRNames::sortUnique(nonterm);
+    if(nonterm.size() > (unsigned int)::arg().asNum("max-ent-entries")) {
+      L<<Logger::Error<<"AXFR zone "<<domain<<" has too many empty non terminals."<<endl;
+      nonterm.clear();
+    }
+
+    set<string> insnonterm(nonterm.begin(), nonterm.end()), delnonterm;
+    if(!nonterm.empty() && di.backend->updateEmptyNonTerminals(domain_id, domain, insnonterm, delnonterm, false) && dnssecZone && haveNSEC3)
     {
-      if(di.backend->updateEmptyNonTerminals(domain_id, domain, nonterm, delnonterm, false))
-      {
-        realrr=false;
-        qnames=nonterm;
-        goto dononterm;
+      // with NSEC the empty non-terminals need nothing more
+      if(hashed)
+        getNSEC3Hashes(ns3pr, nonterm, known, hashes);
+      batch.clear();
+      for(vector<string>::size_type n = 0; n < nonterm.size(); ++n) {
+        DNSSECOrderAndAuth doa;
+        doa.qname = nonterm[n];
+        doa.auth = true;
+        if(hashed) {
+          doa.ordering = DNSSECOrderAndAuth::AbsoluteOrdername;
+          doa.ordername = toLower(toBase32Hex(hashes[n]));
+        }
+        batch.push_back(doa);
       }
+      di.backend->updateDNSSECOrderAndAuthBatch(domain_id, domain, batch);
     }
 
     // now we also need to update the presigned flag and NSEC3PARAM
@@ -358,11 +785,20 @@ void CommunicatorClass::suck(const string &domain,const string &remote)
     di.backend->commitTransaction();
     di.backend->setFresh(domain_id);
     PC.purge(domain+"$");
+    g_nsec3cache.clearIndexes(domain); // the transfer may have kept the serial
+  g_nsec3cache.clearIndexes(domain);
+    if(g_zoneapexes.enabled())
+      g_zoneapexes.add(domain); // a new slave zone only has a SOA from now on
 
+    Utility::gettimeofday(&now, 0);
+    tt.rectify=makeFloat(now - start);
+    setTransferTiming(domain, tt);
 
-    L<<Logger::Error<<"AXFR done for '"<<domain<<"', zone committed with serial number "<<soa_serial<<endl;
+    L<<Logger::Error<<"AXFR done for '"<<domain<<"', zone committed with serial number "<<soa_serial<<", "<<tt.records<<
+      " records, transfer "<<tt.transfer<<" seconds, rectify "<<tt.rectify<<" seconds"<<endl;
     if(::arg().mustDo("slave-renotify"))
       notifyDomain(domain);
+    return true;
   }
   catch(DBException &re) {
     L<<Logger::Error<<"Unable to feed record during incoming AXFR of '"+domain+"': "<<re.reason<<endl;
@@ -392,6 +828,7 @@ void CommunicatorClass::suck(const string &domain,const string &remote)
       di.backend->abortTransaction();
     }
   }
+  return false;
 }
 namespace {
 struct QueryInfo
@@ -506,8 +943,11 @@ void CommunicatorClass::slaveRefresh(PacketHandler *P)
     }
   }
 
-  if(rdomains.empty()) // if we have priority domains, check them first
+  int priority=SuckRequest::Notify;
+  if(rdomains.empty()) { // if we have priority domains, check them first
     B->getUnfreshSlaveInfos(&rdomains);
+    priority=SuckRequest::Refresh;
+  }
     
   DNSSECKeeper dk(B); // NOW HEAR THIS! This DK uses our B backend, so no interleaved access!
   {
@@ -612,13 +1052,13 @@ void CommunicatorClass::slaveRefresh(PacketHandler *P)
         }
         else {
           L<<Logger::Warning<<"Domain '"<< di.zone<<"' is fresh, but RRSIGS differ, so DNSSEC stale"<<endl;
-          addSuckRequest(di.zone, *di.masters.begin());
+          addSuckRequest(di.zone, *di.masters.begin(), priority);
         }
       }
     }
     else {
       L<<Logger::Warning<<"Domain '"<< di.zone<<"' is stale, master serial "<<theirserial<<", our serial "<< ourserial <<endl;
-      addSuckRequest(di.zone, *di.masters.begin());
+      addSuckRequest(di.zone, *di.masters.begin(), priority);
     }
   }
 }  
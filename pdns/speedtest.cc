@@ -1,17 +1,47 @@
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/serialization/vector.hpp>
 #include "dnsparser.hh"
 #include "sstuff.hh"
 #include "misc.hh"
 #include "dnswriter.hh"
 #include "dnsrecords.hh"
 #include <boost/format.hpp>
+#include "rrcodec.hh"
+#include "recpacketcache.hh"
+#include "recursor_cache.hh"
 #include "config.h"
 #ifndef RECURSOR
 #include "statbag.hh"
 StatBag S;
 #endif
+#include "arguments.hh"
+
+ArgvMap& arg()
+{
+  static ArgvMap theArg;
+  return theArg;
+}
+
+unsigned int g_numThreads=1; // MemRecursorCache::doPrune() divides max-cache-entries over the threads
 
 volatile bool g_ret; // make sure the optimizer does not get too smart
 uint64_t g_totalRuns;
+uint64_t g_allocations; // counted by the operator new below, so we see which tests allocate
+
+void* operator new(size_t size) throw(std::bad_alloc)
+{
+  g_allocations++;
+  void* ret=malloc(size ? size : 1);
+  if(!ret)
+    throw std::bad_alloc();
+  return ret;
+}
+
+void operator delete(void* ptr) throw()
+{
+  free(ptr);
+}
 
 volatile bool g_stop;
 
@@ -33,15 +63,17 @@ template<typename C> void doRun(const C& cmd, int mseconds=100)
   
   unsigned int runs=0;
   g_stop=false;
+  uint64_t allocations=g_allocations;
   DTime dt;
   dt.set();
   while(runs++, !g_stop) {
     cmd();
   }
   double delta=dt.udiff()/1000000.0;
-  boost::format fmt("'%s' %.02f seconds: %.1f runs/s, %.02f usec/run");
+  allocations=g_allocations-allocations;
+  boost::format fmt("'%s' %.02f seconds: %.1f runs/s, %.02f usec/run, %.02f allocs/run");
 
-  cerr<< (fmt % cmd.getName() % delta % (runs/delta) % (delta* 1000000.0/runs)) << endl;
+  cerr<< (fmt % cmd.getName() % delta % (runs/delta) % (delta* 1000000.0/runs) % ((double)allocations/runs)) << endl;
   g_totalRuns += runs;
 }
 
@@ -744,6 +776,226 @@ struct StrcasecmpTest
 };
 
 
+static vector<DNSResourceRecord> makeQueryCacheRecords(int records)
+{
+  vector<DNSResourceRecord> rrs;
+  DNSResourceRecord rr;
+  rr.qname="www.powerdns.com";
+  rr.qtype=QType::A;
+  rr.ttl=3600;
+  rr.domain_id=1;
+  for(int n=0; n < records; ++n) {
+    rr.content="1.2.3."+boost::lexical_cast<string>(n);
+    rrs.push_back(rr);
+  }
+  return rrs;
+}
+
+// the two ways the UeberBackend has stored records in the query cache
+struct QueryCacheEncodeTest
+{
+  QueryCacheEncodeTest(int records, bool archive) : d_rrs(makeQueryCacheRecords(records)), d_archive(archive) {}
+
+  string getName() const
+  {
+    return (boost::format("query cache encode %d records with %s") % d_rrs.size() % (d_archive ? "boost archive" : "rrcodec")).str();
+  }
+
+  void operator()() const
+  {
+    if(d_archive) {
+      std::ostringstream ostr;
+      boost::archive::binary_oarchive boa(ostr, boost::archive::no_header);
+      boa << d_rrs;
+      g_ret = ostr.str().empty();
+    }
+    else {
+      string content;
+      encodeResourceRecords(d_rrs, content);
+      g_ret = content.empty();
+    }
+  }
+  vector<DNSResourceRecord> d_rrs;
+  bool d_archive;
+};
+
+struct QueryCacheDecodeTest
+{
+  QueryCacheDecodeTest(int records, bool archive) : d_records(records), d_archive(archive)
+  {
+    vector<DNSResourceRecord> rrs=makeQueryCacheRecords(records);
+    if(archive) {
+      std::ostringstream ostr;
+      boost::archive::binary_oarchive boa(ostr, boost::archive::no_header);
+      boa << rrs;
+      d_content=ostr.str();
+    }
+    else
+      encodeResourceRecords(rrs, d_content);
+  }
+
+  string getName() const
+  {
+    return (boost::format("query cache decode %d records with %s") % d_records % (d_archive ? "boost archive" : "rrcodec")).str();
+  }
+
+  void operator()() const
+  {
+    static vector<DNSResourceRecord> rrs; // reused, like the UeberBackend does
+    if(d_archive) {
+      std::istringstream istr(d_content);
+      boost::archive::binary_iarchive boa(istr, boost::archive::no_header);
+      rrs.clear();
+      boa >> rrs;
+    }
+    else
+      decodeResourceRecords(d_content, rrs);
+    g_ret = rrs.empty();
+  }
+  int d_records;
+  bool d_archive;
+  string d_content;
+};
+
+// the recursor answering from its packet cache, should show 0 allocs/run
+struct PacketCacheHitTest
+{
+  explicit PacketCacheHitTest(int records) : d_records(records), d_now(time(0))
+  {
+    vector<uint8_t> query;
+    DNSPacketWriter qpw(query, "outpost.ds9a.nl", QType::A);
+    qpw.getHeader()->rd=1;
+    qpw.getHeader()->id=htons(4321);
+    d_query.assign((const char*)&*query.begin(), query.size());
+
+    vector<uint8_t> response;
+    DNSPacketWriter pw(response, "outpost.ds9a.nl", QType::A);
+    pw.getHeader()->rd=1;
+    pw.getHeader()->qr=1;
+    for(int records = 0; records < d_records; records++) {
+      pw.startRecord("outpost.ds9a.nl", QType::A, 3600);
+      ARecordContent arc("1.2.3.4");
+      arc.toPacket(pw);
+    }
+    pw.commit();
+    d_pc.insertResponsePacket(string((const char*)&*response.begin(), response.size()), d_now-10, 3600); // so it gets aged
+    d_pc.getResponsePacket(d_query.c_str(), d_query.length(), d_now, &d_response); // the buffer is warm, like in the recursor
+  }
+
+  string getName() const
+  {
+    return (boost::format("packet cache hit with %d a records") % d_records).str();
+  }
+
+  void operator()() const
+  {
+    g_ret = d_pc.getResponsePacket(d_query.c_str(), d_query.length(), d_now, &d_response);
+  }
+  int d_records;
+  time_t d_now;
+  string d_query;
+  mutable RecursorPacketCache d_pc;
+  mutable string d_response;
+};
+
+// what the recursor does per outgoing UDP query, with and without outgoing-socket-pool-size
+struct OutgoingUDPTest
+{
+  explicit OutgoingUDPTest(bool pooled) : d_pooled(pooled), d_packet(32, 0)
+  {
+    d_server=socket(AF_INET, SOCK_DGRAM, 0); // gets the packets, and never reads them. Both sockets live until we exit
+    ComboAddress local("127.0.0.1", 0);
+    if(d_server < 0 || ::bind(d_server, (struct sockaddr*)&local, local.getSocklen()) < 0)
+      throw AhuException("Unable to make a UDP socket for the outgoing UDP test: "+stringerror());
+    socklen_t len=d_dest.getSocklen();
+    getsockname(d_server, (struct sockaddr*)&d_dest, &len);
+
+    d_client=socket(AF_INET, SOCK_DGRAM, 0);
+    Utility::setNonBlocking(d_client);
+  }
+
+  string getName() const
+  {
+    return d_pooled ? "outgoing UDP query from a pooled socket" : "outgoing UDP query from a new connected socket";
+  }
+
+  void operator()() const
+  {
+    if(d_pooled) {
+      g_ret = sendto(d_client, d_packet.c_str(), d_packet.length(), 0, (struct sockaddr*)&d_dest, d_dest.getSocklen()) < 0;
+      return;
+    }
+    int fd=socket(AF_INET, SOCK_DGRAM, 0);
+    ComboAddress local("127.0.0.1", 0);
+    if(::bind(fd, (struct sockaddr*)&local, local.getSocklen()) < 0 || connect(fd, (struct sockaddr*)&d_dest, d_dest.getSocklen()) < 0)
+      throw AhuException("Unable to set up a UDP socket for the outgoing UDP test: "+stringerror());
+    Utility::setNonBlocking(fd);
+    g_ret = send(fd, d_packet.c_str(), d_packet.length(), 0) < 0;
+    close(fd);
+  }
+
+  bool d_pooled;
+  int d_server, d_client;
+  ComboAddress d_dest;
+  string d_packet;
+};
+
+// the recursor's record cache holding a million A records, one operation per run
+struct RecursorCacheTest
+{
+  enum Operation { Insert, Get, Prune };
+  explicit RecursorCacheTest(Operation op) : d_op(op), d_now(time(0)), d_rc(new MemRecursorCache), d_pos(0)
+  {
+    DNSResourceRecord rr;
+    rr.qtype=QType::A;
+    rr.content="1.2.3.4";
+    rr.ttl=d_now + 3600;
+    d_content.insert(rr);
+
+    for(d_pos=0; d_pos < s_entries; ++d_pos)
+      d_rc->replace(d_now, makeName(d_pos), QType(QType::A), d_content, true);
+    d_bytes=d_rc->bytes();
+  }
+
+  static const unsigned int s_entries=1000000;
+
+  const string& makeName(unsigned int n) const
+  {
+    char tmp[32];
+    snprintf(tmp, sizeof(tmp), "host%u.example.net.", n);
+    d_qname.assign(tmp);
+    return d_qname;
+  }
+
+  string getName() const
+  {
+    const char* ops[]={"insert into", "get from", "insert and prune"};
+    return (boost::format("%s record cache of %d entries, %.1f bytes/entry") % ops[d_op] % s_entries % ((double)d_bytes/s_entries)).str();
+  }
+
+  void operator()() const
+  {
+    if(d_op == Get) {
+      g_ret = d_rc->get(d_now, makeName(d_pos++ % s_entries), QType(QType::A), &d_result) > 0;
+      return;
+    }
+    d_rc->replace(d_now, makeName(d_pos++), QType(QType::A), d_content, true);
+    if(d_op == Prune)
+      d_rc->doPrune();
+  }
+
+  Operation d_op;
+  time_t d_now;
+  shared_ptr<MemRecursorCache> d_rc;
+  set<DNSResourceRecord> d_content;
+  mutable set<DNSResourceRecord> d_result;
+  mutable string d_qname;
+  mutable unsigned int d_pos;
+  uint64_t d_bytes;
+};
+
+const unsigned int RecursorCacheTest::s_entries;
+
 struct NOPTest
 {
   string getName() const
@@ -836,6 +1088,26 @@ try
   doRun(SOARecordTest(4));
   doRun(SOARecordTest(64));
 
+  doRun(QueryCacheEncodeTest(1, true));
+  doRun(QueryCacheEncodeTest(1, false));
+  doRun(QueryCacheEncodeTest(8, true));
+  doRun(QueryCacheEncodeTest(8, false));
+  doRun(QueryCacheDecodeTest(1, true));
+  doRun(QueryCacheDecodeTest(1, false));
+  doRun(QueryCacheDecodeTest(8, true));
+  doRun(QueryCacheDecodeTest(8, false));
+
+  doRun(PacketCacheHitTest(1));
+  doRun(PacketCacheHitTest(8));
+
+  doRun(OutgoingUDPTest(false));
+  doRun(OutgoingUDPTest(true));
+
+  ::arg().set("max-cache-entries", "")=lexical_cast<string>(RecursorCacheTest::s_entries);
+  doRun(RecursorCacheTest(RecursorCacheTest::Insert));
+  doRun(RecursorCacheTest(RecursorCacheTest::Get));
+  doRun(RecursorCacheTest(RecursorCacheTest::Prune));
+
   cerr<<"Total runs: " << g_totalRuns<<endl;
 
 }
@@ -0,0 +1,66 @@
+#ifndef PDNS_SPSCQUEUE_HH
+#define PDNS_SPSCQUEUE_HH
+#include <vector>
+#include <boost/utility.hpp>
+
+/** Fixed size queue between exactly one producing and one consuming thread, without locks. The slots are
+    allocated once and reused, so a T that keeps its buffers (like a std::string that is assigned to) costs no
+    allocations once the queue has warmed up.
+
+    The producer fills the slot it gets from prepare() and then calls push(), the consumer reads the slot it
+    gets from front() and then calls pop(). Waking up the consumer is up to the user. */
+template <typename T> class SPSCQueue : public boost::noncopyable
+{
+public:
+  explicit SPSCQueue(unsigned int size) : d_head(0), d_tail(0)
+  {
+    unsigned int slots=1;
+    while(slots < size)
+      slots <<= 1;
+    d_slots.resize(slots);
+    d_mask=slots-1;
+  }
+
+  //! producer: the slot to fill next, or 0 if the queue is full
+  T* prepare()
+  {
+    unsigned int tail=d_tail;
+    __sync_synchronize();
+    if(d_head - tail > d_mask)
+      return 0;
+    return &d_slots[d_head & d_mask];
+  }
+
+  //! producer: hands the slot from prepare() to the consumer
+  void push()
+  {
+    __sync_synchronize(); // the slot is written before the consumer can see it
+    d_head=d_head+1;
+  }
+
+  //! consumer: the oldest slot, or 0 if the queue is empty
+  T* front()
+  {
+    unsigned int head=d_head;
+    __sync_synchronize();
+    if(head == d_tail)
+      return 0;
+    return &d_slots[d_tail & d_mask];
+  }
+
+  //! consumer: gives the slot from front() back to the producer
+  void pop()
+  {
+    __sync_synchronize(); // done reading the slot before the producer can reuse it
+    d_tail=d_tail+1;
+  }
+
+private:
+  std::vector<T> d_slots;
+  unsigned int d_mask;
+  volatile unsigned int d_head; //!< only written by the producer
+  char d_pad[64];               //!< keeps the producer and consumer from sharing a cache line
+  volatile unsigned int d_tail; //!< only written by the consumer
+};
+
+#endif
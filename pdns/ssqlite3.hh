@@ -40,7 +40,8 @@ public:
   int doCommand( const std::string & query )
   {
     result_t result;
-    return doQuery(query, result); // 'result' is necessary to force doQuery to do the work, closing Debian bug 280359
+    doQuery(query, result); // 'result' is necessary to force doQuery to do the work, closing Debian bug 280359
+    return sqlite3_changes(m_pDB);
   }
   
   //! Returns a row from a result set.
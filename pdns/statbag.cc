@@ -170,7 +170,21 @@ StatBag::~StatBag()
     {
       delete i->second;
     }
-  
+  for(map<string,SampledRingBase*>::const_iterator i=d_sampledRings.begin(); i!=d_sampledRings.end(); ++i)
+    delete i->second;
+}
+
+static __thread unsigned int t_statRingShard;
+static pthread_mutex_t s_statRingShardLock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int s_statRingShards;
+
+unsigned int statRingShardId()
+{
+  if(!t_statRingShard) {
+    Lock l(&s_statRingShardLock);
+    t_statRingShard = ++s_statRingShards;
+  }
+  return t_statRingShard - 1;
 }
 
 StatRing::StatRing(unsigned int size)
@@ -253,8 +267,16 @@ void StatBag::declareRing(const string &name, const string &help, unsigned int s
   d_rings[name].setHelp(help);
 }
 
+void StatBag::declareSampledRing(const string &name, const string &help, SampledRingBase *ring)
+{
+  ring->d_help=help;
+  d_sampledRings[name]=ring;
+}
+
 vector<pair<string, unsigned int> > StatBag::getRing(const string &name)
 {
+  if(d_sampledRings.count(name))
+    return d_sampledRings[name]->get();
   return d_rings[name].get();
 }
 
@@ -269,31 +291,44 @@ void StatRing::reset()
 
 void StatBag::resetRing(const string &name)
 {
-  d_rings[name].reset();
+  if(d_sampledRings.count(name))
+    d_sampledRings[name]->reset();
+  else
+    d_rings[name].reset();
 }
 
 void StatBag::resizeRing(const string &name, unsigned int newsize)
 {
-  d_rings[name].resize(newsize);
+  if(d_sampledRings.count(name))
+    d_sampledRings[name]->resize(newsize);
+  else
+    d_rings[name].resize(newsize);
 }
 
 
 unsigned int StatBag::getRingSize(const string &name)
 {
+  if(d_sampledRings.count(name))
+    return d_sampledRings[name]->getSize();
   return d_rings[name].getSize();
 }
 
 
 string StatBag::getRingTitle(const string &name)
 {
+  if(d_sampledRings.count(name))
+    return d_sampledRings[name]->d_help;
   return d_rings[name].getHelp();
 }
 
 vector<string>StatBag::listRings()
 {
   vector<string> ret;
+  for(map<string,SampledRingBase*>::const_iterator i=d_sampledRings.begin();i!=d_sampledRings.end();++i)
+    ret.push_back(i->first);
   for(map<string,StatRing>::const_iterator i=d_rings.begin();i!=d_rings.end();++i)
     ret.push_back(i->first);
+  sort(ret.begin(), ret.end());
   return ret;
 }
 
@@ -23,6 +23,12 @@
 #include <string>
 #include <vector>
 #include "lock.hh"
+#include "iputils.hh"
+#include "qtype.hh"
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/utility.hpp>
 #include "namespaces.hh"
 
 class StatRing
@@ -54,6 +60,279 @@ private:
   string d_help;
 };
 
+//! Returns the index of the per-thread shard this thread writes to in a SampledStatRing
+unsigned int statRingShardId();
+
+//! Compact key for sampled query rings: a case insensitive hash of the qname plus the qtype
+struct QueryRingKey
+{
+  QueryRingKey() : qhash(0), qtype(0) {}
+  QueryRingKey(const string& qname, uint16_t type) : qtype(type)
+  {
+    qhash=2166136261U; // FNV-1a, lowercased on the fly so we don't need a copy
+    for(string::const_iterator i=qname.begin(); i!=qname.end(); ++i) {
+      qhash^=(unsigned char)dns_tolower(*i);
+      qhash*=16777619U;
+    }
+  }
+  bool operator<(const QueryRingKey& rhs) const
+  {
+    if(qhash != rhs.qhash)
+      return qhash < rhs.qhash;
+    return qtype < rhs.qtype;
+  }
+  bool operator==(const QueryRingKey& rhs) const
+  {
+    return qhash==rhs.qhash && qtype==rhs.qtype;
+  }
+  uint32_t qhash;
+  uint16_t qtype;
+};
+
+inline uint32_t statRingHash(const QueryRingKey& key)
+{
+  return key.qhash ^ (key.qtype*2654435761U);
+}
+
+inline uint32_t statRingHash(const ComboAddress& ca)
+{
+  if(ca.sin4.sin_family==AF_INET)
+    return ca.sin4.sin_addr.s_addr*2654435761U;
+  uint32_t ret=0, word;
+  for(int n=0; n < 16; n+=4) {
+    memcpy(&word, ca.sin6.sin6_addr.s6_addr+n, 4);
+    ret=(ret^word)*2654435761U;
+  }
+  return ret;
+}
+
+inline string statRingLabel(const QueryRingKey& key, const string& qname)
+{
+  if(qname.empty())
+    return "#"+boost::lexical_cast<string>(key.qhash)+"/"+QType(key.qtype).getName();
+  return qname+"/"+QType(key.qtype).getName();
+}
+
+inline string statRingLabel(const ComboAddress& ca, const string& label)
+{
+  return ca.toString();
+}
+
+//! Interface through which StatBag manages the different kinds of SampledStatRing
+class SampledRingBase
+{
+public:
+  virtual ~SampledRingBase() {}
+  virtual vector<pair<string,unsigned int> > get() const=0;
+  virtual void reset()=0;
+  virtual void resize(unsigned int newsize)=0;
+  virtual unsigned int getSize() const=0;
+  string d_help;
+};
+
+/** A ring for the hot path of the UDP receiver threads. The configured size is split over one shard per writer
+    thread, each with its own lock, so writers normally never wait for each other. Threads beyond the number of
+    shards share one, which is safe but slower. sample() lets only one in every 'rate' events through, and readers
+    find the top talkers in the shards using a space-saving sketch of bounded size. Counts reported are scaled back
+    up by the sampling rate.
+
+    Keys that can't be printed by themselves (like a QueryRingKey) can be accompanied by a label, which is stored
+    in a small direct mapped table per shard. The label is only (re)assigned if the key in its slot changes, so
+    a steady stream of queries for the same names does not allocate. */
+template<typename T>
+class SampledStatRing : public SampledRingBase
+{
+public:
+  enum {MaxShards=64, SketchSize=1000};
+
+  SampledStatRing(unsigned int size, unsigned int rate, unsigned int shards=1) : d_size(size ? size : 1), d_rate(rate ? rate : 1)
+  {
+    d_numShards=std::max(1U, std::min(shards, (unsigned int)MaxShards));
+    for(unsigned int n=0; n < d_numShards; ++n)
+      d_shards[n]=new Shard(shardSize());
+    pthread_mutex_init(&d_lock, 0);
+  }
+
+  ~SampledStatRing()
+  {
+    for(unsigned int n=0; n < d_numShards; ++n)
+      delete d_shards[n];
+  }
+
+  //! returns true if the current event should be recorded, call this before building the key
+  bool sample()
+  {
+    return !(++getShard()->d_skip % d_rate);
+  }
+
+  void account(const T& key)
+  {
+    Shard* shard=getShard();
+    Lock l(&shard->d_lock);
+    shard->d_slots[shard->d_pos++ % shard->d_slots.size()]=key;
+  }
+
+  void account(const T& key, const string& label)
+  {
+    Shard* shard=getShard();
+    Lock l(&shard->d_lock);
+    shard->d_slots[shard->d_pos++ % shard->d_slots.size()]=key;
+    pair<T,string>& entry=shard->d_labels[statRingHash(key) % shard->d_labels.size()];
+    if(!(entry.first==key) || entry.second.empty()) {
+      entry.first=key;
+      entry.second.assign(label);
+    }
+  }
+
+  vector<pair<string,unsigned int> > get() const
+  {
+    sketch_t sketch;
+    Lock l(&d_lock);
+    vector<T> slots;
+    for(unsigned int n=0; n < d_numShards; ++n) {
+      Shard* shard=d_shards[n];
+      {
+        Lock sl(&shard->d_lock); // copy, so writers don't wait for the sketch
+        unsigned int used=std::min(shard->d_pos, (unsigned int)shard->d_slots.size());
+        slots.assign(shard->d_slots.begin(), shard->d_slots.begin()+used);
+      }
+      for(typename vector<T>::const_iterator i=slots.begin(); i!=slots.end(); ++i)
+        feedSketch(sketch, *i);
+    }
+
+    vector<pair<string,unsigned int> > ret;
+    ret.reserve(sketch.size());
+    typedef typename sketch_t::template nth_index<1>::type bycount_t;
+    const bycount_t& bycount=sketch.template get<1>();
+    for(typename bycount_t::const_reverse_iterator i=bycount.rbegin(); i!=bycount.rend(); ++i)
+      ret.push_back(make_pair(statRingLabel(i->d_key, findLabel(i->d_key)), i->d_count*d_rate));
+    return ret;
+  }
+
+  void reset()
+  {
+    Lock l(&d_lock);
+    for(unsigned int n=0; n < d_numShards; ++n) {
+      Lock sl(&d_shards[n]->d_lock);
+      d_shards[n]->d_pos=0;
+    }
+  }
+
+  void resize(unsigned int newsize)
+  {
+    Lock l(&d_lock);
+    if(!newsize || newsize==d_size)
+      return;
+    d_size=newsize;
+    for(unsigned int n=0; n < d_numShards; ++n) {
+      Shard* shard=d_shards[n];
+      Lock sl(&shard->d_lock);
+      shard->d_slots.clear();
+      shard->d_slots.resize(shardSize());
+      shard->d_labels.clear();
+      shard->d_labels.resize(labelSize(shardSize()));
+      shard->d_pos=0;
+    }
+  }
+
+  unsigned int getSize() const
+  {
+    return d_size;
+  }
+
+private:
+  struct Shard : public boost::noncopyable
+  {
+    Shard(unsigned int size) : d_slots(size), d_labels(labelSize(size)), d_pos(0)
+    {
+      pthread_mutex_init(&d_lock, 0);
+    }
+    ~Shard()
+    {
+      pthread_mutex_destroy(&d_lock);
+    }
+    vector<T> d_slots;
+    vector<pair<T,string> > d_labels;
+    unsigned int d_pos;
+    AtomicCounter d_skip;
+    pthread_mutex_t d_lock; //!< guards all of the above, except d_skip
+  };
+
+  static unsigned int labelSize(unsigned int size)
+  {
+    return std::min(size, (unsigned int)SketchSize);
+  }
+
+  unsigned int shardSize() const
+  {
+    return std::max(1U, (d_size + d_numShards - 1) / d_numShards);
+  }
+
+  struct SketchEntry
+  {
+    T d_key;
+    unsigned int d_count;
+  };
+
+  typedef boost::multi_index::multi_index_container<
+    SketchEntry,
+    boost::multi_index::indexed_by <
+      boost::multi_index::ordered_unique<boost::multi_index::member<SketchEntry, T, &SketchEntry::d_key> >,
+      boost::multi_index::ordered_non_unique<boost::multi_index::member<SketchEntry, unsigned int, &SketchEntry::d_count> >
+    >
+  > sketch_t;
+
+  // space-saving: a key we are not tracking yet takes over the slot of the least popular one, and inherits its count
+  static void feedSketch(sketch_t& sketch, const T& key)
+  {
+    typename sketch_t::iterator iter=sketch.find(key);
+    if(iter!=sketch.end()) {
+      SketchEntry se=*iter;
+      se.d_count++;
+      sketch.replace(iter, se);
+      return;
+    }
+    SketchEntry se;
+    se.d_key=key;
+    se.d_count=1;
+    if(sketch.size() < SketchSize) {
+      sketch.insert(se);
+      return;
+    }
+    typedef typename sketch_t::template nth_index<1>::type bycount_t;
+    bycount_t& bycount=sketch.template get<1>();
+    typename bycount_t::iterator smallest=bycount.begin();
+    se.d_count+=smallest->d_count;
+    bycount.replace(smallest, se);
+  }
+
+  string findLabel(const T& key) const
+  {
+    for(unsigned int n=0; n < d_numShards; ++n) {
+      Shard* shard=d_shards[n];
+      Lock sl(&shard->d_lock);
+      const pair<T,string>& entry=shard->d_labels[statRingHash(key) % shard->d_labels.size()];
+      if(entry.first==key && !entry.second.empty())
+        return entry.second;
+    }
+    return "";
+  }
+
+  //! all shards exist from the start, so this needs no lock
+  Shard* getShard() const
+  {
+    return d_shards[statRingShardId() % d_numShards];
+  }
+
+  Shard* d_shards[MaxShards];
+  unsigned int d_numShards;
+  unsigned int d_size;
+  unsigned int d_rate;
+  mutable pthread_mutex_t d_lock; //!< serialises readers and resize()
+};
+
+typedef SampledStatRing<QueryRingKey> QueryStatRing;
+typedef SampledStatRing<ComboAddress> RemoteStatRing;
 
 //! use this to gather and query statistics
 class StatBag
@@ -61,6 +340,7 @@ class StatBag
   map<string, unsigned int *> d_stats;
   map<string, string> d_keyDescrips;
   map<string,StatRing>d_rings;
+  map<string,SampledRingBase*>d_sampledRings;
   bool d_doRings;
   pthread_mutex_t d_lock;
 
@@ -70,6 +350,7 @@ public:
   void declare(const string &key, const string &descrip=""); //!< Before you can store or access a key, you need to declare it
 
   void declareRing(const string &name, const string &title, unsigned int size=10000);
+  void declareSampledRing(const string &name, const string &title, SampledRingBase *ring); //!< StatBag takes ownership of ring
   vector<pair<string, unsigned int> >getRing(const string &name);
   string getRingTitle(const string &name);
   void ringAccount(const string &name, const string &item)
@@ -81,6 +362,10 @@ public:
   {
     d_doRings=true;
   }
+  bool doingRings() const
+  {
+    return d_doRings;
+  }
 
   vector<string>listRings();
   void resetRing(const string &name);
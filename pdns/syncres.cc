@@ -62,12 +62,17 @@ bool SyncRes::s_log;
 
 bool SyncRes::s_noEDNSPing;
 bool SyncRes::s_noEDNS;
+set<string, CIStringCompare> SyncRes::s_ednsdomains;
+NetmaskGroup SyncRes::s_ednsservers;
+uint8_t SyncRes::s_ecsipv4bits;
+uint8_t SyncRes::s_ecsipv6bits;
+uint16_t SyncRes::s_ednsSubnetOption;
 bool SyncRes::s_doAdditionalProcessing;
 bool SyncRes::s_doAAAAAdditionalProcessing;
 
 SyncRes::SyncRes(const struct timeval& now) :  d_outqueries(0), d_tcpoutqueries(0), d_throttledqueries(0), d_timeouts(0), d_unreachables(0),
         					 d_now(now),
-        					 d_cacheonly(false), d_nocache(false), d_doEDNS0(false) 
+        					 d_cacheonly(false), d_nocache(false), d_doEDNS0(false), d_haveRequestor(false), d_wasVariable(false)
 { 
   if(!t_sstorage) {
     t_sstorage = new StaticStorage();
@@ -240,6 +245,47 @@ void SyncRes::doEDNSDumpAndClose(int fd)
   fclose(fp);
 }
 
+/* if we pass on the subnet of the requestor for qname to server, this is where we truncate its address to the
+   configured number of bits. Nothing goes out if we do not know who is asking */
+bool SyncRes::getEDNSSubnetMask(const string& qname, const ComboAddress& server, Netmask* mask)
+{
+  if(!d_haveRequestor || (s_ednsdomains.empty() && s_ednsservers.empty()))
+    return false;
+
+  bool wanted=s_ednsservers.match(&server);
+  if(!wanted && !s_ednsdomains.empty()) {
+    string name(qname);
+    do {
+      if(s_ednsdomains.count(name)) {
+        wanted=true;
+        break;
+      }
+    } while(chopOff(name));
+  }
+  if(!wanted)
+    return false;
+
+  ComboAddress trunc(d_requestor);
+  uint8_t bits;
+  if(trunc.sin4.sin_family == AF_INET) {
+    bits=s_ecsipv4bits;
+    uint32_t netmask = bits ? htonl(0xFFFFFFFFu << (32-bits)) : 0;
+    trunc.sin4.sin_addr.s_addr &= netmask;
+  }
+  else if(trunc.sin4.sin_family == AF_INET6) {
+    bits=s_ecsipv6bits;
+    uint8_t* bytes=(uint8_t*)&trunc.sin6.sin6_addr.s6_addr;
+    for(unsigned int n=bits/8; n < 16; ++n) 
+      bytes[n] = (n == bits/8) ? (bytes[n] & ~(0xFF >> (bits % 8))) : 0;
+  }
+  else
+    return false;
+  trunc.sin4.sin_port=0;
+
+  *mask=Netmask(trunc, bits);
+  return true;
+}
+
 int SyncRes::asyncresolveWrapper(const ComboAddress& ip, const string& domain, int type, bool doTCP, bool sendRDQuery, struct timeval* now, LWResult* res) 
 {
   /* what is your QUEST?
@@ -277,6 +323,9 @@ int SyncRes::asyncresolveWrapper(const ComboAddress& ip, const string& domain, i
     return asyncresolve(ip, domain, type, doTCP, sendRDQuery, 0, now, res);
   }
 
+  Netmask srcmask;
+  bool doECS=getEDNSSubnetMask(domain, ip, &srcmask);
+
   SyncRes::EDNSStatus* ednsstatus;
   ednsstatus = &t_sstorage->ednsstatus[ip];
 
@@ -307,7 +356,7 @@ int SyncRes::asyncresolveWrapper(const ComboAddress& ip, const string& domain, i
       EDNSLevel = 0;
     }
 
-    ret=asyncresolve(ip, domain, type, doTCP, sendRDQuery, EDNSLevel, now, res);
+    ret=asyncresolve(ip, domain, type, doTCP, sendRDQuery, EDNSLevel, now, res, (doECS && EDNSLevel) ? &srcmask : 0);
     if(ret == 0 || ret < 0) {
       //      cerr<<"Transport error or timeout (ret="<<ret<<"), no change in mode"<<endl;
       return ret;
@@ -606,7 +655,7 @@ bool SyncRes::doCNAMECacheCheck(const string &qname, const QType &qtype, vector<
   
   LOG<<prefix<<qname<<": Looking for CNAME cache hit of '"<<(qname+"|CNAME")<<"'"<<endl;
   set<DNSResourceRecord> cset;
-  if(t_RC->get(d_now.tv_sec, qname,QType(QType::CNAME),&cset) > 0) {
+  if(t_RC->get(d_now.tv_sec, qname,QType(QType::CNAME),&cset, getRequestor(), &d_wasVariable) > 0) {
 
     for(set<DNSResourceRecord>::const_iterator j=cset.begin();j!=cset.end();++j) {
       if(j->ttl>(unsigned int) d_now.tv_sec) {
@@ -678,7 +727,21 @@ bool SyncRes::doCacheCheck(const string &qname, const QType &qtype, vector<DNSRe
   set<DNSResourceRecord> cset;
   bool found=false, expired=false;
 
-  if(t_RC->get(d_now.tv_sec, sqname, sqt, &cset) > 0) {
+  int cached=t_RC->get(d_now.tv_sec, sqname, sqt, &cset, getRequestor(), &d_wasVariable);
+  // the walk up the ancestors is only worth it if the record cache has nothing for us either
+  if(!giveNegative && cached <= 0 && negCacheAncestor(qname, prefix, sqname, sttl)) {
+    res=RCode::NXDomain;
+    giveNegative=true;
+    sqt=QType::SOA;
+    cset.clear();
+    cached=t_RC->get(d_now.tv_sec, sqname, sqt, &cset, getRequestor(), &d_wasVariable);
+  }
+  if(giveNegative)
+    g_stats.negCacheHits++;
+  else
+    g_stats.negCacheMisses++;
+
+  if(cached > 0) {
     LOG<<prefix<<sqname<<": Found cache hit for "<<sqt.getName()<<": ";
     for(set<DNSResourceRecord>::const_iterator j=cset.begin();j!=cset.end();++j) {
       LOG<<j->content;
@@ -712,6 +775,30 @@ bool SyncRes::doCacheCheck(const string &qname, const QType &qtype, vector<DNSRe
   return false;
 }
 
+/* nothing exists below a name that does not exist (RFC 8020), so an NXDOMAIN for an ancestor answers for qname too.
+   If so, sqname becomes the name of the SOA to answer with, and sttl how long the NXDOMAIN still lasts */
+bool SyncRes::negCacheAncestor(const string& qname, const string& prefix, string& sqname, uint32_t& sttl)
+{
+  if(t_sstorage->negcache.empty())
+    return false;
+
+  string ancestor;
+  QType whole(0);
+  for(string::size_type pos=qname.find('.'); pos != string::npos && pos+1 < qname.size(); pos=qname.find('.', pos+1)) {
+    ancestor.assign(qname, pos+1, string::npos);
+    negcache_t::iterator ni=t_sstorage->negcache.find(tie(ancestor, whole));
+    if(ni != t_sstorage->negcache.end() && (uint32_t)d_now.tv_sec < ni->d_ttd) {
+      sttl=ni->d_ttd - d_now.tv_sec;
+      LOG<<prefix<<qname<<": Ancestor '"<<ancestor<<"' is negatively cached via '"<<ni->d_qname<<"' for another "<<sttl<<" seconds"<<endl;
+      sqname=ni->d_qname;
+      moveCacheItemToBack(t_sstorage->negcache, ni);
+      g_stats.negCacheAncestorHits++;
+      return true;
+    }
+  }
+  return false;
+}
+
 bool SyncRes::moreSpecificThan(const string& a, const string &b)
 {
   static string dot(".");
@@ -964,6 +1051,7 @@ int SyncRes::doResolveAt(set<string, CIStringCompare> nameservers, string auth,
 
       typedef map<pair<string, QType>, set<DNSResourceRecord>, TCacheComp > tcache_t;
       tcache_t tcache;
+      set<pair<string, QType>, TCacheComp> answerRRsets; // an EDNS Client Subnet scope is only about these
 
       // reap all answers from this packet that are acceptable
       for(LWResult::res_t::iterator i=lwr.d_result.begin();i != lwr.d_result.end();++i) {
@@ -997,6 +1085,8 @@ int SyncRes::doResolveAt(set<string, CIStringCompare> nameservers, string auth,
               rr.content=toLower(rr.content); // this must stay! (the cache can't be case-insensitive on the RHS of records)
             
             tcache[make_pair(i->qname,i->qtype)].insert(rr);
+            if(i->d_place==DNSResourceRecord::ANSWER)
+              answerRRsets.insert(make_pair(i->qname,i->qtype));
           }
         }	  
         else
@@ -1014,7 +1104,10 @@ int SyncRes::doResolveAt(set<string, CIStringCompare> nameservers, string auth,
             ((tcache_t::value_type::second_type::value_type*)&(*j))->ttl=lowestTTL;
         }
 
-        t_RC->replace(d_now.tv_sec, i->first.first, i->first.second, i->second, lwr.d_aabit);
+        bool scoped=lwr.d_haveEDNSScope && answerRRsets.count(i->first);
+        if(scoped) // only good for clients in the scope of the answer, so the packet cache can't have it either
+          d_wasVariable=true;
+        t_RC->replace(d_now.tv_sec, i->first.first, i->first.second, i->second, lwr.d_aabit, scoped ? &lwr.d_ednsScope : 0);
       }
       set<string, CIStringCompare> nsset;  
       LOG<<prefix<<qname<<": determining status after receiving this packet"<<endl;
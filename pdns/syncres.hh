@@ -195,6 +195,19 @@ public:
     d_doEDNS0=state;
   }
 
+  //! the client we resolve for, whose subnet we might pass on with EDNS Client Subnet
+  void setRequestor(const ComboAddress& requestor)
+  {
+    d_requestor=requestor;
+    d_haveRequestor=true;
+  }
+
+  //! if the answer depends on the subnet of the requestor, and should not go into the packet cache
+  bool wasVariable() const
+  {
+    return d_wasVariable;
+  }
+
   int asyncresolveWrapper(const ComboAddress& ip, const string& domain, int type, bool doTCP, bool sendRDQuery, struct timeval* now, LWResult* res);
   
   static void doEDNSDumpAndClose(int fd);
@@ -218,6 +231,7 @@ public:
 
   //  typedef map<string,NegCacheEntry> negcache_t;
 
+  // ordered by labels from the right, so everything below a name directly follows it
   typedef multi_index_container <
     NegCacheEntry,
     indexed_by <
@@ -227,7 +241,7 @@ public:
                     member<NegCacheEntry, string, &NegCacheEntry::d_name>,
                     member<NegCacheEntry, QType, &NegCacheEntry::d_qtype>
            >,
-           composite_key_compare<CIStringCompare, std::less<QType> >
+           composite_key_compare<CICanonicalCompare, std::less<QType> >
        >,
        sequenced<> 
     >
@@ -301,6 +315,11 @@ public:
   static bool s_noEDNSPing;
   static bool s_noEDNS;
 
+  static set<string, CIStringCompare> s_ednsdomains; //!< we send EDNS Client Subnet for names in these zones
+  static NetmaskGroup s_ednsservers;                 //!< and to these servers
+  static uint8_t s_ecsipv4bits, s_ecsipv6bits;
+  static uint16_t s_ednsSubnetOption;
+
   struct AuthDomain
   {
     vector<ComboAddress> d_servers;
@@ -351,6 +370,7 @@ private:
   domainmap_t::const_iterator getBestAuthZone(string* qname);
   bool doCNAMECacheCheck(const string &qname, const QType &qtype, vector<DNSResourceRecord>&ret, int depth, int &res);
   bool doCacheCheck(const string &qname, const QType &qtype, vector<DNSResourceRecord>&ret, int depth, int &res);
+  bool negCacheAncestor(const string& qname, const string& prefix, string& sqname, uint32_t& sttl);
   void getBestNSFromCache(const string &qname, set<DNSResourceRecord>&bestns, bool* flawedNSSet, int depth, set<GetBestNSAnswer>& beenthere);
   void addCruft(const string &qname, vector<DNSResourceRecord>& ret);
   string getBestNSNamesFromCache(const string &qname,set<string, CIStringCompare>& nsset, bool* flawedNSSet, int depth, set<GetBestNSAnswer>&beenthere);
@@ -359,6 +379,11 @@ private:
   inline vector<string> shuffleInSpeedOrder(set<string, CIStringCompare> &nameservers, const string &prefix);
   bool moreSpecificThan(const string& a, const string &b);
   vector<ComboAddress> getAs(const string &qname, int depth, set<GetBestNSAnswer>& beenthere);
+  bool getEDNSSubnetMask(const string& qname, const ComboAddress& server, Netmask* mask);
+  const ComboAddress* getRequestor() const
+  {
+    return d_haveRequestor ? &d_requestor : 0;
+  }
 
 private:
   string d_prefix;
@@ -366,6 +391,9 @@ private:
   bool d_cacheonly;
   bool d_nocache;
   bool d_doEDNS0;
+  bool d_haveRequestor;
+  bool d_wasVariable;
+  ComboAddress d_requestor;
 
   struct GetBestNSAnswer
   {
@@ -387,12 +415,12 @@ extern __thread SyncRes::StaticStorage* t_sstorage;
 class Socket;
 /* external functions, opaque to us */
 int asendtcp(const string& data, Socket* sock);
-int arecvtcp(string& data, int len, Socket* sock);
+int asendrecvtcp(const ComboAddress& remote, const string& query, uint16_t id, string& answer);
 
 
 struct PacketID
 {
-  PacketID() : id(0), type(0), sock(0), inNeeded(0), outPos(0), nearMisses(0), fd(-1)
+  PacketID() : id(0), type(0), sock(0), inNeeded(0), outPos(0), nearMisses(0), fd(-1), nochain(false)
   {
     memset(&remote, 0, sizeof(remote));
   }
@@ -413,6 +441,7 @@ struct PacketID
   typedef set<uint16_t > chain_t;
   mutable chain_t chain;
   int fd;
+  bool nochain; // the answer is only for us, for example because we sent EDNS Client Subnet
 
   bool operator<(const PacketID& b) const
   {
@@ -448,6 +477,7 @@ struct PacketIDBirthdayCompare: public std::binary_function<PacketID, PacketID,
 };
 extern __thread MemRecursorCache* t_RC;
 extern __thread RecursorPacketCache* t_packetCache;
+extern __thread unsigned int t_id;
 typedef MTasker<PacketID,string> MT_t;
 extern __thread MT_t* MT;
 
@@ -473,12 +503,21 @@ struct RecursorStats
   uint64_t overCapacityDrops;
   uint64_t ipv6queries;
   uint64_t chainResends;
+  uint64_t coalescedQueries;
+  uint64_t coalesceQueueFull;
   uint64_t nsSetInvalidations;
   uint64_t ednsPingMatches;
   uint64_t ednsPingMismatches;
   uint64_t noPingOutQueries, noEdnsOutQueries;
   uint64_t packetCacheHits;
   uint64_t noPacketError;
+  uint64_t udpSocketsOpened;
+  uint64_t negCacheHits;
+  uint64_t negCacheAncestorHits;
+  uint64_t negCacheMisses;
+  uint64_t tcpConnectionsOpened;
+  uint64_t tcpConnectionsReused;
+  uint64_t tcpQueriesPipelined;
   time_t startupTime;
   unsigned int maxMThreadStackUsage;
 };
@@ -533,7 +572,6 @@ ComboAddress parseIPAndPort(const std::string& input, uint16_t port);
 ComboAddress getQueryLocalAddress(int family, uint16_t port);
 typedef boost::function<void*(void)> pipefunc_t;
 void broadcastFunction(const pipefunc_t& func, bool skipSelf = false);
-void distributeAsyncFunction(const pipefunc_t& func);
 
 int directResolve(const std::string& qname, const QType& qtype, int qclass, vector<DNSResourceRecord>& ret);
 
@@ -550,6 +588,8 @@ uint64_t* pleaseGetConcurrentQueries();
 uint64_t* pleaseGetThrottleSize();
 uint64_t* pleaseGetPacketCacheHits();
 uint64_t* pleaseGetPacketCacheSize();
-uint64_t* pleaseWipeCache(const std::string& canon);
+uint64_t* pleaseWipeCache(const std::string& canon, bool subtree=false);
+uint64_t* pleaseLoadCache(const std::string& fname);
+string* pleaseGetThreadQueries();
 
 #endif
@@ -46,6 +46,7 @@
 #include "communicator.hh"
 #include "namespaces.hh"
 #include "signingpipe.hh"
+#include "ixfr.hh"
 extern PacketCache PC;
 extern StatBag S;
 
@@ -274,12 +275,18 @@ void *TCPNameserver::doConnection(void *data)
       if(packet->parse(mesg, pktlen)<0)
         break;
       
-      if(packet->qtype.getCode()==QType::AXFR || packet->qtype.getCode()==QType::IXFR ) {
+      if(packet->qtype.getCode()==QType::AXFR) {
         if(doAXFR(packet->qdomain, packet, fd)) 
           S.inc("tcp-answers");  
         continue;
       }
 
+      if(packet->qtype.getCode()==QType::IXFR) {
+        if(doIXFR(packet->qdomain, packet, fd)) 
+          S.inc("tcp-answers");  
+        continue;
+      }
+
       shared_ptr<DNSPacket> reply; 
       shared_ptr<DNSPacket> cached= shared_ptr<DNSPacket>(new DNSPacket);
       if(logDNSQueries)  {
@@ -477,6 +484,27 @@ namespace {
     ret->d_tcp = true;
     return ret;
   }
+
+  //! the serial the client already has, from the SOA in the authority section of its IXFR query (RFC 1995, 3)
+  bool getIXFRClientSerial(shared_ptr<DNSPacket> q, uint32_t* serial)
+  {
+    try {
+      MOADNSParser mdp(q->getString());
+      for(MOADNSParser::answers_t::const_iterator i=mdp.d_answers.begin(); i != mdp.d_answers.end(); ++i) {
+        if(i->first.d_place != DNSRecord::Nameserver || i->first.d_type != QType::SOA)
+          continue;
+        shared_ptr<SOARecordContent> src=boost::dynamic_pointer_cast<SOARecordContent>(i->first.d_content);
+        if(src) {
+          *serial=src->d_st.serial;
+          return true;
+        }
+      }
+    }
+    catch(std::exception& e) {
+      L<<Logger::Warning<<"Unable to parse IXFR query from "<<q->getRemote()<<": "<<e.what()<<endl;
+    }
+    return false;
+  }
 }
 
 
@@ -788,6 +816,107 @@ int TCPNameserver::doAXFR(const string &target, shared_ptr<DNSPacket> q, int out
   return 1;
 }
 
+/** answer an IXFR from the journal, or fall back to a full AXFR if we can't. Return 0 in case of error, 1 in case of success */
+int TCPNameserver::doIXFR(const string &target, shared_ptr<DNSPacket> q, int outsock)
+{
+  uint32_t clientSerial;
+  if(!IXJ.enabled() || !getIXFRClientSerial(q, &clientSerial))
+    return doAXFR(target, q, outsock);
+
+  DNSSECKeeper dk;
+  dk.clearCaches(target);
+  string soaEdit;
+  dk.getFromMeta(target, "SOA-EDIT", soaEdit);
+  // the journal holds unsigned records and the serials from the database, signed zones need their NSEC(3)s and RRSIGs regenerated
+  if(dk.isSecuredZone(target) || !soaEdit.empty()) 
+    return doAXFR(target, q, outsock);
+
+  shared_ptr<DNSPacket> outpacket= getFreshAXFRPacket(q);
+
+  SOAData sd;
+  sd.db=(DNSBackend *)-1; // force uncached answer
+  {
+    Lock l(&s_plock);
+    if(!s_P) {
+      L<<Logger::Error<<"TCP server is without backend connections in doIXFR, launching"<<endl;
+      s_P=new PacketHandler;
+    }
+
+    if(!s_P->getBackend()->getSOA(target, sd) || !canDoAXFR(q)) {
+      L<<Logger::Error<<"IXFR of domain '"<<target<<"' failed: not authoritative"<<endl;
+      outpacket->setRcode(9); // 'NOTAUTH'
+      sendPacket(outpacket,outsock);
+      return 0;
+    }
+  }
+
+  UeberBackend db;
+  sd.db=(DNSBackend *)-1; // force uncached answer
+  if(!db.getSOA(target, sd) || !sd.db || sd.db==(DNSBackend *)-1) {
+    L<<Logger::Error<<"Error determining backend for domain '"<<target<<"' trying to serve an IXFR"<<endl;
+    outpacket->setRcode(RCode::ServFail);
+    sendPacket(outpacket,outsock);
+    return 0;
+  }
+
+  vector<IXFRDiff> diffs;
+  if(rfc1982LessThan(clientSerial, sd.serial) && !sd.db->getIXFRDiffs(sd.domain_id, clientSerial, sd.serial, diffs)) {
+    IXJ.update(sd, sd.db);
+    if(!IXJ.getDiffs(target, clientSerial, sd.serial, diffs)) {
+      L<<Logger::Warning<<"IXFR of domain '"<<target<<"' from serial "<<clientSerial<<" can't be served from the journal, falling back to AXFR"<<endl;
+      return doAXFR(target, q, outsock);
+    }
+  }
+
+  TSIGRecordContent trc;
+  string tsigkeyname, tsigsecret;
+
+  q->getTSIGDetails(&trc, &tsigkeyname, 0);
+
+  if(!tsigkeyname.empty()) {
+    string tsig64, algorithm;
+    Lock l(&s_plock);
+    s_P->getBackend()->getTSIGKey(tsigkeyname, &algorithm, &tsig64);
+    B64Decode(tsig64, tsigsecret);
+  }
+
+  L<<Logger::Error<<"IXFR of domain '"<<target<<"' from serial "<<clientSerial<<" to "<<sd.serial<<" initiated by "<<q->getRemote()<<", "<<diffs.size()<<" diffs"<<endl;
+
+  // RFC 1995, 4: the current SOA, then per diff the old SOA, the removed records, the new SOA and the added records, and the current SOA again.
+  // If the client is up to date, the answer is just the current SOA
+  DNSResourceRecord soa = makeDNSRRFromSOAData(sd);
+  vector<DNSResourceRecord> rrs;
+  rrs.push_back(soa);
+  BOOST_FOREACH(const IXFRDiff& diff, diffs) {
+    rrs.push_back(diff.oldSOA);
+    rrs.insert(rrs.end(), diff.removed.begin(), diff.removed.end());
+    rrs.push_back(diff.newSOA);
+    rrs.insert(rrs.end(), diff.added.begin(), diff.added.end());
+  }
+  if(!diffs.empty())
+    rrs.push_back(soa);
+
+  bool first=true;
+  unsigned int count=0;
+  for(vector<DNSResourceRecord>::iterator rr=rrs.begin(); rr != rrs.end(); ++rr) {
+    rr->d_place=DNSResourceRecord::ANSWER;
+    outpacket->addRecord(*rr);
+    if(++count < 100 && boost::next(rr) != rrs.end())
+      continue;
+
+    if(!tsigkeyname.empty())
+      outpacket->setTSIGDetails(trc, tsigkeyname, tsigsecret, trc.d_mac, !first); // first answer is 'normal'
+    sendPacket(outpacket, outsock);
+    trc.d_mac=outpacket->d_trc.d_mac;
+    outpacket=getFreshAXFRPacket(q);
+    first=false;
+    count=0;
+  }
+
+  L<<Logger::Error<<"IXFR of domain '"<<target<<"' to "<<q->getRemote()<<" finished"<<endl;
+  return 1;
+}
+
 TCPNameserver::~TCPNameserver()
 {
   delete d_connectionroom_sem;
@@ -15,9 +15,6 @@
     along with this program; if not, write to the Free Software
     Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 */
-#include <boost/archive/binary_iarchive.hpp>
-#include <boost/archive/binary_oarchive.hpp>
-
 #include "packetcache.hh"
 #include "utility.hh"
 
@@ -41,7 +38,8 @@
 #include "dnspacket.hh"
 #include "logger.hh"
 #include "statbag.hh"
-#include <boost/serialization/vector.hpp>
+#include "knownnames.hh"
+#include "rrcodec.hh"
 
 
 extern StatBag S;
@@ -59,6 +57,10 @@ pthread_cond_t UeberBackend::d_cond = PTHREAD_COND_INITIALIZER;
 
 int UeberBackend::s_s=-1; // ?
 
+bool UeberBackend::s_fanout=false;
+UeberBackend::BackendLatency *UeberBackend::s_latencies;
+unsigned int UeberBackend::s_numlatencies;
+
 #ifdef NEED_RTLD_NOW
 #define RTLD_NOW RTLD_LAZY
 #endif
@@ -237,19 +239,32 @@ bool UeberBackend::getSOA(const string &domain, SOAData &sd, DNSPacket *p)
     }
   }
     
-  for(vector<DNSBackend *>::const_iterator i=backends.begin();i!=backends.end();++i)
-    if((*i)->getSOA(domain, sd, p)) {
-      DNSResourceRecord rr;
-      rr.qname=domain;
-      rr.qtype=QType::SOA;
-      rr.content=serializeSOAData(sd);
-      rr.ttl=sd.ttl;
-      rr.domain_id=sd.domain_id;
-      vector<DNSResourceRecord> rrs;
-      rrs.push_back(rr);
-      addCache(d_question, rrs);
-      return true;
+  bool found=false;
+  if(s_fanout && backends.size() > 1)
+    found=fanoutSOA(domain, sd, p);
+  else {
+    DTime dt;
+    for(unsigned int n=0; n < backends.size() && !found; ++n) {
+      dt.set();
+      found=backends[n]->getSOA(domain, sd, p);
+      noteLatency(n, dt.udiff());
     }
+  }
+
+  if(found) {
+    DNSResourceRecord rr;
+    rr.qname=domain;
+    rr.qtype=QType::SOA;
+    rr.content=serializeSOAData(sd);
+    rr.ttl=sd.ttl;
+    rr.domain_id=sd.domain_id;
+    vector<DNSResourceRecord> rrs;
+    rrs.push_back(rr);
+    addCache(d_question, rrs);
+    if(g_knownnames.enabled())
+      g_knownnames.noteSOA(domain, sd);
+    return true;
+  }
 
   addNegCache(d_question); 
   return false;
@@ -279,6 +294,13 @@ UeberBackend::UeberBackend(const string &pname)
   stale=false;
 
   backends=BackendMakers().all(pname=="key-only");
+
+  pthread_mutex_lock(&instances_lock);
+  if(!s_latencies) {
+    s_numlatencies=backends.size();
+    s_latencies=new BackendLatency[s_numlatencies];
+  }
+  pthread_mutex_unlock(&instances_lock);
 }
 
 void UeberBackend::die()
@@ -301,6 +323,7 @@ void UeberBackend::cleanup()
 
   pthread_mutex_unlock(&instances_lock);
 
+  stopFanout();
   for_each(backends.begin(),backends.end(),del);
 }
 
@@ -330,14 +353,16 @@ int UeberBackend::cacheHas(const Question &q, vector<DNSResourceRecord> &rrs)
     (*qcachemiss)++;
     return -1;
   }
-  (*qcachehit)++;
-  if(content.empty()) // negatively cached
+  if(content.empty()) { // negatively cached
+    (*qcachehit)++;
     return 0;
-  
-  std::istringstream istr(content);
-  boost::archive::binary_iarchive boa(istr, boost::archive::no_header);
-  rrs.clear();
-  boa >> rrs;
+  }
+
+  if(!decodeResourceRecords(content, rrs)) { // for example from a cache snapshot of an older version
+    (*qcachemiss)++;
+    return -1;
+  }
+  (*qcachehit)++;
   return 1;
 }
 
@@ -358,16 +383,15 @@ void UeberBackend::addCache(const Question &q, const vector<DNSResourceRecord> &
     return;
   
   //  L<<Logger::Warning<<"inserting: "<<q.qname+"|N|"+q.qtype.getName()+"|"+itoa(q.zoneId)<<endl;
-  std::ostringstream ostr;
-  boost::archive::binary_oarchive boa(ostr, boost::archive::no_header);
-
-  BOOST_FOREACH(DNSResourceRecord rr, rrs) {
-    if (rr.ttl < queryttl)
-      queryttl = rr.ttl;
+  unsigned int ttl=queryttl; // not the static, or one short TTL would shorten all later entries
+  BOOST_FOREACH(const DNSResourceRecord& rr, rrs) {
+    if (rr.ttl < ttl)
+      ttl = rr.ttl;
   }
   
-  boa << rrs;
-  PC.insert(q.qname, q.qtype, PacketCache::QUERYCACHE, ostr.str(), queryttl, q.zoneId);
+  string content;
+  encodeResourceRecords(rrs, content);
+  PC.insert(q.qname, q.qtype, PacketCache::QUERYCACHE, content, ttl, q.zoneId);
 }
 
 void UeberBackend::alsoNotifies(const string &domain, set<string> *ips)
@@ -414,6 +438,13 @@ void UeberBackend::lookup(const QType &qtype,const string &qname, DNSPacket *pkt
     stale=true; // please recycle us! 
     throw AhuException("We are stale, please recycle");
   }
+  else if(g_knownnames.enabled() && !g_knownnames.exists(*this, zoneId, qname)) { // may use getSOA(), so before d_question is set
+    static unsigned int *knownfiltered=S.getPointer("known-names-filtered");
+    (*knownfiltered)++;
+    d_negcached=true;
+    d_cached=false;
+    d_answers.clear();
+  }
   else {
     d_question.qtype=qtype;
     d_question.qname=qname;
@@ -422,7 +453,13 @@ void UeberBackend::lookup(const QType &qtype,const string &qname, DNSPacket *pkt
     if(cstat<0) { // nothing
       d_negcached=d_cached=false;
       d_answers.clear(); 
-      (d_handle.d_hinterBackend=backends[d_handle.i++])->lookup(qtype, qname,pkt_p,zoneId);
+      if(s_fanout && backends.size() > 1)
+        fanoutLookup(qtype, qname, pkt_p, zoneId);
+      else {
+        d_handle.d_dt.set();
+        d_handle.d_current=d_handle.i;
+        (d_handle.d_hinterBackend=backends[d_handle.i++])->lookup(qtype, qname,pkt_p,zoneId);
+      }
     } 
     else if(cstat==0) {
       d_negcached=true;
@@ -498,10 +535,12 @@ bool UeberBackend::handle::get(DNSResourceRecord &r)
   DLOG(L << "Ueber get() was called for a "<<qtype.getName()<<" record" << endl);
   bool isMore=false;
   while(d_hinterBackend && !(isMore=d_hinterBackend->get(r))) { // this backend out of answers
+    UeberBackend::noteLatency(d_current, d_dt.udiff()); // also restarts the clock for the next one
     if(i<parent->backends.size()) {
       DLOG(L<<"Backend #"<<i<<" of "<<parent->backends.size()
            <<" out of answers, taking next"<<endl);
       
+      d_current=i;
       d_hinterBackend=parent->backends[i++];
       d_hinterBackend->lookup(qtype,qname,pkt_p,parent->domain_id);
     }
@@ -520,3 +559,211 @@ bool UeberBackend::handle::get(DNSResourceRecord &r)
   i=parent->backends.size(); // don't go on to the next backend
   return true;
 }
+
+void UeberBackend::noteLatency(unsigned int backend, int usec)
+{
+  if(backend >= s_numlatencies)
+    return;
+  int bucket = usec < 1000 ? 0 : usec < 10000 ? 1 : usec < 100000 ? 2 : usec < 1000000 ? 3 : 4;
+  ++s_latencies[backend].d_buckets[bucket];
+}
+
+string UeberBackend::getLatencyReport()
+{
+  static const char *buckets[]={"<1ms", "<10ms", "<100ms", "<1s", ">=1s"};
+  vector<string> names=BackendMakers().getInstances();
+  ostringstream os;
+
+  pthread_mutex_lock(&instances_lock);
+  for(unsigned int n=0; n < s_numlatencies; ++n) {
+    os<<(n < names.size() ? names[n] : "backend "+itoa(n))<<":";
+    for(unsigned int b=0; b < sizeof(buckets)/sizeof(buckets[0]); ++b)
+      os<<" "<<buckets[b]<<" "<<s_latencies[n].d_buckets[b];
+    os<<endl;
+  }
+  pthread_mutex_unlock(&instances_lock);
+  return os.str();
+}
+
+void UeberBackend::fanoutLookup(const QType &qtype, const string &qname, DNSPacket *pkt_p, int zoneId)
+{
+  if(d_fanout.empty())
+    for(unsigned int n=0; n < backends.size(); ++n)
+      d_fanout.push_back(new FanoutWorker(backends[n], n));
+
+  // the first backend goes last, on our own thread, while the others are already busy
+  for(unsigned int n=d_fanout.size(); n-- > 0; )
+    d_fanout[n]->startLookup(qtype, qname, pkt_p, zoneId, !n);
+  for(unsigned int n=1; n < d_fanout.size(); ++n)
+    d_fanout[n]->wait();
+
+  // the same answer a sequential lookup would have given: that of the first backend with records
+  for(vector<FanoutWorker*>::const_iterator i=d_fanout.begin(); i!=d_fanout.end(); ++i) {
+    if((*i)->d_failed)
+      throw DBException((*i)->d_error);
+    if((*i)->d_found) {
+      d_answers.swap((*i)->d_rrs);
+      break;
+    }
+  }
+
+  d_ancount=d_answers.size();
+  if(d_answers.empty()) {
+    if(!qname.empty()) // don't cache axfr
+      addNegCache(d_question);
+    d_negcached=true;
+  }
+  else {
+    addCache(d_question, d_answers);
+    d_cached=true;
+    d_cachehandleiter=d_answers.begin();
+  }
+}
+
+bool UeberBackend::fanoutSOA(const string &domain, SOAData &sd, DNSPacket *p)
+{
+  if(d_fanout.empty())
+    for(unsigned int n=0; n < backends.size(); ++n)
+      d_fanout.push_back(new FanoutWorker(backends[n], n));
+
+  for(unsigned int n=d_fanout.size(); n-- > 0; )
+    d_fanout[n]->startSOA(domain, sd, p, !n);
+  for(unsigned int n=1; n < d_fanout.size(); ++n)
+    d_fanout[n]->wait();
+
+  for(vector<FanoutWorker*>::const_iterator i=d_fanout.begin(); i!=d_fanout.end(); ++i) {
+    if((*i)->d_failed)
+      throw DBException((*i)->d_error);
+    if((*i)->d_found) {
+      sd=(*i)->d_sd;
+      return true;
+    }
+  }
+  return false;
+}
+
+void UeberBackend::stopFanout()
+{
+  for(vector<FanoutWorker*>::const_iterator i=d_fanout.begin(); i!=d_fanout.end(); ++i)
+    delete *i;
+  d_fanout.clear();
+}
+
+UeberBackend::FanoutWorker::FanoutWorker(DNSBackend *db, unsigned int index) : d_found(false), d_failed(false), d_db(db), d_index(index),
+  d_running(false), d_pending(false), d_quit(false), d_soa(false), d_pkt_p(0), d_zoneId(-1)
+{
+  pthread_mutex_init(&d_lock, 0);
+  pthread_cond_init(&d_cond, 0);
+}
+
+UeberBackend::FanoutWorker::~FanoutWorker()
+{
+  pthread_mutex_lock(&d_lock);
+  d_quit=true;
+  pthread_cond_broadcast(&d_cond);
+  pthread_mutex_unlock(&d_lock);
+  if(d_running)
+    pthread_join(d_tid, 0);
+
+  pthread_cond_destroy(&d_cond);
+  pthread_mutex_destroy(&d_lock);
+}
+
+void UeberBackend::FanoutWorker::startLookup(const QType &qtype, const string &qname, DNSPacket *pkt_p, int zoneId, bool here)
+{
+  d_soa=false;
+  d_qtype=qtype;
+  d_qname=qname;
+  d_pkt_p=pkt_p;
+  d_zoneId=zoneId;
+  start(here);
+}
+
+void UeberBackend::FanoutWorker::startSOA(const string &domain, const SOAData &sd, DNSPacket *p, bool here)
+{
+  d_soa=true;
+  d_qname=domain;
+  d_sd=sd;
+  d_pkt_p=p;
+  start(here);
+}
+
+void UeberBackend::FanoutWorker::start(bool here)
+{
+  if(!here) {
+    pthread_mutex_lock(&d_lock);
+    if(!d_running)
+      d_running = !pthread_create(&d_tid, 0, threadHelper, this);
+    if(d_running) {
+      d_pending=true;
+      pthread_cond_broadcast(&d_cond);
+      pthread_mutex_unlock(&d_lock);
+      return;
+    }
+    pthread_mutex_unlock(&d_lock);
+    L<<Logger::Error<<"Unable to start a fan-out thread for backend #"<<d_index<<", asking it sequentially"<<endl;
+  }
+  execute();
+}
+
+void UeberBackend::FanoutWorker::wait()
+{
+  pthread_mutex_lock(&d_lock);
+  while(d_pending)
+    pthread_cond_wait(&d_cond, &d_lock);
+  pthread_mutex_unlock(&d_lock);
+}
+
+void *UeberBackend::FanoutWorker::threadHelper(void *p)
+{
+  FanoutWorker *fw=(FanoutWorker *)p;
+
+  pthread_mutex_lock(&fw->d_lock);
+  for(;;) {
+    while(!fw->d_pending && !fw->d_quit)
+      pthread_cond_wait(&fw->d_cond, &fw->d_lock);
+    if(fw->d_quit)
+      break;
+    pthread_mutex_unlock(&fw->d_lock);
+
+    fw->execute();
+
+    pthread_mutex_lock(&fw->d_lock);
+    fw->d_pending=false;
+    pthread_cond_broadcast(&fw->d_cond);
+  }
+  pthread_mutex_unlock(&fw->d_lock);
+  return 0;
+}
+
+void UeberBackend::FanoutWorker::execute()
+{
+  DTime dt;
+  dt.set();
+  d_found=d_failed=false;
+  d_rrs.clear();
+  try {
+    if(d_soa)
+      d_found=d_db->getSOA(d_qname, d_sd, d_pkt_p);
+    else {
+      DNSResourceRecord rr;
+      d_db->lookup(d_qtype, d_qname, d_pkt_p, d_zoneId);
+      while(d_db->get(rr))
+        d_rrs.push_back(rr);
+      d_found=!d_rrs.empty();
+    }
+  }
+  catch(AhuException &ae) {
+    d_failed=true;
+    d_error=ae.reason;
+  }
+  catch(std::exception &e) {
+    d_failed=true;
+    d_error=e.what();
+  }
+  catch(...) {
+    d_failed=true;
+    d_error="Unknown exception from backend #"+itoa(d_index);
+  }
+  UeberBackend::noteLatency(d_index, dt.udiff());
+}
@@ -98,8 +98,12 @@ public:
     //! The current real backend, which is answering questions
     DNSBackend *d_hinterBackend;
 
-    //! Index of the current backend within the backends vector
+    //! Index of the next backend to ask within the backends vector
     unsigned int i;
+    //! Index of d_hinterBackend
+    unsigned int d_current;
+    //! Since the current backend was asked, for the latency histograms
+    DTime d_dt;
 
     //! DNSPacket who asked this question
     DNSPacket *pkt_p;
@@ -120,6 +124,14 @@ public:
   static DNSBackend *maker(const map<string,string> &);
   static void closeDynListener();
   static void setStatus(const string &st);
+
+  //! ask all backends at the same time, each from its own thread, instead of one after the other
+  static void setFanout(bool fanout)
+  {
+    s_fanout=fanout;
+  }
+  //! latency histograms of the launched backends, one line per backend
+  static string getLatencyReport();
   void getUnfreshSlaveInfos(vector<DomainInfo>* domains);
   void getUpdatedMasters(vector<DomainInfo>* domains);
   bool getDomainInfo(const string &domain, DomainInfo &di);
@@ -156,6 +168,57 @@ private:
   int cacheHas(const Question &q, vector<DNSResourceRecord> &rrs);
   void addNegCache(const Question &q);
   void addCache(const Question &q, const vector<DNSResourceRecord> &rrs);
+
+  /** Runs the lookups and getSOA calls of one of our backends for the fan-out mode. The first backend is
+      called from our own thread, the others each get a thread of their own, started on first use. */
+  class FanoutWorker : public boost::noncopyable
+  {
+  public:
+    FanoutWorker(DNSBackend *db, unsigned int index);
+    ~FanoutWorker();
+    void startLookup(const QType &qtype, const string &qname, DNSPacket *pkt_p, int zoneId, bool here);
+    void startSOA(const string &domain, const SOAData &sd, DNSPacket *p, bool here);
+    void wait(); //!< until the call is done
+
+    bool d_found;
+    SOAData d_sd;
+    vector<DNSResourceRecord> d_rrs;
+    bool d_failed;
+    string d_error; //!< what the backend threw, if d_failed
+  private:
+    static void *threadHelper(void *p);
+    void start(bool here);
+    void execute();
+
+    DNSBackend *d_db;
+    unsigned int d_index;
+    pthread_t d_tid;
+    pthread_mutex_t d_lock;
+    pthread_cond_t d_cond;
+    bool d_running, d_pending, d_quit;
+
+    bool d_soa;
+    QType d_qtype;
+    string d_qname;
+    DNSPacket *d_pkt_p;
+    int d_zoneId;
+  };
+
+  void fanoutLookup(const QType &qtype, const string &qname, DNSPacket *pkt_p, int zoneId);
+  bool fanoutSOA(const string &domain, SOAData &sd, DNSPacket *p);
+  void stopFanout();
+  static void noteLatency(unsigned int backend, int usec);
+
+  vector<FanoutWorker*> d_fanout;
+  static bool s_fanout;
+
+  //! number of calls per backend that took less than 1ms, 10ms, 100ms, 1s, and longer
+  struct BackendLatency
+  {
+    AtomicCounter d_buckets[5];
+  };
+  static BackendLatency *s_latencies;
+  static unsigned int s_numlatencies;
   
   static pthread_mutex_t d_mut;
   static pthread_cond_t d_cond;
@@ -0,0 +1,104 @@
+/*
+    PowerDNS Versatile Database Driven Nameserver
+    Copyright (C) 2012  PowerDNS.COM BV
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation
+
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "zoneapexes.hh"
+#include "lock.hh"
+#include "logger.hh"
+#include <boost/foreach.hpp>
+
+ZoneApexes g_zoneapexes;
+
+ZoneApexes::ZoneApexes() : d_loaded(0), d_ttl(0), d_usable(false)
+{
+  pthread_rwlock_init(&d_lock, 0);
+  pthread_mutex_init(&d_loadlock, 0);
+}
+
+ZoneApexes::~ZoneApexes()
+{
+  pthread_mutex_destroy(&d_loadlock);
+  pthread_rwlock_destroy(&d_lock);
+}
+
+int ZoneApexes::getBestApex(DNSBackend& B, const string& qname, bool notHere, string& apex)
+{
+  time_t now = time(0);
+  bool stale;
+  {
+    ReadLock l(&d_lock);
+    stale = now >= d_loaded + (time_t)d_ttl;
+  }
+
+  // one thread lists the zones, the others keep using the old list, or ask for SOAs until there is one
+  if(stale && !pthread_mutex_trylock(&d_loadlock)) {
+    vector<DomainInfo> domains;
+    try {
+      B.getAllDomains(&domains);
+    }
+    catch(...) {
+      pthread_mutex_unlock(&d_loadlock);
+      throw;
+    }
+    pthread_mutex_unlock(&d_loadlock);
+
+    set<string> apexes;
+    BOOST_FOREACH(const DomainInfo& di, domains)
+      apexes.insert(toLower(di.zone));
+
+    // no zones at all most likely means the backends can't list them
+    if(apexes.empty())
+      L<<Logger::Warning<<"Backends listed no zones, finding zones by their SOA records instead"<<endl;
+    else
+      DLOG(L<<"Loaded "<<apexes.size()<<" zone apexes"<<endl);
+
+    WriteLock l(&d_lock);
+    d_apexes.swap(apexes);
+    d_usable = !d_apexes.empty();
+    d_loaded = now;
+  }
+
+  string name = toLower(qname);
+  if(notHere && !chopOff(name))
+    return 0;
+
+  ReadLock l(&d_lock);
+  if(!d_usable)
+    return -1;
+
+  do {
+    if(d_apexes.count(name)) {
+      apex = qname.substr(qname.length() - name.length()); // in the case of the question, like the SOA walk
+      return 1;
+    }
+  }
+  while(chopOff(name)); // 'www.powerdns.org' -> 'powerdns.org' -> 'org' -> ''
+
+  return 0;
+}
+
+void ZoneApexes::add(const string& zone)
+{
+  WriteLock l(&d_lock);
+  d_apexes.insert(toLower(zone));
+}
+
+void ZoneApexes::clear()
+{
+  WriteLock l(&d_lock);
+  d_loaded = 0;
+}
@@ -0,0 +1,76 @@
+/*
+    PowerDNS Versatile Database Driven Nameserver
+    Copyright (C) 2012  PowerDNS.COM BV
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation
+
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#ifndef PDNS_ZONEAPEXES_HH
+#define PDNS_ZONEAPEXES_HH
+
+#include <string>
+#include <set>
+#include <pthread.h>
+#include <boost/utility.hpp>
+#include "dnsbackend.hh"
+#include "misc.hh"
+#include "namespaces.hh"
+
+/** Remembers the names of all zones, as listed by DNSBackend::getAllDomains(), so PacketHandler::getAuth() can find
+    the zone a name is in by walking up its labels in memory, and then fetch just that one SOA, instead of asking
+    the backends for a SOA at every label.
+
+    Only useful if all launched backends list their zones. The list is reloaded on the first use after
+    'zone-apex-index-ttl' seconds, or after clear(). Zones we learn about in between, for example by a
+    NOTIFY or an AXFR, are added with add(). A zone that has gone away costs a SOA query that fails, after which
+    getAuth() walks up the labels as before. */
+class ZoneApexes : public boost::noncopyable
+{
+public:
+  ZoneApexes();
+  ~ZoneApexes();
+
+  //! 0 disables the index
+  void setTTL(unsigned int ttl)
+  {
+    d_ttl = ttl;
+  }
+
+  bool enabled() const
+  {
+    return d_ttl;
+  }
+
+  /** 1 if a zone encloses qname, and its name in apex, 0 if no zone does, -1 if we don't have a usable list
+      of zones. With notHere, a zone at qname itself doesn't count. B is used to list the zones if needed */
+  int getBestApex(DNSBackend& B, const string& qname, bool notHere, string& apex);
+
+  //! for a zone that was created, or got its SOA, since the zones were listed
+  void add(const string& zone);
+
+  //! lists the zones again on next use
+  void clear();
+
+private:
+  set<string> d_apexes; //!< lowercase
+  pthread_rwlock_t d_lock;
+  pthread_mutex_t d_loadlock;
+  time_t d_loaded;
+  unsigned int d_ttl;
+  bool d_usable;
+};
+
+extern ZoneApexes g_zoneapexes;
+
+#endif